@@ -0,0 +1,127 @@
+/* Fixed against adaptive window length on the host stand-in
+
+   Runs the same RUN_S seconds of scripted workload twice: with fixed
+   windows of CONFIG_STATS_PERIOD_MS, and with the length the monitor picks
+   (CONFIG_STATS_ADAPTIVE). The load is steady but for two incidents: the
+   worker task's load jumping every 200 ms for 10 s, and a short lived task
+   running for 5 s. For each run a JSON object gives the number of windows,
+   the windows that overlap an incident and their mean length, the mean
+   length of the other windows, and the highest share of a core the worker
+   was seen with during its incident (it reaches close to 100).
+
+   The exit status is 1 if the adaptive run takes more windows in all than
+   the fixed one, or fewer than twice as many during the incidents.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "stats_priv.h"
+#include "stats_sink.h"
+#include "fake_sched.h"
+
+#define RUN_S               120
+#define BURST_START_MS      50000   //worker load jumps
+#define BURST_END_MS        60000
+#define BURST_STEP_MS       200
+#define SHORT_START_MS      90000   //short lived task
+#define SHORT_END_MS        95000
+
+typedef struct {
+    const char *mode;
+    uint32_t windows;
+    uint32_t incident_windows;
+    uint64_t incident_ms;
+    uint64_t steady_ms;
+    uint32_t peak_percent;
+} run_result_t;
+
+static TaskHandle_t s_worker;
+static TaskHandle_t s_short;
+static uint32_t s_start_tick;
+static uint32_t s_seed;
+
+static uint32_t next_random(uint32_t range) {
+    s_seed = s_seed * 1103515245 + 12345;
+    return (s_seed >> 8) % range;
+}
+
+static void script(uint32_t tick, void *arg) {
+    uint32_t ms = (tick - s_start_tick) * portTICK_PERIOD_MS;
+    if (ms >= BURST_START_MS && ms < BURST_END_MS && ms % BURST_STEP_MS == 0) {
+        fake_task_set_load(s_worker, next_random(1000));
+    } else if (ms == BURST_END_MS) {
+        fake_task_set_load(s_worker, 400);
+    }
+    if (ms == SHORT_START_MS) {
+        s_short = fake_task_create("ota", 5, 1);
+        fake_task_set_load(s_short, 500);
+    } else if (ms == SHORT_END_MS) {
+        fake_task_delete(s_short);
+    }
+}
+
+static bool overlaps(uint32_t start_ms, uint32_t end_ms, uint32_t from_ms, uint32_t to_ms) {
+    return start_ms < to_ms && end_ms > from_ms;
+}
+
+static run_result_t run(const char *mode, bool adaptive) {
+    run_result_t result = { .mode = mode };
+    s_seed = 1;
+    s_start_tick = fake_sched_tick_count();
+    fake_task_set_load(s_worker, 400);
+    uint32_t start_ms = 0;
+    while (start_ms < RUN_S * 1000) {
+        TickType_t ticks = adaptive ? stats_monitor_next_ticks() : pdMS_TO_TICKS(CONFIG_STATS_PERIOD_MS);
+        stats_window_t window;
+        if (stats_monitor_run_once(ticks) != ESP_OK || stats_get_window(0, &window) != ESP_OK) {
+            break;
+        }
+        uint32_t end_ms = (fake_sched_tick_count() - s_start_tick) * portTICK_PERIOD_MS;
+        bool burst = overlaps(start_ms, end_ms, BURST_START_MS, BURST_END_MS);
+        result.windows++;
+        if (burst || overlaps(start_ms, end_ms, SHORT_START_MS, SHORT_END_MS)) {
+            result.incident_windows++;
+            result.incident_ms += end_ms - start_ms;
+        } else {
+            result.steady_ms += end_ms - start_ms;
+        }
+        for (int i = 0; burst && i < window.task_num; i++) {
+            uint32_t percent = (uint64_t)window.tasks[i].run_time * 100 / window.elapsed;
+            if (strcmp(window.tasks[i].name, "worker") == 0 && percent > result.peak_percent) {
+                result.peak_percent = percent;
+            }
+        }
+        start_ms = end_ms;
+    }
+    printf("{\"mode\":\"%s\",\"seconds\":%d,\"windows\":%u,\"incident_windows\":%u,\"incident_window_ms\":%.0f,"
+           "\"steady_window_ms\":%.0f,\"worker_peak_percent\":%u}\n",
+           mode, RUN_S, (unsigned)result.windows, (unsigned)result.incident_windows,
+           result.incident_windows ? (double)result.incident_ms / result.incident_windows : 0,
+           result.windows > result.incident_windows ?
+           (double)result.steady_ms / (result.windows - result.incident_windows) : 0,
+           (unsigned)result.peak_percent);
+    return result;
+}
+
+int main(void) {
+    fake_sched_reset();
+    TaskHandle_t wifi = fake_task_create("wifi", 23, 0);
+    fake_task_set_load(wifi, 300);
+    TaskHandle_t control = fake_task_create("control", 10, 0);
+    fake_task_set_load(control, 150);
+    s_worker = fake_task_create("worker", 4, 1);
+    fake_sched_set_tick_callback(script, NULL);
+    stats_init();
+    stats_sink_remove(&stats_sink_console);
+    fake_sched_set_current(fake_sched_find_task("stats"));
+
+    run_result_t adaptive = run("adaptive", true);
+    run_result_t fixed = run("fixed", false);
+    if (adaptive.windows > fixed.windows || adaptive.incident_windows < 2 * fixed.incident_windows) {
+        fprintf(stderr, "adaptive windows do not trade steady detail for incident detail\n");
+        return 1;
+    }
+    return 0;
+}
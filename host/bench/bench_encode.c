@@ -0,0 +1,227 @@
+/* Compression of the monitor's window encoding on the host stand-in
+
+   Runs the monitor over a scripted workload of WINDOW_NUM one second windows:
+   tasks whose loads drift and jump, short lived tasks that come and go, stack
+   high water marks that creep down and a heap that is used and freed. The
+   windows are then encoded with several keyframe intervals. For each one a JSON
+   object is written to stdout with the encoded size against a plain binary
+   dump of the same windows (window header plus one stats_task_sample_t per
+   task) and the encode and decode time per window.
+
+   Every stream is decoded again and compared with the original windows; the
+   exit status is 1 if any window differs.
+
+   With --stream FILE the stream with keyframe interval STREAM_KEYFRAME_INTERVAL
+   is also written to FILE, for host/stats_decode.c.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_heap_caps.h"
+#include "stats_priv.h"
+#include "stats_encode.h"
+#include "fake_sched.h"
+
+#define WINDOW_NUM          600
+#define STEADY_TASK_NUM     16
+#define SHORT_TASK_PERIOD   45      //windows between short lived tasks starting
+#define SHORT_TASK_LIFE     7       //windows a short lived task runs
+#define STREAM_KEYFRAME_INTERVAL 30
+
+static const uint32_t s_keyframe_intervals[] = { 1, 10, 30, 60, 300 };
+
+static TaskHandle_t s_steady[STEADY_TASK_NUM];
+static uint32_t s_steady_load[STEADY_TASK_NUM];
+static uint32_t s_steady_stack[STEADY_TASK_NUM];
+static TaskHandle_t s_short;
+static int s_short_num;
+static uint32_t s_seed = 1;
+static stats_window_t s_windows[WINDOW_NUM];
+static stats_window_t s_decoded;
+static stats_encoder_t s_encoder;
+static stats_decoder_t s_decoder;
+
+static uint32_t next_random(uint32_t range) {
+    s_seed = s_seed * 1103515245 + 12345;
+    return (s_seed >> 8) % range;
+}
+
+//Called every simulated tick; changes the workload a little every 100 ms
+static void script(uint32_t tick, void *arg) {
+    if (tick % 100 != 0) {
+        return;
+    }
+    for (int i = 0; i < STEADY_TASK_NUM; i++) {
+        //Loads drift, and now and then jump to a new level
+        if (next_random(50) == 0) {
+            s_steady_load[i] = next_random(120);
+        } else if (next_random(4) == 0) {
+            s_steady_load[i] = s_steady_load[i] + next_random(5) - 2;
+            s_steady_load[i] = s_steady_load[i] > 200 ? 0 : s_steady_load[i];
+        }
+        fake_task_set_load(s_steady[i], s_steady_load[i]);
+        if (next_random(400) == 0 && s_steady_stack[i] > 200) {
+            s_steady_stack[i] -= 4 * (1 + next_random(16));
+            fake_task_set_stack_high_water_mark(s_steady[i], s_steady_stack[i]);
+        }
+    }
+    fake_task_set_state(s_steady[next_random(STEADY_TASK_NUM)], next_random(2) ? eReady : eBlocked);
+
+    uint32_t window = tick / 1000;
+    if (tick % 1000 == 500 && window % SHORT_TASK_PERIOD == 0) {
+        char name[configMAX_TASK_NAME_LEN];
+        snprintf(name, sizeof(name), "job%d", s_short_num++);
+        s_short = fake_task_create(name, 5, next_random(portNUM_PROCESSORS));
+        fake_task_set_load(s_short, 300 + next_random(400));
+    } else if (tick % 1000 == 500 && window % SHORT_TASK_PERIOD == SHORT_TASK_LIFE && s_short != NULL) {
+        fake_task_delete(s_short);
+        s_short = NULL;
+    }
+
+    size_t free_size = 180000 - next_random(20000);
+    fake_heap_set(MALLOC_CAP_INTERNAL, free_size, 150000, free_size / 2 + next_random(1000));
+}
+
+static void record_windows(void) {
+    fake_sched_reset();
+    static const char *names[STEADY_TASK_NUM] = {
+        "wifi", "tcpip", "mqtt", "http", "sensor", "control", "logger", "ota",
+        "display", "touch", "audio", "ble", "storage", "watchdog", "ipc", "app_main",
+    };
+    for (int i = 0; i < STEADY_TASK_NUM; i++) {
+        s_steady[i] = fake_task_create(names[i], 1 + i % 22, i % 3 == 2 ? tskNO_AFFINITY : i % 2);
+        s_steady_load[i] = next_random(120);
+        s_steady_stack[i] = 600 + next_random(3000);
+        fake_task_set_stack_high_water_mark(s_steady[i], s_steady_stack[i]);
+    }
+    fake_sched_set_tick_callback(script, NULL);
+
+    stats_init();
+    fake_sched_set_current(fake_sched_find_task("stats"));
+
+    //The monitor prints every window; keep stdout for the results
+    fflush(stdout);
+    int stdout_fd = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+    for (int i = 0; i < WINDOW_NUM; i++) {
+        stats_monitor_run_once(pdMS_TO_TICKS(1000));
+        stats_get_window(0, &s_windows[i]);
+    }
+    fflush(stdout);
+    dup2(stdout_fd, STDOUT_FILENO);
+    close(stdout_fd);
+}
+
+static const stats_task_sample_t *find_task(const stats_window_t *window, uint32_t task_id) {
+    for (int i = 0; i < window->task_num; i++) {
+        if (window->tasks[i].task_id == task_id) {
+            return &window->tasks[i];
+        }
+    }
+    return NULL;
+}
+
+static bool same_window(const stats_window_t *a, const stats_window_t *b) {
+    if (a->seq != b->seq || a->elapsed != b->elapsed || a->task_num != b->task_num ||
+        memcmp(a->state_count, b->state_count, sizeof(a->state_count)) != 0 ||
+        a->inherited_num != b->inherited_num || a->starved_num != b->starved_num ||
+        memcmp(a->heap, b->heap, sizeof(a->heap)) != 0) {
+        return false;
+    }
+    //Decoded tasks are ordered by id
+    for (int i = 0; i < a->task_num; i++) {
+        const stats_task_sample_t *x = &a->tasks[i], *y = find_task(b, x->task_id);
+        if (y == NULL || strncmp(x->name, y->name, sizeof(x->name)) != 0 || x->status != y->status ||
+            x->state != y->state || x->priority != y->priority || x->base_priority != y->base_priority ||
+            x->core != y->core || x->ready != y->ready || x->starved != y->starved ||
+            x->run_time != y->run_time || x->run_time_accumulated != y->run_time_accumulated ||
+            x->percentage != y->percentage || x->min_stack != y->min_stack) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+    const char *stream_path = NULL;
+    if (argc == 3 && strcmp(argv[1], "--stream") == 0) {
+        stream_path = argv[2];
+    } else if (argc != 1) {
+        fprintf(stderr, "usage: %s [--stream FILE]\n", argv[0]);
+        return 2;
+    }
+    record_windows();
+
+    size_t raw_bytes = 0;
+    for (int i = 0; i < WINDOW_NUM; i++) {
+        raw_bytes += offsetof(stats_window_t, tasks) + sizeof(s_windows[i].heap) +
+                     s_windows[i].task_num * sizeof(stats_task_sample_t);
+    }
+
+    uint8_t *stream = malloc(WINDOW_NUM * STATS_ENCODE_SIZE_MAX);
+    bool ok = true;
+    for (size_t k = 0; k < sizeof(s_keyframe_intervals) / sizeof(s_keyframe_intervals[0]); k++) {
+        size_t len = 0;
+        stats_encoder_init(&s_encoder, s_keyframe_intervals[k]);
+        int64_t t0 = now_ns();
+        for (int i = 0; i < WINDOW_NUM; i++) {
+            size_t record_len;
+            if (stats_encode_window(&s_encoder, &s_windows[i], stream + len, STATS_ENCODE_SIZE_MAX,
+                                    &record_len) != ESP_OK) {
+                fprintf(stderr, "window %d does not fit in STATS_ENCODE_SIZE_MAX\n", i);
+                return 1;
+            }
+            len += record_len;
+        }
+        int64_t encode_ns = now_ns() - t0;
+
+        size_t pos = 0;
+        stats_decoder_init(&s_decoder);
+        t0 = now_ns();
+        for (int i = 0; i < WINDOW_NUM; i++) {
+            size_t used;
+            if (stats_decode_window(&s_decoder, stream + pos, len - pos, &s_decoded, &used) != ESP_OK ||
+                !same_window(&s_windows[i], &s_decoded)) {
+                fprintf(stderr, "keyframe interval %u: window %d does not decode to the original\n",
+                        s_keyframe_intervals[k], i);
+                ok = false;
+                break;
+            }
+            pos += used;
+        }
+        int64_t decode_ns = now_ns() - t0;
+
+        printf("{\"keyframe_interval\":%u,\"windows\":%d,\"raw_bytes\":%zu,\"encoded_bytes\":%zu,"
+               "\"ratio\":%.1f,\"bytes_per_window\":%.1f,\"encode_ns\":%.0f,\"decode_ns\":%.0f}\n",
+               s_keyframe_intervals[k], WINDOW_NUM, raw_bytes, len, (double)raw_bytes / len,
+               (double)len / WINDOW_NUM, (double)encode_ns / WINDOW_NUM, (double)decode_ns / WINDOW_NUM);
+
+        if (stream_path != NULL && s_keyframe_intervals[k] == STREAM_KEYFRAME_INTERVAL) {
+            FILE *file = fopen(stream_path, "wb");
+            if (file == NULL || fwrite(stream, 1, len, file) != len) {
+                perror(stream_path);
+                ok = false;
+            }
+            if (file != NULL) {
+                fclose(file);
+            }
+        }
+    }
+    free(stream);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,331 @@
+/* Throughput of the JSON writer on the host stand-in
+
+   usage: bench_json [--dump FILE]
+
+   Records WINDOW_NUM windows of a scripted workload, then writes them as JSON
+   with stats_json_read in chunks of several sizes and with stats_json_write.
+   For each it prints a JSON object with the bytes and time per window, the
+   throughput and the heap allocations made while writing (counted by
+   wrapping malloc). Built with cJSON (see host/CMakeLists.txt), the same
+   windows are also built as cJSON trees and printed, for comparison.
+
+   Output written in chunks must match the output written in one go, and the
+   longest pieces (names escaped in full, every number at its widest) must
+   fit STATS_JSON_PIECE_SIZE as plain ASCII; the exit status is 1 otherwise. --dump writes that output to FILE, one window per
+   line, e.g. for python3 -m json.tool --json-lines.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "stats_priv.h"
+#include "stats_json.h"
+#include "stats_sink.h"
+#include "fake_sched.h"
+#if HAVE_CJSON
+#include "cjson/cJSON.h"
+#endif
+
+#define WINDOW_NUM          200
+#define TASK_NUM            20
+#define REPS                20
+#define TEXT_SIZE_MAX       (STATS_JSON_PIECE_SIZE * (STATS_WINDOW_TASK_NUM + 8))
+
+static const size_t s_chunk_sizes[] = { 16, 64, 256, 1460, TEXT_SIZE_MAX };
+
+static TaskHandle_t s_tasks[TASK_NUM];
+static stats_window_t s_windows[WINDOW_NUM];
+static stats_json_t s_json;
+static char s_expected[WINDOW_NUM][TEXT_SIZE_MAX];
+static size_t s_expected_len[WINDOW_NUM];
+static char s_text[TEXT_SIZE_MAX];
+static size_t s_text_len;
+static uint32_t s_seed = 1;
+static size_t s_allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t num, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    s_allocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t num, size_t size) {
+    s_allocs++;
+    return __real_calloc(num, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    s_allocs++;
+    return __real_realloc(ptr, size);
+}
+
+static uint32_t next_random(uint32_t range) {
+    s_seed = s_seed * 1103515245 + 12345;
+    return (s_seed >> 8) % range;
+}
+
+static void script(uint32_t tick, void *arg) {
+    if (tick % 100 == 0) {
+        fake_task_set_load(s_tasks[next_random(TASK_NUM)], next_random(150));
+        fake_task_set_state(s_tasks[next_random(TASK_NUM)], next_random(2) ? eReady : eBlocked);
+    }
+}
+
+static void record_windows(void) {
+    fake_sched_reset();
+    for (int i = 0; i < TASK_NUM; i++) {
+        char name[configMAX_TASK_NAME_LEN];
+        //Some names need escaping, one of them is not ASCII
+        snprintf(name, sizeof(name), i % 5 == 4 ? "task\"%d\\" : i == 3 ? "t\xe4sk%d" : "task%d", i);
+        s_tasks[i] = fake_task_create(name, 1 + i, i % 3 == 2 ? tskNO_AFFINITY : i % 2);
+        fake_task_set_load(s_tasks[i], next_random(150));
+    }
+    fake_sched_set_tick_callback(script, NULL);
+    stats_init();
+    stats_sink_remove(&stats_sink_console);
+    fake_sched_set_current(fake_sched_find_task("stats"));
+    for (int i = 0; i < WINDOW_NUM; i++) {
+        stats_monitor_run_once(pdMS_TO_TICKS(1000));
+        stats_get_window(0, &s_windows[i]);
+    }
+}
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static esp_err_t append(const char *data, size_t len, void *arg) {
+    if (s_text_len + len > sizeof(s_text)) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(s_text + s_text_len, data, len);
+    s_text_len += len;
+    return ESP_OK;
+}
+
+static void report(const char *writer, size_t chunk, size_t bytes, int64_t ns, size_t allocs) {
+    printf("{\"writer\":\"%s\",\"chunk\":%zu,\"windows\":%d,\"bytes_per_window\":%.0f,\"ns_per_window\":%.0f,"
+           "\"mb_per_s\":%.1f,\"allocs_per_window\":%.1f}\n",
+           writer, chunk, WINDOW_NUM, (double)bytes / WINDOW_NUM, (double)ns / REPS / WINDOW_NUM,
+           (double)bytes * REPS / ns * 1000, (double)allocs / REPS / WINDOW_NUM);
+}
+
+//Write every window REPS times, taking chunk bytes at a time, and check the text
+static bool bench_read(size_t chunk) {
+    bool ok = true;
+    size_t bytes = 0;
+    size_t allocs = s_allocs;
+    int64_t t0 = now_ns();
+    for (int r = 0; r < REPS; r++) {
+        for (int i = 0; i < WINDOW_NUM; i++) {
+            size_t len, text_len = 0;
+            stats_json_window(&s_json, &s_windows[i]);
+            while ((len = stats_json_read(&s_json, s_text + text_len, chunk)) > 0) {
+                text_len += len;
+            }
+            if (r == 0) {
+                ok &= text_len == s_expected_len[i] && memcmp(s_text, s_expected[i], text_len) == 0;
+                bytes += text_len;
+            }
+        }
+    }
+    report("stats_json_read", chunk, bytes, now_ns() - t0, s_allocs - allocs);
+    return ok;
+}
+
+static bool bench_write(void) {
+    bool ok = true;
+    size_t bytes = 0;
+    size_t allocs = s_allocs;
+    int64_t t0 = now_ns();
+    for (int r = 0; r < REPS; r++) {
+        for (int i = 0; i < WINDOW_NUM; i++) {
+            s_text_len = 0;
+            stats_json_window(&s_json, &s_windows[i]);
+            ok &= stats_json_write(&s_json, append, NULL) == ESP_OK;
+            if (r == 0) {
+                ok &= s_text_len == s_expected_len[i] && memcmp(s_text, s_expected[i], s_text_len) == 0;
+                bytes += s_text_len;
+            }
+        }
+    }
+    report("stats_json_write", 0, bytes, now_ns() - t0, s_allocs - allocs);
+    return ok;
+}
+
+static bool is_ascii_object(const char *text, size_t len, char last) {
+    for (size_t i = 0; i < len; i++) {
+        if ((unsigned char)text[i] >= 0x80) {
+            return false;
+        }
+    }
+    return len > 0 && text[len - 1] == last;
+}
+
+//The longest window and handle pieces; one that does not fit aborts in stats_json.c
+static bool check_longest_pieces(void) {
+    static stats_window_t window;
+    memset(&window, 0, sizeof(window));
+    window.seq = UINT32_MAX;
+    window.elapsed = UINT32_MAX;
+    window.task_num = 2;
+    for (int i = 0; i < STATS_TASK_STATE_NUM; i++) {
+        window.state_count[i] = UINT16_MAX;
+    }
+    window.inherited_num = UINT16_MAX;
+    window.starved_num = UINT16_MAX;
+    for (int i = 0; i < STATS_HEAP_NUM; i++) {
+        window.heap[i] = (stats_heap_sample_t){ UINT32_MAX, UINT32_MAX, UINT32_MAX, UINT8_MAX };
+    }
+    for (int i = 0; i < window.task_num; i++) {
+        stats_task_sample_t *task = &window.tasks[i];
+        memset(task->name, i == 0 ? 0xff : 0x01, sizeof(task->name) - 1);
+        task->task_id = UINT32_MAX;
+        task->status = STATS_TASK_MATCHED;
+        task->state = STATS_TASK_SUSPENDED;
+        task->priority = UINT8_MAX;
+        task->base_priority = UINT8_MAX;
+        task->core = INT8_MIN;
+        task->run_time = UINT32_MAX;
+        task->run_time_accumulated = UINT64_MAX;
+        task->percentage = UINT32_MAX;
+        task->min_stack = UINT32_MAX;
+    }
+    stats_json_window(&s_json, &window);
+    size_t len = stats_json_read(&s_json, s_text, sizeof(s_text));
+    bool ok = is_ascii_object(s_text, len, '}');
+
+    stats_run_time_t handler;
+    memset(&handler, 0, sizeof(handler));
+    memset(handler.name, 0xff, sizeof(handler.name) - 1);
+    handler.time = INT64_MIN;
+    handler.self_time = INT64_MIN;
+#if CONFIG_STATS_METRICS
+    handler.count = UINT32_MAX;
+    for (int b = 0; b < STATS_RUN_TIME_BUCKET_NUM; b++) {
+        handler.buckets[b] = UINT32_MAX;
+    }
+#endif
+    const stats_run_time_t *handlers[] = { &handler, &handler };
+    stats_json_run_times(&s_json, handlers, 2);
+    len = stats_json_read(&s_json, s_text, sizeof(s_text));
+    return ok && is_ascii_object(s_text, len, ']');
+}
+
+#if HAVE_CJSON
+static cJSON *window_to_cjson(const stats_window_t *window) {
+    static const char *const heap_names[] = { "internal", "dma", "spiram" };
+    static const char *const status_names[] = { "matched", "created", "deleted" };
+    static const char *const state_names[] = { "running", "ready", "blocked", "suspended" };
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "seq", window->seq);
+    cJSON_AddNumberToObject(root, "elapsed", window->elapsed);
+    cJSON *states = cJSON_AddObjectToObject(root, "states");
+    for (int i = 0; i < STATS_TASK_STATE_NUM; i++) {
+        cJSON_AddNumberToObject(states, state_names[i], window->state_count[i]);
+    }
+    cJSON_AddNumberToObject(root, "inherited_num", window->inherited_num);
+    cJSON_AddNumberToObject(root, "starved_num", window->starved_num);
+    cJSON *heaps = cJSON_AddObjectToObject(root, "heap");
+    for (int i = 0; i < STATS_HEAP_NUM; i++) {
+        cJSON *heap = cJSON_AddObjectToObject(heaps, heap_names[i]);
+        cJSON_AddNumberToObject(heap, "free", window->heap[i].free_size);
+        cJSON_AddNumberToObject(heap, "min_free", window->heap[i].min_free_size);
+        cJSON_AddNumberToObject(heap, "largest_free_block", window->heap[i].largest_free_block);
+        cJSON_AddNumberToObject(heap, "fragmentation", window->heap[i].fragmentation);
+    }
+    cJSON *tasks = cJSON_AddArrayToObject(root, "tasks");
+    for (int i = 0; i < window->task_num; i++) {
+        const stats_task_sample_t *from = &window->tasks[i];
+        cJSON *task = cJSON_CreateObject();
+        cJSON_AddStringToObject(task, "name", from->name);
+        cJSON_AddNumberToObject(task, "id", from->task_id);
+        cJSON_AddStringToObject(task, "status", status_names[from->status]);
+        cJSON_AddStringToObject(task, "state", state_names[from->state]);
+        cJSON_AddNumberToObject(task, "priority", from->priority);
+        cJSON_AddNumberToObject(task, "base_priority", from->base_priority);
+        cJSON_AddNumberToObject(task, "core", from->core);
+        cJSON_AddBoolToObject(task, "ready", from->ready);
+        cJSON_AddBoolToObject(task, "starved", from->starved);
+        cJSON_AddNumberToObject(task, "run_time", from->run_time);
+        cJSON_AddNumberToObject(task, "run_time_accumulated", from->run_time_accumulated);
+        cJSON_AddNumberToObject(task, "percentage", from->percentage);
+        cJSON_AddNumberToObject(task, "min_stack", from->min_stack);
+        cJSON_AddItemToArray(tasks, task);
+    }
+    return root;
+}
+
+static void bench_cjson(void) {
+    size_t bytes = 0;
+    size_t allocs = s_allocs;
+    int64_t t0 = now_ns();
+    for (int r = 0; r < REPS; r++) {
+        for (int i = 0; i < WINDOW_NUM; i++) {
+            cJSON *root = window_to_cjson(&s_windows[i]);
+            char *text = cJSON_PrintUnformatted(root);
+            if (r == 0 && text != NULL) {
+                bytes += strlen(text);
+            }
+            cJSON_free(text);
+            cJSON_Delete(root);
+        }
+    }
+    report("cjson", 0, bytes, now_ns() - t0, s_allocs - allocs);
+}
+#endif
+
+int main(int argc, char **argv) {
+    const char *dump_path = NULL;
+    if (argc == 3 && strcmp(argv[1], "--dump") == 0) {
+        dump_path = argv[2];
+    } else if (argc != 1) {
+        fprintf(stderr, "usage: %s [--dump FILE]\n", argv[0]);
+        return 2;
+    }
+    record_windows();
+
+    for (int i = 0; i < WINDOW_NUM; i++) {
+        stats_json_window(&s_json, &s_windows[i]);
+        s_expected_len[i] = stats_json_read(&s_json, s_expected[i], sizeof(s_expected[i]));
+    }
+    if (dump_path != NULL) {
+        FILE *file = fopen(dump_path, "w");
+        if (file == NULL) {
+            perror(dump_path);
+            return 1;
+        }
+        for (int i = 0; i < WINDOW_NUM; i++) {
+            fprintf(file, "%.*s\n", (int)s_expected_len[i], s_expected[i]);
+        }
+        fclose(file);
+    }
+
+    bool ok = true;
+    for (size_t k = 0; k < sizeof(s_chunk_sizes) / sizeof(s_chunk_sizes[0]); k++) {
+        if (!bench_read(s_chunk_sizes[k])) {
+            fprintf(stderr, "chunks of %zu bytes give other text\n", s_chunk_sizes[k]);
+            ok = false;
+        }
+    }
+    if (!bench_write()) {
+        fprintf(stderr, "stats_json_write gives other text\n");
+        ok = false;
+    }
+    if (!check_longest_pieces()) {
+        fprintf(stderr, "the longest pieces are not plain ASCII JSON\n");
+        ok = false;
+    }
+#if HAVE_CJSON
+    bench_cjson();
+#endif
+    return ok ? 0 : 1;
+}
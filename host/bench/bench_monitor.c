@@ -0,0 +1,308 @@
+/* Cost of one monitor pass on the host stand-in
+
+   For task counts from 8 to 1024 this times the stages of a pass (snapshot,
+   matching, accumulating, formatting), taking the fastest of many repetitions,
+   and measures the peak heap and stack a full pass uses. One JSON object per
+   task count is written to stdout; sample_ns is the cost of a whole pass
+   (two snapshots plus the other stages).
+
+   With --baseline FILE (earlier output of this program) the run fails if any
+   figure grew by more than --threshold percent (default 25).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "stats_priv.h"
+#include "fake_sched.h"
+
+#define TASK_NUM_MIN        8
+#define TASK_NUM_MAX        1024
+#define TOTAL_TASK_REPS     20000   //repetitions are scaled down as task counts grow
+#define BENCH_STACK_SIZE    (256 * 1024)
+#define STACK_PAINT         0xa5
+
+typedef struct {
+    int task_num;
+    double snapshot_ns;
+    double match_ns;
+    double accumulate_ns;
+    double format_ns;
+    double sample_ns;
+    size_t peak_heap;
+    size_t peak_stack;
+} bench_result_t;
+
+static stats_window_t s_window;
+//Snapshots hold up to STATS_SNAPSHOT_TASK_NUM tasks each, too large for the stack
+static stats_snapshot_t s_start, s_end, s_work_start, s_work_end;
+
+//Heap accounting through -Wl,--wrap=malloc,--wrap=calloc,--wrap=free
+typedef union {
+    size_t size;
+    max_align_t align;
+} alloc_header_t;
+
+static size_t s_heap_used;
+static size_t s_heap_peak;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t num, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size) {
+    alloc_header_t *header = __real_malloc(sizeof(alloc_header_t) + size);
+    if (header == NULL) {
+        return NULL;
+    }
+    header->size = size;
+    s_heap_used += size;
+    if (s_heap_used > s_heap_peak) {
+        s_heap_peak = s_heap_used;
+    }
+    return header + 1;
+}
+
+void *__wrap_calloc(size_t num, size_t size) {
+    void *ptr = __wrap_malloc(num * size);
+    if (ptr != NULL) {
+        memset(ptr, 0, num * size);
+    }
+    return ptr;
+}
+
+void __wrap_free(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    alloc_header_t *header = (alloc_header_t *)ptr - 1;
+    s_heap_used -= header->size;
+    __real_free(header);
+}
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//The fastest repetition is the least disturbed by the rest of the machine
+static double min_ns(const int64_t *samples, int num) {
+    int64_t min = samples[0];
+    for (int i = 1; i < num; i++) {
+        if (samples[i] < min) {
+            min = samples[i];
+        }
+    }
+    return (double)min;
+}
+
+static void setup_tasks(int task_num) {
+    fake_sched_reset();
+    //The idle tasks count towards task_num
+    int worker_num = task_num - portNUM_PROCESSORS;
+    for (int i = 0; i < worker_num; i++) {
+        char name[configMAX_TASK_NAME_LEN];
+        snprintf(name, sizeof(name), "task%d", i);
+        TaskHandle_t task = fake_task_create(name, 1 + i % 20, i % portNUM_PROCESSORS);
+        fake_task_set_load(task, 1800 / worker_num + 1);
+        fake_task_set_stack_high_water_mark(task, 400 + i % 3000);
+    }
+}
+
+//Deterministic reordering, standing in for tasks moving between FreeRTOS lists
+static void shuffle(TaskStatus_t *tasks, UBaseType_t num) {
+    uint32_t seed = 12345;
+    for (UBaseType_t i = num - 1; i > 0; i--) {
+        seed = seed * 1103515245 + 12345;
+        UBaseType_t j = (seed >> 8) % (i + 1);
+        TaskStatus_t tmp = tasks[i];
+        tasks[i] = tasks[j];
+        tasks[j] = tmp;
+    }
+}
+
+static int s_stdout_fd = -1;
+
+static void mute_stdout(void) {
+    fflush(stdout);
+    s_stdout_fd = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+}
+
+static void unmute_stdout(void) {
+    fflush(stdout);
+    dup2(s_stdout_fd, STDOUT_FILENO);
+    close(s_stdout_fd);
+}
+
+static void time_stages(bench_result_t *result, int reps) {
+    int64_t *samples = malloc(sizeof(int64_t) * reps);
+    stats_snapshot_t *start = &s_start, *end = &s_end;
+
+    for (int r = 0; r < reps; r++) {
+        int64_t t0 = now_ns();
+        stats_snapshot_take(start);
+        samples[r] = now_ns() - t0;
+    }
+    result->snapshot_ns = min_ns(samples, reps);
+
+    stats_snapshot_take(start);
+    fake_sched_advance(10);
+    stats_snapshot_take(end);
+    shuffle(end->tasks, end->task_num);
+    stats_snapshot_t *work_start = &s_work_start, *work_end = &s_work_end;
+    work_start->task_num = start->task_num;
+    work_start->run_time = start->run_time;
+    work_end->task_num = end->task_num;
+    work_end->run_time = end->run_time;
+
+    UBaseType_t matched = 0;
+    for (int r = 0; r < reps; r++) {
+        memcpy(work_start->tasks, start->tasks, sizeof(TaskStatus_t) * start->task_num);
+        memcpy(work_end->tasks, end->tasks, sizeof(TaskStatus_t) * end->task_num);
+        int64_t t0 = now_ns();
+        matched = stats_snapshot_match(work_start, work_end);
+        samples[r] = now_ns() - t0;
+    }
+    result->match_ns = min_ns(samples, reps);
+
+    for (int r = 0; r < reps; r++) {
+        int64_t t0 = now_ns();
+        stats_window_build(&s_window, work_start, work_end, matched);
+        samples[r] = now_ns() - t0;
+    }
+    result->accumulate_ns = min_ns(samples, reps);
+
+    mute_stdout();
+    for (int r = 0; r < reps; r++) {
+        int64_t t0 = now_ns();
+        stats_window_print(&s_window);
+        fflush(stdout);
+        samples[r] = now_ns() - t0;
+    }
+    unmute_stdout();
+    result->format_ns = min_ns(samples, reps);
+
+    result->sample_ns = result->snapshot_ns * 2 + result->match_ns + result->accumulate_ns + result->format_ns;
+    free(samples);
+}
+
+static void *monitor_pass(void *arg) {
+    stats_monitor_run_once(10);
+    return NULL;
+}
+
+//Run one full monitor pass on a painted stack with heap accounting on
+static void measure_memory(bench_result_t *result) {
+    uint8_t *stack = malloc(BENCH_STACK_SIZE);
+    memset(stack, STACK_PAINT, BENCH_STACK_SIZE);
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, stack, BENCH_STACK_SIZE);
+
+    size_t heap_base = s_heap_used;
+    s_heap_peak = s_heap_used;
+    mute_stdout();
+    pthread_t thread;
+    pthread_create(&thread, &attr, monitor_pass, NULL);
+    pthread_join(thread, NULL);
+    unmute_stdout();
+    result->peak_heap = s_heap_peak - heap_base;
+
+    //The stack grows down; find the deepest byte that was written
+    size_t untouched = 0;
+    while (untouched < BENCH_STACK_SIZE && stack[untouched] == STACK_PAINT) {
+        untouched++;
+    }
+    result->peak_stack = BENCH_STACK_SIZE - untouched;
+    pthread_attr_destroy(&attr);
+    free(stack);
+}
+
+static void print_result(const bench_result_t *r) {
+    printf("{\"tasks\":%d,\"snapshot_ns\":%.0f,\"match_ns\":%.0f,\"accumulate_ns\":%.0f,\"format_ns\":%.0f,"
+           "\"sample_ns\":%.0f,\"peak_heap_bytes\":%zu,\"peak_stack_bytes\":%zu}\n",
+           r->task_num, r->snapshot_ns, r->match_ns, r->accumulate_ns, r->format_ns,
+           r->sample_ns, r->peak_heap, r->peak_stack);
+}
+
+static bool find_baseline(FILE *file, int task_num, bench_result_t *baseline) {
+    char line[512];
+    rewind(file);
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (sscanf(line, "{\"tasks\":%d,\"snapshot_ns\":%lf,\"match_ns\":%lf,\"accumulate_ns\":%lf,\"format_ns\":%lf,"
+                   "\"sample_ns\":%lf,\"peak_heap_bytes\":%zu,\"peak_stack_bytes\":%zu}",
+                   &baseline->task_num, &baseline->snapshot_ns, &baseline->match_ns, &baseline->accumulate_ns,
+                   &baseline->format_ns, &baseline->sample_ns, &baseline->peak_heap, &baseline->peak_stack) == 8 &&
+            baseline->task_num == task_num) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool check_regression(const char *what, int task_num, double value, double baseline, double threshold) {
+    if (value > baseline * (1.0 + threshold / 100.0)) {
+        fprintf(stderr, "regression: %s with %d tasks is %.0f, baseline %.0f (+%.0f%%)\n",
+                what, task_num, value, baseline, (value / baseline - 1.0) * 100.0);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    const char *baseline_path = NULL;
+    double threshold = 25;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baseline_path = argv[++i];
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            threshold = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--baseline FILE] [--threshold PERCENT]\n", argv[0]);
+            return 2;
+        }
+    }
+    FILE *baseline_file = NULL;
+    if (baseline_path != NULL) {
+        baseline_file = fopen(baseline_path, "r");
+        if (baseline_file == NULL) {
+            perror(baseline_path);
+            return 2;
+        }
+    }
+
+    bool ok = true;
+    for (int task_num = TASK_NUM_MIN; task_num <= TASK_NUM_MAX; task_num *= 2) {
+        bench_result_t result = { .task_num = task_num };
+        int reps = TOTAL_TASK_REPS / task_num;
+        if (reps < 20) {
+            reps = 20;
+        }
+        setup_tasks(task_num);
+        time_stages(&result, reps);
+        setup_tasks(task_num);
+        measure_memory(&result);
+        print_result(&result);
+
+        bench_result_t baseline;
+        if (baseline_file != NULL && find_baseline(baseline_file, task_num, &baseline)) {
+            ok &= check_regression("sample_ns", task_num, result.sample_ns, baseline.sample_ns, threshold);
+            ok &= check_regression("peak_heap_bytes", task_num, result.peak_heap, baseline.peak_heap, threshold);
+            ok &= check_regression("peak_stack_bytes", task_num, result.peak_stack, baseline.peak_stack, threshold);
+        }
+    }
+    if (baseline_file != NULL) {
+        fclose(baseline_file);
+    }
+    return ok ? 0 : 1;
+}
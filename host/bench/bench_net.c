@@ -0,0 +1,248 @@
+/* Loopback run of the streaming server on the host stand-in
+
+   usage: bench_net [PORT]
+
+   Starts the server on PORT (default CONFIG_STATS_NET_PORT) and, for 1, 2 and
+   4 TCP clients plus one UDP subscriber and one JSON client (on PORT + 1) on
+   127.0.0.1, runs the monitor for WINDOW_NUM windows over a small scripted
+   workload. Every client decodes what it receives, and each window is
+   compared with the one the monitor kept; for the JSON client, each line's
+   window number, which must follow the last one, and length. One JSON object per client count goes to
+   stdout with the bytes each client received per window and the number of
+   windows it decoded.
+
+   The exit status is 1 if a client missed a window after its first keyframe
+   or decoded one that differs.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "stats_priv.h"
+#include "stats_encode.h"
+#include "stats_sink.h"
+#include "fake_sched.h"
+
+#define WINDOW_NUM          40
+#define TASK_NUM            12
+#define CLIENT_NUM_MAX      4
+#define UDP_RENEW_WINDOWS   10      //well within the lease
+#define BUF_SIZE            (8 * STATS_ENCODE_SIZE_MAX)
+
+typedef struct {
+    int fd;
+    bool udp;
+    bool json;
+    uint32_t next_datagram;         //or next window number, for the JSON client
+    uint8_t buf[BUF_SIZE];
+    size_t len;
+    size_t bytes;
+    int decoded;
+    int failed;
+    stats_decoder_t decoder;
+} client_t;
+
+static const int s_client_nums[] = { 1, 2, 4 };
+static client_t s_clients[CLIENT_NUM_MAX + 2];
+static TaskHandle_t s_tasks[TASK_NUM];
+static stats_window_t s_expected;
+static stats_window_t s_decoded;
+static uint32_t s_seed = 1;
+
+static uint32_t next_random(uint32_t range) {
+    s_seed = s_seed * 1103515245 + 12345;
+    return (s_seed >> 8) % range;
+}
+
+static void script(uint32_t tick, void *arg) {
+    if (tick % 100 == 0) {
+        fake_task_set_load(s_tasks[next_random(TASK_NUM)], next_random(150));
+    }
+}
+
+static void subscribe(const client_t *client) {
+    send(client->fd, "", 1, 0);
+}
+
+static int open_client(bool udp, uint16_t port) {
+    int fd = socket(AF_INET, udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror("connect");
+        exit(1);
+    }
+    return fd;
+}
+
+static bool same_window(const stats_window_t *a, const stats_window_t *b) {
+    if (a->seq != b->seq || a->elapsed != b->elapsed || a->task_num != b->task_num) {
+        return false;
+    }
+    for (int i = 0; i < a->task_num; i++) {
+        int j = 0;
+        for (; j < b->task_num && b->tasks[j].task_id != a->tasks[i].task_id; j++) {
+        }
+        if (j == b->task_num || a->tasks[i].run_time != b->tasks[j].run_time ||
+            a->tasks[i].percentage != b->tasks[j].percentage) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//Check each whole line against the window of the same number the monitor kept. A line may
+//arrive after the next window was run, so it is looked up by age.
+static void decode_json(client_t *client) {
+    uint8_t *end;
+    while ((end = memchr(client->buf, '\n', client->len)) != NULL) {
+        *end = '\0';
+        unsigned seq, elapsed;
+        if (sscanf((const char *)client->buf, "{\"seq\":%u,\"elapsed\":%u,", &seq, &elapsed) == 2 &&
+            end[-1] == '}' && (client->decoded == 0 || seq == client->next_datagram) &&
+            stats_get_window(s_expected.seq - seq, &s_decoded) == ESP_OK && elapsed == s_decoded.elapsed) {
+            client->decoded++;
+            client->next_datagram = seq + 1;
+        } else {
+            client->failed++;
+        }
+        size_t used = end + 1 - client->buf;
+        memmove(client->buf, end + 1, client->len - used);
+        client->len -= used;
+    }
+}
+
+static void decode(client_t *client, const uint8_t *buf, size_t len) {
+    size_t pos = 0;
+    while (pos < len) {
+        size_t used;
+        esp_err_t ret = stats_decode_window(&client->decoder, buf + pos, len - pos, &s_decoded, &used);
+        if (ret == ESP_ERR_INVALID_SIZE) {
+            break;
+        }
+        if (ret == ESP_OK) {
+            client->decoded++;
+            if (!same_window(&s_expected, &s_decoded)) {
+                client->failed++;
+            }
+        } else if (ret != ESP_ERR_NOT_FOUND || client->decoded > 0) {
+            client->failed++;
+        }
+        pos += used;
+    }
+    if (!client->udp) {
+        memmove(client->buf, client->buf + pos, client->len - pos);
+        client->len -= pos;
+    }
+}
+
+//Take whatever arrived for one window
+static void receive(client_t *client) {
+    struct pollfd pfd = { .fd = client->fd, .events = POLLIN };
+    while (poll(&pfd, 1, 100) > 0) {
+        ssize_t n = recv(client->fd, client->buf + client->len, BUF_SIZE - client->len, MSG_DONTWAIT);
+        if (n <= 0) {
+            break;
+        }
+        client->bytes += n;
+        if (client->udp) {
+            uint32_t seq;
+            memcpy(&seq, client->buf, sizeof(seq));
+            if (client->bytes > (size_t)n && seq != client->next_datagram) {
+                //Lost datagrams; wait for the next keyframe
+                stats_decoder_init(&client->decoder);
+            }
+            client->next_datagram = seq + 1;
+            decode(client, client->buf + sizeof(seq), n - sizeof(seq));
+        } else if (client->json) {
+            client->len += n;
+            decode_json(client);
+        } else {
+            client->len += n;
+            decode(client, client->buf, client->len);
+        }
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 0) <= 0) {
+            break;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    uint16_t port = argc > 1 ? atoi(argv[1]) : CONFIG_STATS_NET_PORT;
+
+    fake_sched_reset();
+    for (int i = 0; i < TASK_NUM; i++) {
+        char name[configMAX_TASK_NAME_LEN];
+        snprintf(name, sizeof(name), "task%d", i);
+        s_tasks[i] = fake_task_create(name, 1 + i, i % 2);
+        fake_task_set_load(s_tasks[i], next_random(150));
+    }
+    fake_sched_set_tick_callback(script, NULL);
+    stats_init();
+    stats_sink_remove(&stats_sink_console);
+    fake_sched_set_current(fake_sched_find_task("stats"));
+
+    bool ok = true;
+    for (size_t k = 0; k < sizeof(s_client_nums) / sizeof(s_client_nums[0]); k++) {
+        //TCP clients, then the UDP subscriber, then the JSON client
+        int client_num = s_client_nums[k] + 2;
+        client_t *udp = &s_clients[client_num - 2];
+        client_t *json = &s_clients[client_num - 1];
+        if (stats_net_start(port) != ESP_OK) {
+            return 1;
+        }
+        for (int i = 0; i < client_num; i++) {
+            client_t *client = &s_clients[i];
+            memset(client, 0, sizeof(*client));
+            client->udp = client == udp;
+            client->json = client == json;
+            client->fd = open_client(client->udp, client->json ? port + 1 : port);
+            if (client->udp) {
+                subscribe(client);
+            }
+            stats_decoder_init(&client->decoder);
+        }
+        //Clients are taken at the end of the first window, so they start with the second
+        for (int w = 0; w < WINDOW_NUM; w++) {
+            if (w % UDP_RENEW_WINDOWS == UDP_RENEW_WINDOWS - 1) {
+                subscribe(udp);
+            }
+            stats_monitor_run_once(pdMS_TO_TICKS(1000));
+            stats_get_window(0, &s_expected);
+            for (int i = 0; i < client_num; i++) {
+                receive(&s_clients[i]);
+            }
+        }
+        stats_net_stop();
+
+        size_t tcp_bytes = 0;
+        for (int i = 0; i < client_num; i++) {
+            client_t *client = &s_clients[i];
+            close(client->fd);
+            if (client->failed > 0 || client->decoded != WINDOW_NUM - 1) {
+                fprintf(stderr, "%s client %d: %d windows decoded, %d wrong\n",
+                        client->udp ? "UDP" : client->json ? "JSON" : "TCP", i, client->decoded, client->failed);
+                ok = false;
+            }
+            tcp_bytes += client->udp || client->json ? 0 : client->bytes;
+        }
+        int tcp_num = client_num - 2;
+        printf("{\"tcp_clients\":%d,\"udp_subscribers\":1,\"json_clients\":1,\"windows\":%d,"
+               "\"tcp_bytes_per_window\":%.1f,\"udp_bytes_per_window\":%.1f,\"udp_decoded\":%d,"
+               "\"json_bytes_per_window\":%.1f}\n",
+               tcp_num, WINDOW_NUM, (double)tcp_bytes / tcp_num / (WINDOW_NUM - 1),
+               (double)udp->bytes / (WINDOW_NUM - 1), udp->decoded, (double)json->bytes / (WINDOW_NUM - 1));
+    }
+    return ok ? 0 : 1;
+}
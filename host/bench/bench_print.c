@@ -0,0 +1,232 @@
+/* Cost of the window report on the host stand-in
+
+   Records WINDOW_NUM windows of a scripted workload (tasks created and
+   deleted, inherited priorities, starved tasks, low stacks), plus copies with
+   counters beyond 32 bits. Each window is then reported by
+   stats_window_format and by a printf implementation of the same report, as
+   the monitor had before, with formats fixed for the field types. Both write
+   into memory, and a JSON object with the time per window and per task row is
+   printed for each.
+
+   The exit status is 1 if the two reports of any window differ by a byte, or
+   if stats_window_format hands out a piece that does not end a line.
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_heap_caps.h"
+#include "stats_priv.h"
+#include "stats_sink.h"
+#include "fake_sched.h"
+
+#define WINDOW_NUM          100
+#define TASK_NUM            20
+#define REPS                50
+#define STACK_HEADROOM_MIN  512     //as in stats.c
+#define TEXT_SIZE_MAX       16384
+
+static TaskHandle_t s_tasks[TASK_NUM];
+static TaskHandle_t s_short;
+static stats_window_t s_windows[2 * WINDOW_NUM];
+static char s_text[TEXT_SIZE_MAX];
+static size_t s_text_len;
+static char s_expected[TEXT_SIZE_MAX];
+static size_t s_expected_len;
+static uint32_t s_seed = 1;
+static int s_split_lines;   //pieces handed out that do not end with a line end
+
+static uint32_t next_random(uint32_t range) {
+    s_seed = s_seed * 1103515245 + 12345;
+    return (s_seed >> 8) % range;
+}
+
+static void script(uint32_t tick, void *arg) {
+    if (tick % 100 != 0) {
+        return;
+    }
+    TaskHandle_t task = s_tasks[next_random(TASK_NUM)];
+    fake_task_set_load(task, next_random(150));
+    fake_task_set_state(task, next_random(2) ? eReady : eBlocked);
+    if (next_random(10) == 0) {
+        UBaseType_t priority = 1 + next_random(20);
+        fake_task_set_priority(task, priority + next_random(2) * 3, priority);
+    }
+    if (next_random(20) == 0) {
+        fake_task_set_stack_high_water_mark(task, 200 + next_random(3000));
+    }
+    if (tick % 1000 == 500 && s_short == NULL) {
+        s_short = fake_task_create("short", 5, 0);
+    } else if (tick % 3000 == 500) {
+        fake_task_delete(s_short);
+        s_short = NULL;
+    }
+    fake_heap_set(MALLOC_CAP_INTERNAL, 180000 - next_random(20000), 150000, 90000);
+}
+
+static void record_windows(void) {
+    fake_sched_reset();
+    for (int i = 0; i < TASK_NUM; i++) {
+        char name[configMAX_TASK_NAME_LEN];
+        snprintf(name, sizeof(name), i % 4 == 0 ? "long_task_nm_%d" : "task%d", i);
+        s_tasks[i] = fake_task_create(name, 1 + i, i % 2);
+        fake_task_set_load(s_tasks[i], next_random(150));
+    }
+    fake_sched_set_tick_callback(script, NULL);
+    stats_init();
+    stats_sink_remove(&stats_sink_console);
+    fake_sched_set_current(fake_sched_find_task("stats"));
+    for (int i = 0; i < WINDOW_NUM; i++) {
+        stats_monitor_run_once(pdMS_TO_TICKS(1000));
+        stats_get_window(0, &s_windows[i]);
+    }
+    //Counters a long running device reaches
+    for (int i = 0; i < WINDOW_NUM; i++) {
+        stats_window_t *window = &s_windows[WINDOW_NUM + i];
+        *window = s_windows[i];
+        for (int t = 0; t < window->task_num; t++) {
+            window->tasks[t].run_time += 3000000000u;
+            window->tasks[t].run_time_accumulated += 123456789012345ull;
+        }
+    }
+}
+
+static void append(const char *text, size_t len, void *arg) {
+    if (len == 0 || text[len - 1] != '\n') {
+        s_split_lines++;
+    }
+    memcpy(s_text + s_text_len, text, len);
+    s_text_len += len;
+}
+
+#define PRINT(...)  (s_text_len += snprintf(s_text + s_text_len, TEXT_SIZE_MAX - s_text_len, __VA_ARGS__))
+
+//The report as printf wrote it, with formats that match the field types
+static void printf_report(const stats_window_t *window) {
+    uint32_t stack_low_num = 0, stack_reclaimable = 0;
+#if CONFIG_STATS_ADAPTIVE
+    PRINT("Length: %" PRIu32 " ms\n", window->elapsed / 1000);     //1 MHz run time clock on the host
+#endif
+    PRINT("| Task | Run Time | Run Time(Accumulated) | Percentage | Min Free Stack\n");
+    PRINT("| --- | --- | --- | --- | ---\n");
+    for (int i = 0; i < window->task_num; i++) {
+        const stats_task_sample_t *task = &window->tasks[i];
+        if (task->status != STATS_TASK_MATCHED) {
+            continue;
+        }
+        bool stack_low = task->min_stack < STACK_HEADROOM_MIN;
+        if (stack_low) {
+            stack_low_num++;
+        } else {
+            stack_reclaimable += task->min_stack - STACK_HEADROOM_MIN;
+        }
+        PRINT("| %s | %" PRIu32 " | %" PRIu64 " | %" PRIu32 "%% | %" PRIu32 "%s\n", task->name, task->run_time,
+              task->run_time_accumulated, task->percentage, task->min_stack, stack_low ? " (low)" : "");
+    }
+    for (int i = 0; i < window->task_num; i++) {
+        if (window->tasks[i].status == STATS_TASK_DELETED) {
+            PRINT("| %s | Deleted\n", window->tasks[i].name);
+        }
+    }
+    for (int i = 0; i < window->task_num; i++) {
+        if (window->tasks[i].status == STATS_TASK_CREATED) {
+            PRINT("| %s | Created\n", window->tasks[i].name);
+        }
+    }
+    PRINT("Stack: %" PRIu32 " task(s) below %d bytes free, %" PRIu32 " bytes reclaimable\n",
+          stack_low_num, STACK_HEADROOM_MIN, stack_reclaimable);
+    PRINT("States: %u running, %u ready, %u blocked, %u suspended\n",
+          window->state_count[STATS_TASK_RUNNING], window->state_count[STATS_TASK_READY],
+          window->state_count[STATS_TASK_BLOCKED], window->state_count[STATS_TASK_SUSPENDED]);
+    if (window->inherited_num > 0 || window->starved_num > 0) {
+        for (int i = 0; i < window->task_num; i++) {
+            const stats_task_sample_t *task = &window->tasks[i];
+            if (task->status != STATS_TASK_MATCHED) {
+                continue;
+            }
+            if (task->priority != task->base_priority) {
+                PRINT("Priority inherited: %s (%u -> %u)\n", task->name, task->base_priority, task->priority);
+            }
+            if (task->starved) {
+                PRINT("Ready but starved: %s (priority %u, %" PRIu32 "%%)\n", task->name, task->priority,
+                      task->percentage);
+            }
+        }
+    }
+    static const char *heap_names[STATS_HEAP_NUM] = { "internal", "dma", "spiram" };
+    PRINT("| Heap | Free | Min Free | Largest Free Block | Fragmentation\n");
+    PRINT("| --- | --- | --- | --- | ---\n");
+    for (int i = 0; i < STATS_HEAP_NUM; i++) {
+        const stats_heap_sample_t *heap = &window->heap[i];
+        if (heap->free_size == 0 && heap->min_free_size == 0) {
+            continue;
+        }
+        PRINT("| %s | %" PRIu32 " | %" PRIu32 " | %" PRIu32 " | %u%%\n", heap_names[i], heap->free_size,
+              heap->min_free_size, heap->largest_free_block, heap->fragmentation);
+    }
+}
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int main(void) {
+    record_windows();
+
+    bool ok = true;
+    size_t rows = 0, bytes = 0;
+    for (int i = 0; i < 2 * WINDOW_NUM; i++) {
+        rows += s_windows[i].task_num;
+        s_text_len = 0;
+        printf_report(&s_windows[i]);
+        memcpy(s_expected, s_text, s_text_len);
+        s_expected_len = s_text_len;
+        bytes += s_text_len;
+
+        s_text_len = 0;
+        stats_window_format(&s_windows[i], append, NULL);
+        if (s_text_len != s_expected_len || memcmp(s_text, s_expected, s_text_len) != 0) {
+            fprintf(stderr, "window %d: reports differ\n--- printf\n%.*s--- stats_window_format\n%.*s", i,
+                    (int)s_expected_len, s_expected, (int)s_text_len, s_text);
+            ok = false;
+        }
+    }
+    if (s_split_lines > 0) {
+        fprintf(stderr, "%d report pieces end inside a line\n", s_split_lines);
+        ok = false;
+    }
+
+    int64_t t0 = now_ns();
+    for (int r = 0; r < REPS; r++) {
+        for (int i = 0; i < 2 * WINDOW_NUM; i++) {
+            s_text_len = 0;
+            printf_report(&s_windows[i]);
+        }
+    }
+    int64_t printf_ns = now_ns() - t0;
+    t0 = now_ns();
+    for (int r = 0; r < REPS; r++) {
+        for (int i = 0; i < 2 * WINDOW_NUM; i++) {
+            s_text_len = 0;
+            stats_window_format(&s_windows[i], append, NULL);
+        }
+    }
+    int64_t format_ns = now_ns() - t0;
+
+    int64_t runs = (int64_t)REPS * 2 * WINDOW_NUM;
+    printf("{\"formatter\":\"printf\",\"windows\":%d,\"bytes_per_window\":%.0f,\"ns_per_window\":%.0f,"
+           "\"ns_per_row\":%.1f}\n",
+           2 * WINDOW_NUM, (double)bytes / (2 * WINDOW_NUM), (double)printf_ns / runs,
+           (double)printf_ns / REPS / rows);
+    printf("{\"formatter\":\"stats_window_format\",\"windows\":%d,\"bytes_per_window\":%.0f,\"ns_per_window\":%.0f,"
+           "\"ns_per_row\":%.1f,\"speedup\":%.1f}\n",
+           2 * WINDOW_NUM, (double)bytes / (2 * WINDOW_NUM), (double)format_ns / runs,
+           (double)format_ns / REPS / rows, (double)printf_ns / format_ns);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,149 @@
+/* Context switch trace of a scripted switch pattern on the host stand-in
+
+   On core 0, each PERIOD_TICKS period runs worker for A_TICKS, then logger
+   for B_TICKS, then the idle task for the rest; core 1 stays idle. The trace
+   hooks are driven by the fake scheduler's switches, and stats_ctxsw_print is
+   checked against the pattern: the timeline of core 0 must be exactly the
+   scripted switches in order, with their timestamps, core 1 must have none,
+   and the table must give each task's switch count, average and longest
+   slice. The exit status is 1 on any difference.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "stats.h"
+#include "fake_sched.h"
+
+#define PERIOD_NUM      3
+#define PERIOD_TICKS    20
+#define A_TICKS         10
+#define B_TICKS         5
+#define EVENT_MAX       (6 * PERIOD_NUM)
+
+typedef struct {
+    uint32_t timestamp;
+    bool in;
+    const char *task;
+} switch_t;
+
+typedef struct {
+    const char *task;
+    uint32_t switches, avg_slice, max_slice;
+} task_row_t;
+
+static TaskHandle_t s_worker, s_logger;
+
+static void script(uint32_t tick, void *arg) {
+    uint32_t phase = tick % PERIOD_TICKS;
+    fake_task_set_load(s_worker, phase < A_TICKS ? 1000 : 0);
+    fake_task_set_load(s_logger, phase >= A_TICKS && phase < A_TICKS + B_TICKS ? 1000 : 0);
+}
+
+//The switches the script makes on core 0, in order
+static int expected_switches(switch_t *switches) {
+    int n = 0;
+    for (uint32_t period = 0; period < PERIOD_NUM; period++) {
+        uint32_t start = period * PERIOD_TICKS * FAKE_SCHED_TICK_US;
+        uint32_t b_start = start + A_TICKS * FAKE_SCHED_TICK_US;
+        uint32_t idle_start = b_start + B_TICKS * FAKE_SCHED_TICK_US;
+        switches[n++] = (switch_t){ start, false, "IDLE0" };
+        switches[n++] = (switch_t){ start, true, "worker" };
+        switches[n++] = (switch_t){ b_start, false, "worker" };
+        switches[n++] = (switch_t){ b_start, true, "logger" };
+        switches[n++] = (switch_t){ idle_start, false, "logger" };
+        switches[n++] = (switch_t){ idle_start, true, "IDLE0" };
+    }
+    return n;
+}
+
+static FILE *capture_print(void) {
+    FILE *out = tmpfile();
+    if (out == NULL) {
+        perror("tmpfile");
+        return NULL;
+    }
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    dup2(fileno(out), STDOUT_FILENO);
+    esp_err_t ret = stats_ctxsw_print(true);
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    rewind(out);
+    if (ret != ESP_OK) {
+        printf("stats_ctxsw_print failed (%d)\n", ret);
+        fclose(out);
+        return NULL;
+    }
+    return out;
+}
+
+int main(void) {
+    fake_sched_reset();
+    s_worker = fake_task_create("worker", 5, 0);
+    s_logger = fake_task_create("logger", 3, 0);
+    fake_sched_set_tick_callback(script, NULL);
+    stats_ctxsw_clear();
+    fake_sched_advance(PERIOD_NUM * PERIOD_TICKS);
+
+    FILE *out = capture_print();
+    if (out == NULL) {
+        return 1;
+    }
+    switch_t expected[EVENT_MAX];
+    int expected_num = expected_switches(expected);
+    //The last idle slice is still running, so IDLE0 has one slice fewer than switches
+    const task_row_t rows[] = {
+        { "worker", PERIOD_NUM, A_TICKS * FAKE_SCHED_TICK_US, A_TICKS * FAKE_SCHED_TICK_US },
+        { "logger", PERIOD_NUM, B_TICKS * FAKE_SCHED_TICK_US, B_TICKS * FAKE_SCHED_TICK_US },
+        { "IDLE0", PERIOD_NUM, (PERIOD_TICKS - A_TICKS - B_TICKS) * FAKE_SCHED_TICK_US,
+          (PERIOD_TICKS - A_TICKS - B_TICKS) * FAKE_SCHED_TICK_US },
+    };
+    bool rows_seen[sizeof(rows) / sizeof(rows[0])] = { false };
+
+    bool ok = true;
+    int core = -1, event_num[portNUM_PROCESSORS] = { 0 };
+    char line[128];
+    while (fgets(line, sizeof(line), out) != NULL) {
+        int next_core;
+        unsigned timestamp, switches, avg_slice, max_slice;
+        char dir[4], task[16];
+        if (sscanf(line, "Core %d switches", &next_core) == 1) {
+            core = next_core;
+        } else if (sscanf(line, "| %15[^ |] | %u | %u | %u", task, &switches, &avg_slice, &max_slice) == 4) {
+            size_t i;
+            for (i = 0; i < sizeof(rows) / sizeof(rows[0]) && strcmp(rows[i].task, task) != 0; i++) {
+            }
+            if (i == sizeof(rows) / sizeof(rows[0]) || switches != rows[i].switches ||
+                avg_slice != rows[i].avg_slice || max_slice != rows[i].max_slice) {
+                printf("unexpected row: %s", line);
+                ok = false;
+            } else {
+                rows_seen[i] = true;
+            }
+        } else if (sscanf(line, "%u %3s %15s", &timestamp, dir, task) == 3 && core >= 0) {
+            int n = event_num[core]++;
+            if (core != 0 || n >= expected_num || timestamp != expected[n].timestamp ||
+                (strcmp(dir, "in") == 0) != expected[n].in || strcmp(task, expected[n].task) != 0) {
+                printf("core %d event %d unexpected: %s", core, n, line);
+                ok = false;
+            }
+        }
+    }
+    fclose(out);
+    if (event_num[0] != expected_num) {
+        printf("core 0: %d switches, %d expected\n", event_num[0], expected_num);
+        ok = false;
+    }
+    for (size_t i = 0; i < sizeof(rows) / sizeof(rows[0]); i++) {
+        if (!rows_seen[i]) {
+            printf("no row for %s\n", rows[i].task);
+            ok = false;
+        }
+    }
+    printf("%d periods of scripted switches: %s\n", PERIOD_NUM, ok ? "ok" : "failed");
+    return ok ? 0 : 1;
+}
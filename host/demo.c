@@ -0,0 +1,175 @@
+/* Runs the monitor over a scripted workload on the host stand-in
+
+   usage: perfmon_host_demo [LOG_FILE]
+
+   With LOG_FILE the windows are also logged to it as the "stats_log" flash
+   partition; read them back with stats_log_read.
+
+   The clock starts close to where the 32-bit run time counter wraps, so that
+   it wraps halfway through the second window, and the wifi task's counter
+   wraps in the first. The windows kept by the monitor are then checked
+   against the script: each task's run time and share, and "worker" deleted
+   and "worker2" created in the second window. The exit status is 1 if they
+   differ or the monitor fails.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "stats.h"
+#include "stats_priv.h"
+#include "fake_sched.h"
+
+#define LOG_PARTITION_SIZE  (16 * 4096)
+#define WINDOW_NUM          3
+#define WINDOW_US           1000000
+#define START_US            ((1LL << 32) - WINDOW_US * 3 / 2)  //run time counter wraps in window 1
+#define WIFI_START_RUN_TIME (UINT32_MAX - 100000)               //wraps in window 0
+
+typedef struct {
+    const char *name;
+    stats_task_status_t status;
+    uint32_t run_time;          //expected in a matched window, within a tick
+} expected_task_t;
+
+static TaskHandle_t s_worker;
+
+//Replace the "worker" task halfway through the second window
+static void script(uint32_t tick, void *arg) {
+    if (tick == 1500) {
+        TaskHandle_t worker2 = fake_task_create("worker2", 4, 1);
+        fake_task_set_load(worker2, 500);
+        fake_task_delete(s_worker);
+        s_worker = worker2;
+    }
+}
+
+#if CONFIG_STATS_BLACKBOX
+static void sink_on_tick(uint32_t tick, void *arg) {
+    stats_sink_process(0);
+}
+#endif
+
+static const stats_task_sample_t *find_task(const stats_window_t *window, const char *name) {
+    for (int i = 0; i < window->task_num; i++) {
+        if (strcmp(window->tasks[i].name, name) == 0) {
+            return &window->tasks[i];
+        }
+    }
+    return NULL;
+}
+
+static bool within_tick(uint32_t value, uint32_t expected) {
+    return value + FAKE_SCHED_TICK_US >= expected && value <= expected + FAKE_SCHED_TICK_US;
+}
+
+static bool check_window(uint32_t seq, const expected_task_t *expected, int expected_num) {
+    stats_window_t window;
+    if (stats_get_window(WINDOW_NUM - 1 - seq, &window) != ESP_OK || window.seq != seq) {
+        printf("window %u: not kept\n", seq);
+        return false;
+    }
+    bool ok = within_tick(window.elapsed, WINDOW_US);
+    if (!ok) {
+        printf("window %u: %u us long, %u expected\n", seq, window.elapsed, WINDOW_US);
+    }
+    for (int i = 0; i < expected_num; i++) {
+        const expected_task_t *e = &expected[i];
+        const stats_task_sample_t *task = find_task(&window, e->name);
+        if (task == NULL || task->status != e->status) {
+            printf("window %u: %s missing or not in the expected status\n", seq, e->name);
+            ok = false;
+            continue;
+        }
+        if (e->status != STATS_TASK_MATCHED) {
+            continue;
+        }
+        uint32_t percentage = (uint64_t)e->run_time * 100 / ((uint64_t)WINDOW_US * portNUM_PROCESSORS);
+        if (!within_tick(task->run_time, e->run_time) || task->percentage + 1 < percentage ||
+            task->percentage > percentage) {
+            printf("window %u: %s ran %u us (%u%%), %u us (%u%%) expected\n", seq, e->name,
+                   task->run_time, task->percentage, e->run_time, percentage);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+//The script's loads: wifi 30% of core 0, control 15%, httpd 20% of either core, worker 80% of
+//core 1 until worker2 replaces it at 50%
+static bool check_windows(void) {
+    const expected_task_t window0[] = {
+        { "wifi", STATS_TASK_MATCHED, 300000 },
+        { "control", STATS_TASK_MATCHED, 150000 },
+        { "httpd", STATS_TASK_MATCHED, 200000 },
+        { "worker", STATS_TASK_MATCHED, 800000 },
+    };
+    const expected_task_t window1[] = {
+        { "wifi", STATS_TASK_MATCHED, 300000 },
+        { "control", STATS_TASK_MATCHED, 150000 },
+        { "httpd", STATS_TASK_MATCHED, 200000 },
+        { "worker", STATS_TASK_DELETED, 0 },
+        { "worker2", STATS_TASK_CREATED, 0 },
+    };
+    const expected_task_t window2[] = {
+        { "wifi", STATS_TASK_MATCHED, 300000 },
+        { "control", STATS_TASK_MATCHED, 150000 },
+        { "httpd", STATS_TASK_MATCHED, 200000 },
+        { "worker2", STATS_TASK_MATCHED, 500000 },
+    };
+    bool ok = check_window(0, window0, sizeof(window0) / sizeof(window0[0]));
+    ok &= check_window(1, window1, sizeof(window1) / sizeof(window1[0]));
+    ok &= check_window(2, window2, sizeof(window2) / sizeof(window2[0]));
+    stats_window_t last;
+    stats_get_window(0, &last);
+    const stats_task_sample_t *wifi = find_task(&last, "wifi");
+    //Three windows of run time, each one counted once across both wraps
+    if (wifi == NULL || !within_tick(wifi->run_time_accumulated, 3 * 300000)) {
+        printf("wifi: accumulated run time is not three windows' worth\n");
+        ok = false;
+    }
+    printf("Windows: %s\n", ok ? "as scripted" : "differ from the script");
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    fake_sched_reset();
+    fake_sched_set_time(START_US);
+    if (argc > 1 && fake_partition_open(CONFIG_STATS_LOG_PARTITION_LABEL, argv[1], LOG_PARTITION_SIZE) != ESP_OK) {
+        return 1;
+    }
+
+    TaskHandle_t wifi = fake_task_create("wifi", 23, 0);
+    fake_task_set_load(wifi, 300);
+    fake_task_set_run_time(wifi, WIFI_START_RUN_TIME);
+    TaskHandle_t control = fake_task_create("control", 10, 0);
+    fake_task_set_load(control, 150);
+    fake_task_set_stack_high_water_mark(control, 256);
+    TaskHandle_t httpd = fake_task_create("httpd", 5, tskNO_AFFINITY);   //runs on either core
+    fake_task_set_load(httpd, 200);
+    s_worker = fake_task_create("worker", 4, 1);
+    fake_task_set_load(s_worker, 800);
+    fake_sched_set_tick_callback(script, NULL);
+
+    stats_init();
+    fake_sched_set_current(fake_sched_find_task("stats"));
+    for (int i = 0; i < WINDOW_NUM; i++) {
+        if (stats_monitor_run_once(pdMS_TO_TICKS(WINDOW_US / 1000)) != ESP_OK) {
+            printf("Error getting real time stats\n");
+            return 1;
+        }
+    }
+    stats_log_flush();
+#if CONFIG_STATS_BLACKBOX
+    //Replay the black box through the sinks as the next boot would. The replay waits for the
+    //sink task when the queue is full; the tick callback stands in for it.
+    fake_sched_set_tick_callback(sink_on_tick, NULL);
+    stats_blackbox_init();
+    stats_sink_process(0);
+#endif
+    printf("CPU load: core 0 %u%%, core 1 %u%%\n", stats_cpu_load_get(0), stats_cpu_load_get(1));
+    bool ok = check_windows();
+    return stats_ctxsw_print(false) == ESP_OK && ok ? 0 : 1;
+}
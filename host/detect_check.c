@@ -0,0 +1,89 @@
+/* Priority inversion events on the host stand-in
+
+   Two scripted phases on core 0, each window 1 s long:
+   - idle: sensor (priority 5) is ready at both ends of every window but
+     needs little CPU, so the idle task gets most of the core. No inversion
+     may be raised against the idle task.
+   - inversion: control (priority 10) stays ready but gets 5% of the core
+     while logger (priority 3) gets 60%. The event must be raised once, in the
+     third window of the streak. After one window in which control catches up,
+     a new streak must raise it once more.
+
+   Prints the events raised. The exit status is 1 if they are not exactly
+   the expected ones.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "stats.h"
+#include "stats_priv.h"
+#include "stats_sink.h"
+#include "fake_sched.h"
+
+#define WINDOW_TICKS    1000
+
+typedef struct {
+    int inversions;
+    uint32_t windows;           //of the last inversion event
+    char task[16], other[16];   //of the last inversion event
+} events_t;
+
+static events_t s_events;
+
+static void event_handler(const stats_event_t *event, void *arg) {
+    if (event->type != STATS_EVENT_PRIORITY_INVERSION) {
+        return;
+    }
+    s_events.inversions++;
+    s_events.windows = event->windows;
+    snprintf(s_events.task, sizeof(s_events.task), "%s", event->task->name);
+    snprintf(s_events.other, sizeof(s_events.other), "%s", event->other->name);
+}
+
+static void run_windows(int num) {
+    for (int i = 0; i < num; i++) {
+        stats_monitor_run_once(WINDOW_TICKS);
+    }
+}
+
+static bool expect(const char *phase, int inversions) {
+    bool ok = s_events.inversions == inversions;
+    printf("%s: %d inversion event(s), %d expected\n", phase, s_events.inversions, inversions);
+    return ok;
+}
+
+int main(void) {
+    fake_sched_reset();
+    TaskHandle_t sensor = fake_task_create("sensor", 5, 0);
+    fake_task_set_load(sensor, 50);
+    fake_task_set_state(sensor, eReady);
+    stats_set_event_handler(event_handler, NULL);
+    stats_init();
+    stats_sink_remove(&stats_sink_console);
+    fake_sched_set_current(fake_sched_find_task("stats"));
+    bool ok = true;
+
+    //A first window to have a start snapshot, then a mostly idle core
+    run_windows(6);
+    ok &= expect("idle", 0);
+
+    fake_task_set_state(sensor, eBlocked);
+    TaskHandle_t control = fake_task_create("control", 10, 0);
+    fake_task_set_load(control, 50);
+    fake_task_set_state(control, eReady);
+    TaskHandle_t logger = fake_task_create("logger", 3, 0);
+    fake_task_set_load(logger, 600);
+    //The window the tasks are created in has them as created, not matched
+    run_windows(6);
+    ok &= expect("inversion", 1);
+    ok &= s_events.windows == 3 && strcmp(s_events.task, "control") == 0 && strcmp(s_events.other, "logger") == 0;
+
+    fake_task_set_load(control, 900);
+    run_windows(1);
+    fake_task_set_load(control, 50);
+    run_windows(4);
+    ok &= expect("second inversion", 2);
+    return ok ? 0 : 1;
+}
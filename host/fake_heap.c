@@ -0,0 +1,63 @@
+/* Host stand-in for the heap_caps statistics functions */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_heap_caps.h"
+#include "fake_sched.h"
+
+#define FAKE_HEAP_NUM   3
+
+typedef struct {
+    uint32_t caps;
+    size_t free_size;
+    size_t min_free_size;
+    size_t largest_free_block;
+} fake_heap_t;
+
+static fake_heap_t s_heaps[FAKE_HEAP_NUM] = {
+    { MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA, 200 * 1024, 150 * 1024, 110 * 1024 },
+    { MALLOC_CAP_INTERNAL, 60 * 1024, 40 * 1024, 32 * 1024 },
+    { MALLOC_CAP_SPIRAM, 0, 0, 0 },
+};
+
+//Replace the heap whose capabilities are exactly caps
+void fake_heap_set(uint32_t caps, size_t free_size, size_t min_free_size, size_t largest_free_block) {
+    for (int i = 0; i < FAKE_HEAP_NUM; i++) {
+        if (s_heaps[i].caps == caps) {
+            s_heaps[i].free_size = free_size;
+            s_heaps[i].min_free_size = min_free_size;
+            s_heaps[i].largest_free_block = largest_free_block;
+        }
+    }
+}
+
+//Like heap_caps, a heap counts when it has every capability asked for
+size_t heap_caps_get_free_size(uint32_t caps) {
+    size_t size = 0;
+    for (int i = 0; i < FAKE_HEAP_NUM; i++) {
+        if ((s_heaps[i].caps & caps) == caps) {
+            size += s_heaps[i].free_size;
+        }
+    }
+    return size;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+    size_t size = 0;
+    for (int i = 0; i < FAKE_HEAP_NUM; i++) {
+        if ((s_heaps[i].caps & caps) == caps) {
+            size += s_heaps[i].min_free_size;
+        }
+    }
+    return size;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+    size_t size = 0;
+    for (int i = 0; i < FAKE_HEAP_NUM; i++) {
+        if ((s_heaps[i].caps & caps) == caps && s_heaps[i].largest_free_block > size) {
+            size = s_heaps[i].largest_free_block;
+        }
+    }
+    return size;
+}
@@ -0,0 +1,120 @@
+/* Host stand-in for esp_partition, backed by memory-mapped files */
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "esp_partition.h"
+#include "esp_log.h"
+
+#define FAKE_PARTITION_NUM  4
+#define FAKE_SECTOR_SIZE    4096
+
+typedef struct {
+    esp_partition_t partition;
+    uint8_t *data;
+} fake_partition_t;
+
+static const char *TAG = "fake_partition";
+static fake_partition_t s_partitions[FAKE_PARTITION_NUM];
+
+static fake_partition_t *get_fake(const esp_partition_t *partition) {
+    return (fake_partition_t *)partition;
+}
+
+esp_err_t fake_partition_open(const char *label, const char *path, size_t size) {
+    fake_partition_t *fake = NULL;
+    for (int i = 0; i < FAKE_PARTITION_NUM && fake == NULL; i++) {
+        if (s_partitions[i].data == NULL) {
+            fake = &s_partitions[i];
+        }
+    }
+    if (fake == NULL || size % FAKE_SECTOR_SIZE != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        ESP_LOGE(TAG, "cannot open %s", path);
+        return ESP_FAIL;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    bool created = st.st_size == 0;
+    if (created && ftruncate(fd, size) != 0) {
+        close(fd);
+        return ESP_FAIL;
+    }
+    if (!created && (size_t)st.st_size != size) {
+        ESP_LOGE(TAG, "%s is %ld bytes, expected %zu", path, (long)st.st_size, size);
+        close(fd);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    fake->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (fake->data == MAP_FAILED) {
+        fake->data = NULL;
+        return ESP_FAIL;
+    }
+    if (created) {
+        memset(fake->data, 0xff, size);
+    }
+    fake->partition = (esp_partition_t) {
+        .type = ESP_PARTITION_TYPE_DATA,
+        .subtype = ESP_PARTITION_SUBTYPE_ANY,
+        .size = size,
+    };
+    strncpy(fake->partition.label, label, sizeof(fake->partition.label) - 1);
+    return ESP_OK;
+}
+
+void fake_partition_close(const char *label) {
+    for (int i = 0; i < FAKE_PARTITION_NUM; i++) {
+        fake_partition_t *fake = &s_partitions[i];
+        if (fake->data != NULL && strcmp(fake->partition.label, label) == 0) {
+            munmap(fake->data, fake->partition.size);
+            memset(fake, 0, sizeof(*fake));
+        }
+    }
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label) {
+    for (int i = 0; i < FAKE_PARTITION_NUM; i++) {
+        fake_partition_t *fake = &s_partitions[i];
+        if (fake->data != NULL && fake->partition.type == type &&
+            (subtype == ESP_PARTITION_SUBTYPE_ANY || fake->partition.subtype == subtype) &&
+            (label == NULL || strcmp(fake->partition.label, label) == 0)) {
+            return &fake->partition;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size) {
+    if (src_offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, get_fake(partition)->data + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size) {
+    if (dst_offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    //NOR flash: programming can only clear bits
+    uint8_t *dst = get_fake(partition)->data + dst_offset;
+    for (size_t i = 0; i < size; i++) {
+        dst[i] &= ((const uint8_t *)src)[i];
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size) {
+    if (offset % FAKE_SECTOR_SIZE != 0 || size % FAKE_SECTOR_SIZE != 0 || offset + size > partition->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(get_fake(partition)->data + offset, 0xff, size);
+    return ESP_OK;
+}
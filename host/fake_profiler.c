@@ -0,0 +1,129 @@
+/* Host stand-in for the profiler's sampling interrupt
+
+   A SIGPROF interval timer stands in for the per-core timer interrupt. The
+   handler takes the interrupted PC from the signal context and the callers
+   from backtrace(), which unwinds through the signal frame, and stores them
+   with the fake scheduler's current task and core, as the interrupt would.
+   The samples are of the host process's own code, for profiling the monitor
+   itself; the executable is position independent, so its load address is
+   reported for the symboliser, and the executable segments of the shared
+   libraries so that samples in them are grouped by library.
+
+   The kernel checks process CPU time timers on its own tick, so at most HZ
+   samples a second are taken (often 250), whatever rate is asked for; the
+   dump's header still gives the rate asked for. A timer_create() timer on
+   CLOCK_PROCESS_CPUTIME_ID is checked the same way. Only a wall clock timer
+   would be finer, and it would also fire while the process sleeps.
+*/
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <link.h>
+#include <stdio.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+#include "stats_priv.h"
+
+#if STATS_ENABLED && CONFIG_STATS_PROFILER
+
+#define SKIP_FRAMES_MAX     4   //frames of the handler and the signal trampoline
+
+static struct sigaction s_old_action;
+
+static uintptr_t context_pc(const ucontext_t *context) {
+#if defined(__x86_64__)
+    return context->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+    return context->uc_mcontext.pc;
+#else
+    return 0;
+#endif
+}
+
+static void sample_on_signal(int signo, siginfo_t *info, void *arg) {
+    uintptr_t pcs[STATS_PROFILER_DEPTH];
+    int depth = 0;
+    pcs[depth++] = context_pc(arg);
+    if (pcs[0] == 0) {
+        return;
+    }
+#if STATS_PROFILER_DEPTH > 1
+    void *frames[STATS_PROFILER_DEPTH + SKIP_FRAMES_MAX];
+    int frame_num = backtrace(frames, STATS_PROFILER_DEPTH + SKIP_FRAMES_MAX);
+    //Callers follow the interrupted PC, once the unwinder has crossed the signal frame
+    for (int i = 0; i < frame_num && i <= SKIP_FRAMES_MAX; i++) {
+        if ((uintptr_t)frames[i] == pcs[0]) {
+            for (i++; i < frame_num && depth < STATS_PROFILER_DEPTH; i++) {
+                pcs[depth++] = (uintptr_t)frames[i];
+            }
+            break;
+        }
+    }
+#endif
+    stats_profiler_record(xPortGetCoreID(), xTaskGetCurrentTaskHandle(), pcs, depth);
+}
+
+esp_err_t stats_profiler_port_start(uint32_t hz) {
+    if (hz == 0 || hz > 1000000) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    //backtrace() loads the unwinder on its first call, which must not happen in the handler
+    void *frame;
+    backtrace(&frame, 1);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = sample_on_signal;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &s_old_action) != 0) {
+        return ESP_FAIL;
+    }
+    struct timeval period = { .tv_sec = 1 / hz, .tv_usec = (1000000 / hz) % 1000000 };
+    struct itimerval timer = { .it_interval = period, .it_value = period };
+    if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+        sigaction(SIGPROF, &s_old_action, NULL);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void stats_profiler_port_stop(void) {
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    sigaction(SIGPROF, &s_old_action, NULL);
+}
+
+uintptr_t stats_profiler_port_base(void) {
+    Dl_info info;
+    if (dladdr((void *)stats_profiler_port_base, &info) == 0) {
+        return 0;
+    }
+    return (uintptr_t)info.dli_fbase;
+}
+
+static int dump_module(struct dl_phdr_info *info, size_t size, void *arg) {
+    //The executable has no name here
+    const char *name = info->dlpi_name[0] != '\0' ? info->dlpi_name : program_invocation_short_name;
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type == PT_LOAD && (phdr->p_flags & PF_X)) {
+            uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+            printf("stats_profile,M,%lx,%lx,%s\n", (unsigned long)start, (unsigned long)(start + phdr->p_memsz), name);
+        }
+    }
+    return 0;
+}
+
+void stats_profiler_port_dump_modules(void) {
+    dl_iterate_phdr(dump_module, NULL);
+}
+
+#endif // STATS_ENABLED && CONFIG_STATS_PROFILER
@@ -0,0 +1,388 @@
+/* Host stand-in for FreeRTOS task functions and esp_timer */
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "esp_freertos_hooks.h"
+#include "stats_ctxsw.h"
+#include "fake_sched.h"
+
+#define FAKE_TASK_NUM       1100    //room for the benchmarks' largest task sets
+#define FAKE_TICK_HOOK_NUM  4
+
+struct fake_task {
+    bool used;
+    char name[configMAX_TASK_NAME_LEN];
+    UBaseType_t number;
+    UBaseType_t priority;
+    UBaseType_t base_priority;
+    BaseType_t core;
+    eTaskState state;               //reported state unless the task is running
+    uint32_t load;                  //permille of a core
+    uint32_t credit;
+    uint32_t run_time;
+    uint32_t stack_high_water_mark;
+    uint32_t notification;
+    void *tls[configNUM_THREAD_LOCAL_STORAGE_POINTERS];
+    TlsDeleteCallbackFunction_t tls_delete[configNUM_THREAD_LOCAL_STORAGE_POINTERS];
+};
+
+static struct fake_task s_tasks[FAKE_TASK_NUM];
+static UBaseType_t s_task_count;
+static UBaseType_t s_next_number;
+static TaskHandle_t s_idle[portNUM_PROCESSORS];
+static TaskHandle_t s_running[portNUM_PROCESSORS];
+static TaskHandle_t s_current;
+static BaseType_t s_current_core;
+//Set on threads that stand in for tasks (fake_sched_bind_thread)
+static __thread TaskHandle_t s_thread_task;
+static __thread BaseType_t s_thread_core;
+static int64_t s_now_us;
+static uint32_t s_tick;
+static fake_sched_tick_cb_t s_tick_cb;
+static void *s_tick_cb_arg;
+static esp_freertos_tick_cb_t s_tick_hooks[portNUM_PROCESSORS][FAKE_TICK_HOOK_NUM];
+
+void fake_sched_reset(void) {
+    for (int i = 0; i < FAKE_TASK_NUM; i++) {
+        if (s_tasks[i].used) {
+            fake_task_delete(&s_tasks[i]);
+        }
+    }
+    memset(s_tasks, 0, sizeof(s_tasks));
+    memset(s_tick_hooks, 0, sizeof(s_tick_hooks));
+    s_task_count = 0;
+    s_next_number = 1;
+    s_now_us = 0;
+    s_tick = 0;
+    s_tick_cb = NULL;
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        char name[configMAX_TASK_NAME_LEN];
+        snprintf(name, sizeof(name), "IDLE%d", core);
+        s_idle[core] = fake_task_create(name, 0, core);
+        s_running[core] = s_idle[core];
+    }
+    s_current = s_idle[0];
+    s_current_core = 0;
+}
+
+TaskHandle_t fake_task_create(const char *name, UBaseType_t priority, BaseType_t core) {
+    for (int i = 0; i < FAKE_TASK_NUM; i++) {
+        struct fake_task *task = &s_tasks[i];
+        if (!task->used) {
+            memset(task, 0, sizeof(*task));
+            task->used = true;
+            strncpy(task->name, name, sizeof(task->name) - 1);
+            task->number = s_next_number++;
+            task->priority = priority;
+            task->base_priority = priority;
+            task->core = core;
+            task->state = eBlocked;
+            task->stack_high_water_mark = 2048;
+            s_task_count++;
+            return task;
+        }
+    }
+    return NULL;
+}
+
+void fake_task_delete(TaskHandle_t task) {
+    for (int i = 0; i < configNUM_THREAD_LOCAL_STORAGE_POINTERS; i++) {
+        if (task->tls[i] != NULL && task->tls_delete[i] != NULL) {
+            task->tls_delete[i](i, task->tls[i]);
+        }
+    }
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        if (s_running[core] == task) {
+            s_running[core] = s_idle[core];
+        }
+    }
+    if (s_current == task) {
+        s_current = s_idle[0];
+    }
+    task->used = false;
+    s_task_count--;
+}
+
+void fake_task_set_load(TaskHandle_t task, uint32_t load_permille) {
+    task->load = load_permille > 1000 ? 1000 : load_permille;
+}
+
+void fake_task_set_state(TaskHandle_t task, eTaskState state) {
+    task->state = state;
+}
+
+void fake_task_set_priority(TaskHandle_t task, UBaseType_t priority, UBaseType_t base_priority) {
+    task->priority = priority;
+    task->base_priority = base_priority;
+}
+
+void fake_task_set_stack_high_water_mark(TaskHandle_t task, uint32_t bytes) {
+    task->stack_high_water_mark = bytes;
+}
+
+void fake_task_set_core(TaskHandle_t task, BaseType_t core) {
+    task->core = core;
+}
+
+void fake_task_set_run_time(TaskHandle_t task, uint32_t run_time) {
+    task->run_time = run_time;
+}
+
+uint32_t fake_task_take_notification(TaskHandle_t task) {
+    uint32_t value = task->notification;
+    task->notification = 0;
+    return value;
+}
+
+void fake_sched_set_current(TaskHandle_t task) {
+    s_current = task;
+}
+
+void fake_sched_bind_thread(TaskHandle_t task, BaseType_t core) {
+    s_thread_task = task;
+    s_thread_core = core;
+}
+
+static TaskHandle_t current_task(void) {
+    return s_thread_task != NULL ? s_thread_task : s_current;
+}
+
+void fake_sched_set_tick_callback(fake_sched_tick_cb_t cb, void *arg) {
+    s_tick_cb = cb;
+    s_tick_cb_arg = arg;
+}
+
+TaskHandle_t fake_sched_find_task(const char *name) {
+    for (int i = 0; i < FAKE_TASK_NUM; i++) {
+        if (s_tasks[i].used && strcmp(s_tasks[i].name, name) == 0) {
+            return &s_tasks[i];
+        }
+    }
+    return NULL;
+}
+
+static bool is_running_below(TaskHandle_t task, BaseType_t core) {
+    for (BaseType_t other = 0; other < core; other++) {
+        if (s_running[other] == task) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//Credit every task that wants to run with its load for this tick
+static void credit_tasks(void) {
+    for (int i = 0; i < FAKE_TASK_NUM; i++) {
+        struct fake_task *task = &s_tasks[i];
+        if (task->used && task->load > 0 && task->state != eSuspended) {
+            task->credit += task->load;
+        }
+    }
+}
+
+//Pick the task that has fallen furthest behind its load on this core. Unpinned tasks may run on
+//any core, but on one at a time; lower cores pick first.
+static TaskHandle_t pick_task(BaseType_t core) {
+    TaskHandle_t next = s_idle[core];
+    for (int i = 0; i < FAKE_TASK_NUM; i++) {
+        struct fake_task *task = &s_tasks[i];
+        if (!task->used || task->load == 0 || task->state == eSuspended) {
+            continue;
+        }
+        if (task->core != core && (task->core != tskNO_AFFINITY || is_running_below(task, core))) {
+            continue;
+        }
+        if (task->credit >= 1000 && (next == s_idle[core] || task->credit > next->credit ||
+                                     (task->credit == next->credit && task->priority > next->priority))) {
+            next = task;
+        }
+    }
+    if (next != s_idle[core]) {
+        next->credit -= 1000;
+    }
+    return next;
+}
+
+void fake_sched_advance(uint32_t ticks) {
+    TaskHandle_t caller = s_current;
+    for (uint32_t t = 0; t < ticks; t++) {
+        if (s_tick_cb != NULL) {
+            s_tick_cb(s_tick, s_tick_cb_arg);
+        }
+        credit_tasks();
+        for (BaseType_t core = 0; core < portNUM_PROCESSORS; core++) {
+            s_current_core = core;
+            TaskHandle_t next = pick_task(core);
+            if (next != s_running[core]) {
+                s_current = s_running[core];
+                traceTASK_SWITCHED_OUT();
+                s_running[core] = next;
+                s_current = next;
+                traceTASK_SWITCHED_IN();
+            }
+            s_current = next;
+            for (int i = 0; i < FAKE_TICK_HOOK_NUM && s_tick_hooks[core][i] != NULL; i++) {
+                s_tick_hooks[core][i]();
+            }
+            next->run_time += FAKE_SCHED_TICK_US;
+        }
+        s_now_us += FAKE_SCHED_TICK_US;
+        s_tick++;
+    }
+    s_current_core = 0;
+    s_current = caller;
+}
+
+void fake_sched_set_time(int64_t now_us) {
+    s_now_us = now_us;
+}
+
+uint32_t fake_sched_tick_count(void) {
+    return s_tick;
+}
+
+uint32_t fake_sched_run_time_counter(void) {
+    return (uint32_t)s_now_us;
+}
+
+int64_t esp_timer_get_time(void) {
+    return s_now_us;
+}
+
+BaseType_t xPortGetCoreID(void) {
+    return s_thread_task != NULL ? s_thread_core : s_current_core;
+}
+
+UBaseType_t uxTaskGetNumberOfTasks(void) {
+    return s_task_count;
+}
+
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *pxTaskStatusArray, UBaseType_t uxArraySize, uint32_t *pulTotalRunTime) {
+    if (uxArraySize < s_task_count) {
+        return 0;
+    }
+    UBaseType_t n = 0;
+    for (int i = 0; i < FAKE_TASK_NUM; i++) {
+        struct fake_task *task = &s_tasks[i];
+        if (!task->used) {
+            continue;
+        }
+        TaskStatus_t *status = &pxTaskStatusArray[n++];
+        memset(status, 0, sizeof(*status));
+        status->xHandle = task;
+        status->pcTaskName = task->name;
+        status->xTaskNumber = task->number;
+        status->eCurrentState = (task == s_current) ? eRunning : task->state;
+        status->uxCurrentPriority = task->priority;
+        status->uxBasePriority = task->base_priority;
+        status->ulRunTimeCounter = task->run_time;
+        status->usStackHighWaterMark = task->stack_high_water_mark;
+        status->xCoreID = task->core;
+    }
+    if (pulTotalRunTime != NULL) {
+        *pulTotalRunTime = (uint32_t)s_now_us;
+    }
+    return n;
+}
+
+void vTaskDelay(TickType_t xTicksToDelay) {
+    fake_sched_advance(xTicksToDelay);
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode, const char *pcName, uint32_t usStackDepth,
+                                   void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pvCreatedTask,
+                                   BaseType_t xCoreID) {
+    TaskHandle_t task = fake_task_create(pcName, uxPriority, xCoreID);
+    if (task == NULL) {
+        return pdFAIL;
+    }
+    if (pvCreatedTask != NULL) {
+        *pvCreatedTask = task;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t xTask) {
+    fake_task_delete(xTask == NULL ? current_task() : xTask);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return current_task();
+}
+
+TaskHandle_t xTaskGetIdleTaskHandle(void) {
+    return s_idle[xPortGetCoreID()];
+}
+
+uint32_t ulTaskGetIdleRunTimeCounter(void) {
+    return s_idle[xPortGetCoreID()]->run_time;
+}
+
+char *pcTaskGetName(TaskHandle_t xTaskToQuery) {
+    return (xTaskToQuery == NULL ? current_task() : xTaskToQuery)->name;
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return s_tick;
+}
+
+void vTaskPrioritySet(TaskHandle_t xTask, UBaseType_t uxNewPriority) {
+    TaskHandle_t task = (xTask == NULL) ? current_task() : xTask;
+    //An inherited priority is kept unless the new base priority is higher
+    if (task->priority == task->base_priority || uxNewPriority > task->priority) {
+        task->priority = uxNewPriority;
+    }
+    task->base_priority = uxNewPriority;
+}
+
+void vTaskSuspend(TaskHandle_t xTaskToSuspend) {
+    ((xTaskToSuspend == NULL) ? current_task() : xTaskToSuspend)->state = eSuspended;
+}
+
+void vTaskResume(TaskHandle_t xTaskToResume) {
+    if (xTaskToResume->state == eSuspended) {
+        xTaskToResume->state = eReady;
+    }
+}
+
+BaseType_t xTaskNotify(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction) {
+    switch (eAction) {
+    case eSetBits:
+        xTaskToNotify->notification |= ulValue;
+        break;
+    case eIncrement:
+        xTaskToNotify->notification++;
+        break;
+    case eSetValueWithOverwrite:
+    case eSetValueWithoutOverwrite:
+        xTaskToNotify->notification = ulValue;
+        break;
+    default:
+        break;
+    }
+    return pdPASS;
+}
+
+void *pvTaskGetThreadLocalStoragePointer(TaskHandle_t xTaskToQuery, BaseType_t xIndex) {
+    return (xTaskToQuery == NULL ? current_task() : xTaskToQuery)->tls[xIndex];
+}
+
+void vTaskSetThreadLocalStoragePointerAndDelCallback(TaskHandle_t xTaskToSet, BaseType_t xIndex, void *pvValue,
+                                                     TlsDeleteCallbackFunction_t pvDelCallback) {
+    TaskHandle_t task = (xTaskToSet == NULL) ? current_task() : xTaskToSet;
+    task->tls[xIndex] = pvValue;
+    task->tls_delete[xIndex] = pvDelCallback;
+}
+
+esp_err_t esp_register_freertos_tick_hook_for_cpu(esp_freertos_tick_cb_t new_tick_cb, int cpuid) {
+    for (int i = 0; i < FAKE_TICK_HOOK_NUM; i++) {
+        if (s_tick_hooks[cpuid][i] == NULL) {
+            s_tick_hooks[cpuid][i] = new_tick_cb;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
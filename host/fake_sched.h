@@ -0,0 +1,54 @@
+#pragma once
+
+//Scriptable fake scheduler behind the host FreeRTOS stand-in.
+//
+//Time only moves when the code under test calls vTaskDelay (or a script calls
+//fake_sched_advance). Every simulated tick, each core runs the task that is
+//furthest behind its configured load, or its idle task, and that task is
+//credited with the tick in its run time counter. Context switch trace hooks
+//and tick hooks are called as a real scheduler would.
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define FAKE_SCHED_TICK_US      (1000000 / configTICK_RATE_HZ)
+
+//Called at the start of every simulated tick, before any task runs
+typedef void (*fake_sched_tick_cb_t)(uint32_t tick, void *arg);
+
+void fake_sched_reset(void);
+
+TaskHandle_t fake_task_create(const char *name, UBaseType_t priority, BaseType_t core);
+void fake_task_delete(TaskHandle_t task);
+
+//Share of one core the task gets, in permille
+void fake_task_set_load(TaskHandle_t task, uint32_t load_permille);
+//State reported by uxTaskGetSystemState while the task is not the current one; eBlocked by default.
+//eSuspended also stops the task from being scheduled.
+void fake_task_set_state(TaskHandle_t task, eTaskState state);
+void fake_task_set_priority(TaskHandle_t task, UBaseType_t priority, UBaseType_t base_priority);
+void fake_task_set_stack_high_water_mark(TaskHandle_t task, uint32_t bytes);
+void fake_task_set_core(TaskHandle_t task, BaseType_t core);
+//Run time counter of the task, e.g. close to where it wraps
+void fake_task_set_run_time(TaskHandle_t task, uint32_t run_time);
+//Notification value set through xTaskNotify, cleared as the task would on taking it
+uint32_t fake_task_take_notification(TaskHandle_t task);
+
+//Task whose code is executing, as seen by xTaskGetCurrentTaskHandle
+void fake_sched_set_current(TaskHandle_t task);
+//Make the calling thread run as task on core, whatever the fake scheduler's current task is, so
+//threads can stand in for tasks preempting each other. The scheduler itself is not thread safe:
+//only one thread may create tasks or advance time.
+void fake_sched_bind_thread(TaskHandle_t task, BaseType_t core);
+
+void fake_sched_set_tick_callback(fake_sched_tick_cb_t cb, void *arg);
+void fake_sched_advance(uint32_t ticks);
+//Move the clock behind esp_timer and the run time counter, e.g. close to where the counter wraps
+void fake_sched_set_time(int64_t now_us);
+uint32_t fake_sched_tick_count(void);
+
+//Task created through xTaskCreatePinnedToCore; its code is not run
+TaskHandle_t fake_sched_find_task(const char *name);
+
+void fake_heap_set(uint32_t caps, size_t free_size, size_t min_free_size, size_t largest_free_block);
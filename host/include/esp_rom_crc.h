@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdint.h>
+
+//Same result as the ROM function: crc32_le(0, buf, len) is the usual CRC-32 of buf
+static inline uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len) {
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+typedef enum {
+    ESP_RST_UNKNOWN,
+    ESP_RST_POWERON,
+    ESP_RST_EXT,
+    ESP_RST_SW,
+    ESP_RST_PANIC,
+    ESP_RST_INT_WDT,
+    ESP_RST_TASK_WDT,
+    ESP_RST_WDT,
+} esp_reset_reason_t;
+
+//A host run standing in for a reboot is a software reset
+static inline esp_reset_reason_t esp_reset_reason(void) {
+    return ESP_RST_SW;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+//Host stand-in for FreeRTOS mutexes: a pthread mutex in the static buffer, or a heap allocated one
+
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+
+typedef struct {
+    pthread_mutex_t mutex;
+} StaticSemaphore_t;
+
+typedef StaticSemaphore_t *SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer) {
+    pthread_mutex_init(&buffer->mutex, NULL);
+    return buffer;
+}
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    StaticSemaphore_t *buffer = malloc(sizeof(StaticSemaphore_t));
+    return buffer != NULL ? xSemaphoreCreateMutexStatic(buffer) : NULL;
+}
+
+//Only for mutexes from xSemaphoreCreateMutex
+static inline void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+    pthread_mutex_destroy(&semaphore->mutex);
+    free(semaphore);
+}
+
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+    (void)ticks;
+    return pthread_mutex_lock(&semaphore->mutex) == 0 ? pdTRUE : pdFALSE;
+}
+
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    return pthread_mutex_unlock(&semaphore->mutex) == 0 ? pdTRUE : pdFALSE;
+}
@@ -0,0 +1,58 @@
+/* CPU load meter on the host stand-in
+
+   Scripts the busy share of each core in phases and checks the percentage
+   stats_cpu_load_get reports for each core once the meter has seen two full
+   windows of the phase: idle cores, a fully busy core, and partly busy cores,
+   with a task that runs on either core. The meter may be off by half a tick
+   at each end of its window, so one percent either way is accepted.
+
+   Prints one line per phase. The exit status is 1 if a core's load is off.
+*/
+
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "stats.h"
+#include "fake_sched.h"
+
+#define PHASE_TICKS     (2 * CONFIG_STATS_CPU_LOAD_WINDOW_TICKS)
+
+typedef struct {
+    const char *name;
+    uint32_t load0, load1, load_any;    //permille of the core 0 task, core 1 task and unpinned task
+    uint32_t expected[portNUM_PROCESSORS];
+} phase_t;
+
+int main(void) {
+    static const phase_t phases[] = {
+        { "idle", 0, 0, 0, { 0, 0 } },
+        { "core 1 busy", 0, 1000, 0, { 0, 100 } },
+        { "partly busy", 300, 550, 0, { 30, 55 } },
+        { "unpinned task", 300, 1000, 400, { 70, 100 } },
+    };
+    fake_sched_reset();
+    TaskHandle_t task0 = fake_task_create("task0", 5, 0);
+    TaskHandle_t task1 = fake_task_create("task1", 5, 1);
+    TaskHandle_t task_any = fake_task_create("task_any", 5, tskNO_AFFINITY);
+    if (stats_cpu_load_init() != ESP_OK) {
+        return 1;
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(phases) / sizeof(phases[0]); i++) {
+        const phase_t *phase = &phases[i];
+        fake_task_set_load(task0, phase->load0);
+        fake_task_set_load(task1, phase->load1);
+        fake_task_set_load(task_any, phase->load_any);
+        fake_sched_advance(PHASE_TICKS);
+        printf("%s:", phase->name);
+        for (int core = 0; core < portNUM_PROCESSORS; core++) {
+            uint32_t load = stats_cpu_load_get(core);
+            bool core_ok = load + 1 >= phase->expected[core] && load <= phase->expected[core] + 1;
+            printf(" core %d %u%% (%u%% expected)%s", core, load, phase->expected[core], core_ok ? "" : " off");
+            ok &= core_ok;
+        }
+        printf("\n");
+    }
+    return ok ? 0 : 1;
+}
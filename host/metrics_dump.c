@@ -0,0 +1,64 @@
+/* Prints the OpenMetrics exposition after a short scripted run on the host stand-in
+
+   usage: metrics_dump | tools/openmetrics_check.py
+
+   A few tasks run for three windows while run time handles measure work of
+   different lengths, two of them under the same name. The exposition is
+   rendered into a fixed buffer, as on the device, and written to stdout.
+*/
+
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "stats.h"
+#include "stats_priv.h"
+#include "stats_sink.h"
+#include "fake_sched.h"
+
+static char s_buf[8192];
+
+//Measure work lasting ticks milliseconds, times times
+static void measure(stats_run_time_t *handler, int times, TickType_t ticks) {
+    for (int i = 0; i < times; i++) {
+        stats_run_time_start(handler);
+        vTaskDelay(ticks);
+        stats_run_time_stop(handler);
+    }
+}
+
+int main(void) {
+    fake_sched_reset();
+    TaskHandle_t wifi = fake_task_create("wifi", 23, 0);
+    fake_task_set_load(wifi, 300);
+    TaskHandle_t control = fake_task_create("control \"loop\"", 10, 0);
+    fake_task_set_load(control, 150);
+    fake_task_set_stack_high_water_mark(control, 256);
+    TaskHandle_t worker = fake_task_create("worker", 4, tskNO_AFFINITY);
+    fake_task_set_load(worker, 800);
+
+    stats_init();
+    stats_sink_remove(&stats_sink_console);
+    fake_sched_set_current(fake_sched_find_task("stats"));
+    for (int i = 0; i < 3; i++) {
+        stats_monitor_run_once(pdMS_TO_TICKS(1000));
+    }
+
+    stats_run_time_t *parse = stats_run_time_init("parse");
+    stats_run_time_t *flush = stats_run_time_init("flush");
+    stats_run_time_t *flush2 = stats_run_time_init("flush");
+    measure(parse, 20, 0);
+    measure(parse, 5, 2);
+    measure(flush, 3, 50);
+    measure(flush2, 1, 1500);
+
+    size_t len;
+    if (stats_metrics_render(s_buf, sizeof(s_buf), &len) != ESP_OK) {
+        fprintf(stderr, "exposition needs %zu bytes\n", len);
+        return 1;
+    }
+    fwrite(s_buf, 1, len, stdout);
+    stats_run_time_free(flush2);
+    stats_run_time_free(flush);
+    stats_run_time_free(parse);
+    return 0;
+}
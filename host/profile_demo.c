@@ -0,0 +1,80 @@
+/* Profiles the monitor on the host stand-in
+
+   usage: profile_demo [SECONDS]
+
+   Runs monitor passes over TASK_NUM tasks, each window also formatted as the
+   report, as JSON and encoded, for SECONDS of CPU time (default 2) with the
+   profiler sampling, then prints the samples with stats_profiler_dump().
+   Symbolise them with
+
+       profile_demo > profile.txt
+       tools/stats_profile.py profile.txt --elf profile_demo
+       tools/stats_profile.py profile.txt --elf profile_demo --folded > profile.folded
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "stats.h"
+#include "stats_priv.h"
+#include "stats_encode.h"
+#include "stats_json.h"
+#include "stats_sink.h"
+#include "fake_sched.h"
+
+#define TASK_NUM    400
+
+static stats_window_t s_window;
+static stats_encoder_t s_encoder;
+static stats_json_t s_json;
+static uint8_t s_record[STATS_ENCODE_SIZE_MAX];
+static char s_text[4096];
+static size_t s_bytes;
+
+static void discard(const char *text, size_t len, void *arg) {
+    s_bytes += len;
+}
+
+static double cpu_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    double seconds = argc > 1 ? atof(argv[1]) : 2;
+    fake_sched_reset();
+    for (int i = 0; i < TASK_NUM; i++) {
+        char name[configMAX_TASK_NAME_LEN];
+        snprintf(name, sizeof(name), "task%d", i);
+        TaskHandle_t task = fake_task_create(name, 1 + i % 20, i % 2);
+        fake_task_set_load(task, 1 + i % 5);
+    }
+    stats_init();
+    stats_sink_remove(&stats_sink_console);
+    fake_sched_set_current(fake_sched_find_task("stats"));
+    stats_encoder_init(&s_encoder, 10);
+
+    if (stats_profiler_start(0) != ESP_OK) {
+        return 1;
+    }
+    uint32_t windows = 0;
+    double end = cpu_seconds() + seconds;
+    while (cpu_seconds() < end) {
+        stats_monitor_run_once(1);
+        stats_get_window(0, &s_window);
+        stats_window_format(&s_window, discard, NULL);
+        stats_json_window(&s_json, &s_window);
+        while (stats_json_read(&s_json, s_text, sizeof(s_text)) > 0) {
+        }
+        size_t len;
+        stats_encode_window(&s_encoder, &s_window, s_record, sizeof(s_record), &len);
+        windows++;
+    }
+    stats_profiler_stop();
+    fprintf(stderr, "%u windows of %d tasks in %.1f s of CPU time\n", (unsigned)windows, TASK_NUM, seconds);
+    stats_profiler_dump();
+    return 0;
+}
@@ -0,0 +1,144 @@
+/* CPU quotas on the host stand-in
+
+   Three tasks overrun their quotas, one for each action:
+   - render (core 0) is notified, and sheds load when it sees the notification
+   - logger (core 0) is suspended, resumed, and suspended again while it keeps
+     overrunning; its quota is cleared near the end, which resumes it for good
+   - encoder (core 1) is lowered one priority step per overrun, until its load
+     drops halfway through, after which its priority is restored
+
+   Prints each task's share of a core and priority per window, and the events
+   raised. The exit status is 1 if any task was not treated as described.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "stats.h"
+#include "stats_priv.h"
+#include "stats_sink.h"
+#include "fake_sched.h"
+
+#define WINDOW_NUM          18
+#define WINDOW_TICKS        1000
+#define LOGGER_CLEAR_WINDOW 15      //quota of logger cleared after this window
+#define ENCODER_CALM_TICK   (8 * WINDOW_TICKS)
+
+typedef struct {
+    const char *name;
+    TaskHandle_t task;
+    uint32_t percent[WINDOW_NUM];
+    uint8_t priority[WINDOW_NUM];
+    stats_task_state_t state[WINDOW_NUM];
+    int overruns;
+} sim_task_t;
+
+static sim_task_t s_render = { .name = "render" };
+static sim_task_t s_logger = { .name = "logger" };
+static sim_task_t s_encoder = { .name = "encoder" };
+static sim_task_t *const s_sim_tasks[] = { &s_render, &s_logger, &s_encoder };
+
+static void script(uint32_t tick, void *arg) {
+    //render takes its notification on its next tick, and halves its work
+    if (fake_task_take_notification(s_render.task) & STATS_QUOTA_NOTIFY_BIT) {
+        fake_task_set_load(s_render.task, 300);
+    }
+    if (tick == ENCODER_CALM_TICK) {
+        fake_task_set_load(s_encoder.task, 300);
+    }
+}
+
+static void event_handler(const stats_event_t *event, void *arg) {
+    if (event->type != STATS_EVENT_QUOTA_OVERRUN) {
+        return;
+    }
+    printf("window %u: %s over quota for %u windows\n", (unsigned)event->seq, event->task->name,
+           (unsigned)event->windows);
+    for (size_t i = 0; i < sizeof(s_sim_tasks) / sizeof(s_sim_tasks[0]); i++) {
+        if (strcmp(event->task->name, s_sim_tasks[i]->name) == 0) {
+            s_sim_tasks[i]->overruns++;
+        }
+    }
+}
+
+static void record(int w, const stats_window_t *window) {
+    for (size_t i = 0; i < sizeof(s_sim_tasks) / sizeof(s_sim_tasks[0]); i++) {
+        sim_task_t *sim = s_sim_tasks[i];
+        for (int t = 0; t < window->task_num; t++) {
+            const stats_task_sample_t *task = &window->tasks[t];
+            if (strcmp(task->name, sim->name) == 0) {
+                sim->percent[w] = (uint64_t)task->run_time * 100 / window->elapsed;
+                sim->priority[w] = task->base_priority;
+                sim->state[w] = task->state;
+            }
+        }
+    }
+}
+
+static bool check(bool ok, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "failed: %s\n", what);
+    }
+    return ok;
+}
+
+int main(void) {
+    fake_sched_reset();
+    s_render.task = fake_task_create(s_render.name, 5, 0);
+    fake_task_set_load(s_render.task, 600);
+    s_logger.task = fake_task_create(s_logger.name, 4, 0);
+    fake_task_set_load(s_logger.task, 350);
+    s_encoder.task = fake_task_create(s_encoder.name, 8, 1);
+    fake_task_set_load(s_encoder.task, 700);
+    fake_sched_set_tick_callback(script, NULL);
+
+    stats_init();
+    stats_sink_remove(&stats_sink_console);
+    stats_set_event_handler(event_handler, NULL);
+    fake_sched_set_current(fake_sched_find_task("stats"));
+    if (stats_quota_set("render", 40, 3, STATS_QUOTA_NOTIFY) != ESP_OK ||
+        stats_quota_set("logger", 25, 2, STATS_QUOTA_SUSPEND) != ESP_OK ||
+        stats_quota_set("encoder", 50, 2, STATS_QUOTA_LOWER_PRIORITY) != ESP_OK) {
+        return 1;
+    }
+
+    printf("| Window | render %% | logger %% | logger state | encoder %% | encoder priority\n");
+    printf("| --- | --- | --- | --- | --- | ---\n");
+    for (int w = 0; w < WINDOW_NUM; w++) {
+        stats_window_t window;
+        if (stats_monitor_run_once(pdMS_TO_TICKS(WINDOW_TICKS)) != ESP_OK || stats_get_window(0, &window) != ESP_OK) {
+            return 1;
+        }
+        record(w, &window);
+        printf("| %d | %u | %u | %s | %u | %u\n", w, (unsigned)s_render.percent[w], (unsigned)s_logger.percent[w],
+               s_logger.state[w] == STATS_TASK_SUSPENDED ? "suspended" : "running", (unsigned)s_encoder.percent[w],
+               s_encoder.priority[w]);
+        if (w == LOGGER_CLEAR_WINDOW) {
+            stats_quota_clear("logger");
+        }
+    }
+
+    bool ok = true;
+    //Notified after the third window over, then within the quota
+    ok &= check(s_render.overruns == 1 && s_render.percent[2] > 40, "render notified once");
+    for (int w = 4; w < WINDOW_NUM; w++) {
+        ok &= check(s_render.percent[w] <= 40, "render within its quota after the notification");
+    }
+    //Suspended windows get no CPU; suspended and resumed more than once
+    int suspensions = 0, resumptions = 0;
+    for (int w = 1; w < WINDOW_NUM; w++) {
+        bool suspended = s_logger.state[w] == STATS_TASK_SUSPENDED;
+        bool was_suspended = s_logger.state[w - 1] == STATS_TASK_SUSPENDED;
+        ok &= check(!suspended || s_logger.percent[w] == 0, "suspended logger gets no CPU");
+        suspensions += suspended && !was_suspended;
+        resumptions += !suspended && was_suspended;
+    }
+    ok &= check(suspensions >= 2 && resumptions >= 2, "logger suspended and resumed repeatedly");
+    ok &= check(s_logger.state[WINDOW_NUM - 1] != STATS_TASK_SUSPENDED && s_logger.percent[WINDOW_NUM - 1] > 25,
+                "logger runs freely once its quota is cleared");
+    //Lowered step by step while over (seen from the next window on), restored once calm
+    ok &= check(s_encoder.priority[2] == 7 && s_encoder.priority[8] == 4, "encoder lowered once per overrun");
+    ok &= check(s_encoder.priority[WINDOW_NUM - 1] == 8, "encoder priority restored");
+    return ok ? 0 : 1;
+}
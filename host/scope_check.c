@@ -0,0 +1,88 @@
+/* Scope guards that recurse or overlap, on the host stand-in
+
+   A recursive function, and two tasks in the same scope at once, share one
+   handle through the scope guard. Only the outermost entry, or the task that
+   came first, may measure. The exit status is 1 if the handle's time is not
+   exactly that entry's, or if the handle is left running.
+
+   Built as C (the cleanup attribute guard) and, when a C++ compiler is found,
+   as C++ (stats::run_time_scope).
+*/
+
+#include <stdio.h>
+#include "stats.h"
+#include "stats_scope.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "fake_sched.h"
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef __cplusplus
+#define LANGUAGE        "C++"
+#define SCOPE(handler)  stats::run_time_scope scope(handler)
+#else
+#define LANGUAGE        "C"
+#define SCOPE(handler) \
+    stats_run_time_t *scope __attribute__((cleanup(stats_run_time_scope_end), unused)) = \
+        stats_run_time_scope_begin(handler)
+#endif
+
+#define STEP_TICKS  10
+
+static stats_run_time_t *s_handler;
+
+static void recurse(int depth) {
+    SCOPE(s_handler);
+    fake_sched_advance(STEP_TICKS);
+    if (depth > 0) {
+        recurse(depth - 1);
+    }
+    fake_sched_advance(STEP_TICKS);
+}
+
+//a enters first; b enters while a is inside and leaves before it
+static void overlap(TaskHandle_t a, TaskHandle_t b) {
+    fake_sched_set_current(a);
+    SCOPE(s_handler);
+    fake_sched_advance(STEP_TICKS);
+    fake_sched_set_current(b);
+    {
+        SCOPE(s_handler);
+        fake_sched_advance(STEP_TICKS);
+    }
+    fake_sched_set_current(a);
+    fake_sched_advance(STEP_TICKS);
+}
+
+static bool check(const char *name, int64_t expected_ticks) {
+    int64_t expected = expected_ticks * FAKE_SCHED_TICK_US;
+    bool ok = s_handler->time == expected && s_handler->state == STATS_MEASURE_STOP;
+    printf("%s %s: %lld us measured, %lld us expected%s\n", LANGUAGE, name, (long long)s_handler->time,
+           (long long)expected, s_handler->state == STATS_MEASURE_STOP ? "" : ", still running");
+    return ok;
+}
+
+int main(void) {
+    fake_sched_reset();
+    TaskHandle_t a = fake_task_create("a", 5, 0);
+    TaskHandle_t b = fake_task_create("b", 5, 1);
+    fake_sched_set_current(a);
+    s_handler = stats_run_time_init("scope");
+    bool ok = true;
+
+    //Four levels of STEP_TICKS on the way in and out, all inside the outermost entry
+    recurse(3);
+    ok &= check("recursion", 8 * STEP_TICKS);
+    recurse(0);
+    ok &= check("second call", 10 * STEP_TICKS);
+
+    s_handler->time = 0;
+    overlap(a, b);
+    ok &= check("two tasks", 3 * STEP_TICKS);
+
+    stats_run_time_free(s_handler);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,2 @@
+//scope_check.c built as C++, for stats::run_time_scope
+#include "scope_check.c"
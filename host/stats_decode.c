@@ -0,0 +1,65 @@
+/* Decodes a stream of encoded monitor windows (stats_encode.h) and prints
+   them in the monitor's report format.
+
+   usage: stats_decode [FILE]      reads stdin without FILE
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stats_priv.h"
+#include "stats_encode.h"
+
+static stats_decoder_t s_decoder;
+static stats_window_t s_window;
+
+int main(int argc, char **argv) {
+    FILE *file = stdin;
+    if (argc > 1) {
+        file = fopen(argv[1], "rb");
+        if (file == NULL) {
+            perror(argv[1]);
+            return 2;
+        }
+    }
+
+    static uint8_t buf[4 * STATS_ENCODE_SIZE_MAX];
+    size_t len = 0;
+    size_t read_len;
+    int skipped = 0, malformed = 0;
+    stats_decoder_init(&s_decoder);
+    while ((read_len = fread(buf + len, 1, sizeof(buf) - len, file)) > 0 || len > 0) {
+        len += read_len;
+        size_t pos = 0;
+        while (pos < len) {
+            size_t used = 0;
+            esp_err_t ret = stats_decode_window(&s_decoder, buf + pos, len - pos, &s_window, &used);
+            if (ret == ESP_ERR_INVALID_SIZE) {
+                break;      //Rest of the record is in the next read
+            }
+            if (ret == ESP_ERR_INVALID_CRC && used == 0) {
+                fprintf(stderr, "stream is not a window record stream\n");
+                return 1;
+            }
+            if (ret == ESP_OK) {
+                printf("\nWindow %u\n", s_window.seq);
+                stats_window_print(&s_window);
+            } else if (ret == ESP_ERR_NOT_FOUND) {
+                skipped++;
+            } else {
+                malformed++;
+            }
+            pos += used;
+        }
+        memmove(buf, buf + pos, len - pos);
+        len -= pos;
+        if (read_len == 0 && len > 0) {
+            fprintf(stderr, "stream ends inside a record\n");
+            break;
+        }
+    }
+    if (skipped > 0 || malformed > 0) {
+        fprintf(stderr, "%d records before the first keyframe skipped, %d malformed\n", skipped, malformed);
+    }
+    return malformed > 0 ? 1 : 0;
+}
@@ -0,0 +1,39 @@
+/* Prints the last windows in a stats log, e.g. a "stats_log" partition read
+   from a device with esptool.py read_flash, in the monitor's report format.
+
+   usage: stats_log_read FILE [N]      N defaults to 10
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include "esp_partition.h"
+#include "stats_priv.h"
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s FILE [N]\n", argv[0]);
+        return 2;
+    }
+    size_t num = argc > 2 ? strtoul(argv[2], NULL, 0) : 10;
+    struct stat st;
+    if (stat(argv[1], &st) != 0 || num == 0) {
+        perror(argv[1]);
+        return 2;
+    }
+    if (fake_partition_open(CONFIG_STATS_LOG_PARTITION_LABEL, argv[1], st.st_size) != ESP_OK) {
+        return 1;
+    }
+
+    stats_window_t *windows = malloc(sizeof(stats_window_t) * num);
+    size_t read_num = 0;
+    esp_err_t ret = stats_log_read_last(windows, num, &read_num);
+    for (size_t i = 0; i < read_num; i++) {
+        //Window numbers start again from 0 after every reset
+        printf("\nWindow %u\n", windows[i].seq);
+        stats_window_print(&windows[i]);
+    }
+    free(windows);
+    fake_partition_close(CONFIG_STATS_LOG_PARTITION_LABEL);
+    return ret == ESP_OK ? 0 : 1;
+}
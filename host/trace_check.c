@@ -0,0 +1,173 @@
+/* Event trace recorded from concurrent threads on the host stand-in
+
+   usage: trace_check [--dump]
+
+   THREAD_NUM threads stand in for tasks, two per core, so tasks on the same
+   core claim slots of one ring at the same time, as preempting tasks would.
+   Each round, every thread times ITERATION_NUM measurements of its own zone;
+   the trace is then dumped and checked: every task must have exactly its
+   begin and end events, alternating, with its own zone name, and no event may
+   be dropped or torn. The exit status is 1 on the first failed round.
+
+   With --dump one round is run and the dump printed, for
+   tools/stats_trace_to_json.py. The zone names contain commas, which the
+   converter must keep.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "stats.h"
+#include "fake_sched.h"
+
+#define THREAD_NUM      (2 * portNUM_PROCESSORS)
+#define ITERATION_NUM   (CONFIG_STATS_TRACE_EVENT_NUM / 4)     //two threads fill half of a core's ring
+#define ROUND_NUM       200
+
+typedef struct {
+    TaskHandle_t task;
+    BaseType_t core;
+    stats_run_time_t *handler;
+    char zone[16];
+    int begins, ends;
+    bool ok;
+} trace_thread_t;
+
+static trace_thread_t s_threads[THREAD_NUM];
+static pthread_barrier_t s_start, s_done;
+
+static void *thread_main(void *arg) {
+    trace_thread_t *thread = arg;
+    fake_sched_bind_thread(thread->task, thread->core);
+    for (int round = 0; round < ROUND_NUM; round++) {
+        pthread_barrier_wait(&s_start);
+        for (int i = 0; i < ITERATION_NUM; i++) {
+            stats_run_time_start(thread->handler);
+            stats_run_time_stop(thread->handler);
+        }
+        pthread_barrier_wait(&s_done);
+    }
+    return NULL;
+}
+
+static trace_thread_t *find_thread(unsigned long task) {
+    for (int i = 0; i < THREAD_NUM; i++) {
+        if ((uintptr_t)s_threads[i].task == task) {
+            return &s_threads[i];
+        }
+    }
+    return NULL;
+}
+
+//Dump the trace into a file and check every event in it
+static bool check_round(int round) {
+    FILE *dump = tmpfile();
+    if (dump == NULL) {
+        perror("tmpfile");
+        return false;
+    }
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    dup2(fileno(dump), STDOUT_FILENO);
+    stats_trace_dump();
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    rewind(dump);
+
+    for (int i = 0; i < THREAD_NUM; i++) {
+        s_threads[i].begins = 0;
+        s_threads[i].ends = 0;
+        s_threads[i].ok = true;
+    }
+    bool ok = true;
+    char line[128];
+    while (fgets(line, sizeof(line), dump) != NULL) {
+        int core;
+        unsigned long task;
+        char type;
+        long long timestamp;
+        char zone[17];
+        if (strncmp(line, "stats_trace,D,", 14) == 0) {
+            printf("round %d: events dropped: %s", round, line);
+            ok = false;
+        }
+        if (sscanf(line, "stats_trace,E,%d,%lx,%c,%lld,%16[^\n]", &core, &task, &type, &timestamp, zone) != 5) {
+            continue;
+        }
+        trace_thread_t *thread = find_thread(task);
+        if (thread == NULL || core != thread->core || strcmp(zone, thread->zone) != 0) {
+            printf("round %d: torn event: %s", round, line);
+            ok = false;
+            continue;
+        }
+        //Events of one task are claimed in program order, so they alternate
+        if (type != (thread->begins == thread->ends ? 'B' : 'E')) {
+            thread->ok = false;
+        }
+        if (type == 'B') {
+            thread->begins++;
+        } else {
+            thread->ends++;
+        }
+    }
+    fclose(dump);
+    for (int i = 0; i < THREAD_NUM; i++) {
+        trace_thread_t *thread = &s_threads[i];
+        if (!thread->ok || thread->begins != ITERATION_NUM || thread->ends != ITERATION_NUM) {
+            printf("round %d: %s: %d begin and %d end events%s, %d each expected\n", round, thread->zone,
+                   thread->begins, thread->ends, thread->ok ? "" : " out of order", ITERATION_NUM);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    bool dump = argc > 1 && strcmp(argv[1], "--dump") == 0;
+    int round_num = dump ? 1 : ROUND_NUM;
+    fake_sched_reset();
+    for (int i = 0; i < THREAD_NUM; i++) {
+        trace_thread_t *thread = &s_threads[i];
+        char name[configMAX_TASK_NAME_LEN];
+        snprintf(name, sizeof(name), "worker%d", i);
+        thread->core = i % portNUM_PROCESSORS;
+        thread->task = fake_task_create(name, 5, thread->core);
+        snprintf(thread->zone, sizeof(thread->zone), "zone,%d", i);
+        thread->handler = stats_run_time_init(thread->zone);
+    }
+    stats_trace_clear();
+
+    pthread_barrier_init(&s_start, NULL, THREAD_NUM + 1);
+    pthread_barrier_init(&s_done, NULL, THREAD_NUM + 1);
+    pthread_t threads[THREAD_NUM];
+    for (int i = 0; i < THREAD_NUM; i++) {
+        pthread_create(&threads[i], NULL, thread_main, &s_threads[i]);
+    }
+    bool ok = true;
+    int round;
+    for (round = 0; round < ROUND_NUM; round++) {
+        pthread_barrier_wait(&s_start);
+        pthread_barrier_wait(&s_done);
+        if (round >= round_num) {
+            continue;       //let the threads finish their rounds
+        }
+        if (dump) {
+            stats_trace_dump();
+        } else if (!check_round(round)) {
+            ok = false;
+            round_num = round + 1;
+        }
+    }
+    for (int i = 0; i < THREAD_NUM; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    if (!dump) {
+        printf("%d rounds of %d threads, %d measurements each: %s\n", round_num, THREAD_NUM, ITERATION_NUM,
+               ok ? "ok" : "failed");
+    }
+    return ok ? 0 : 1;
+}
@@ -7,54 +7,84 @@
    CONDITIONS OF ANY KIND, either express or implied.
 */
 
+#include <inttypes.h>
 #include "string.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
 #include "stats.h"
+#include "stats_priv.h"
 
-#define STATS_TICKS         pdMS_TO_TICKS(1000)
-#define STATS_TASK_PRIO     3
-#define ARRAY_SIZE_OFFSET   5   //Increase this if print_real_time_stats returns ESP_ERR_INVALID_SIZE
-#define ACCUMULATED_INFO_NUM 32
+#if STATS_ENABLED
+
+#define STATS_TICKS         pdMS_TO_TICKS(CONFIG_STATS_PERIOD_MS)
+#define STATS_TASK_PRIO     CONFIG_STATS_TASK_PRIORITY
+#define STATS_TASK_STACK    CONFIG_STATS_TASK_STACK_SIZE
+#ifndef ACCUMULATED_INFO_NUM
+#define ACCUMULATED_INFO_NUM CONFIG_STATS_ACCUMULATED_INFO_NUM
+#endif
+#define STACK_HEADROOM_MIN  512 //Tasks whose free stack drops below this many bytes are flagged
+#define STARVED_PERCENT     1   //Ready tasks below this CPU share are reported as starved
+#define HISTORY_NUM         CONFIG_STATS_HISTORY_NUM   //Windows kept for stats_get_window
+//Rate of portGET_RUN_TIME_COUNTER_VALUE: esp_timer, unless FreeRTOS is set to count CPU cycles
+#if CONFIG_FREERTOS_RUN_TIME_STATS_USING_CPU_CLK
+#define RUN_TIME_CLOCK_HZ   ((uint64_t)CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 1000000)
+#else
+#define RUN_TIME_CLOCK_HZ   1000000
+#endif
+#define TEXT_BUF_SIZE       1024    //Report text buffer, handed out in whole lines; about 12 task rows fit
 
 typedef struct {
     char *task_name;
     uint64_t time;
+    uint32_t min_stack;     //lowest stack high water mark seen, in bytes
     bool is_running;
 } accumulated_info_t;
 
 static const char *TAG = "stats_monitor";
 static accumulated_info_t s_accumulated_infos[ACCUMULATED_INFO_NUM];
+//One spare slot for the window being filled, so readers never see it half written (see stats_get_window)
+static stats_window_t s_history[HISTORY_NUM + 1];
+static uint32_t s_history_count;
+//Only the monitor task takes snapshots, so one static pair is enough
+static stats_snapshot_t s_start, s_end;
+static TickType_t s_window_ticks = STATS_TICKS;
 
 void stats_reset_accumulated_infos(void) {
     for (int i = 0; i < ACCUMULATED_INFO_NUM; i++) {
         s_accumulated_infos[i].task_name = NULL;
         s_accumulated_infos[i].time = 0;
+        s_accumulated_infos[i].min_stack = 0;
         s_accumulated_infos[i].is_running = false;
     }
     ESP_LOGI(TAG, "reseted accumulated infos");
 }
 
 static void set_accumulated_info(accumulated_info_t *info) {
-    uint8_t dst_idx = 255;
+    int dst_idx = -1;
     for (int i = 0; i < ACCUMULATED_INFO_NUM; i++) {
         if (s_accumulated_infos[i].task_name == info->task_name) {
             s_accumulated_infos[i].time += info->time;
+            if (info->min_stack < s_accumulated_infos[i].min_stack) {
+                s_accumulated_infos[i].min_stack = info->min_stack;
+            }
             s_accumulated_infos[i].is_running = true;
             return;
         }
-        else if (s_accumulated_infos[i].task_name == NULL && dst_idx == 255) {
+        else if (s_accumulated_infos[i].task_name == NULL && dst_idx < 0) {
             dst_idx = i;
         }
     }
-    if (dst_idx == 255) {
+    if (dst_idx < 0) {
         ESP_LOGE(TAG, "error: accumulated info's buffer is full");
         return;
     }
     s_accumulated_infos[dst_idx].task_name = info->task_name;
     s_accumulated_infos[dst_idx].time = info->time;
+    s_accumulated_infos[dst_idx].min_stack = info->min_stack;
     s_accumulated_infos[dst_idx].is_running = true;
 }
 
@@ -79,6 +109,418 @@ static void end_calc_accumulated_info(void) {
     }
 }
 
+static void set_task_sample_state(stats_task_sample_t *sample, const TaskStatus_t *task) {
+    switch (task->eCurrentState) {
+    case eRunning:
+        sample->state = STATS_TASK_RUNNING;
+        break;
+    case eReady:
+        sample->state = STATS_TASK_READY;
+        break;
+    case eSuspended:
+        sample->state = STATS_TASK_SUSPENDED;
+        break;
+    default:
+        sample->state = STATS_TASK_BLOCKED;
+        break;
+    }
+    sample->priority = task->uxCurrentPriority;
+    sample->base_priority = task->uxBasePriority;
+    sample->core = (task->xCoreID == tskNO_AFFINITY) ? STATS_TASK_NO_AFFINITY : task->xCoreID;
+}
+
+//Add the task's window to its accumulated info, which buf may stand in for if that is full
+static const accumulated_info_t *accumulate_task(const TaskStatus_t *start, const TaskStatus_t *end,
+                                                 accumulated_info_t *buf) {
+    buf->task_name = (char *)start->pcTaskName;
+    buf->time = end->ulRunTimeCounter - start->ulRunTimeCounter;
+    buf->min_stack = end->usStackHighWaterMark;
+    buf->is_running = true;
+    set_accumulated_info(buf);
+    accumulated_info_t *res = get_accumulated_info(start->pcTaskName);
+    //Accumulated info's buffer is full, report this window only
+    return res != NULL ? res : buf;
+}
+
+//Fill one row of the window and update the task's accumulated info
+static void set_task_sample(stats_task_sample_t *sample, const TaskStatus_t *start, const TaskStatus_t *end,
+                            uint32_t total_elapsed_time) {
+    uint32_t task_elapsed_time = end->ulRunTimeCounter - start->ulRunTimeCounter;
+    //In 64 bits: task_elapsed_time * 100 passes 32 bits in windows over about 43 s at 1 MHz
+    uint32_t percentage_time = (uint64_t)task_elapsed_time * 100 / ((uint64_t)total_elapsed_time * portNUM_PROCESSORS);
+
+    accumulated_info_t buf;
+    const accumulated_info_t *res = accumulate_task(start, end, &buf);
+
+    strncpy(sample->name, start->pcTaskName, sizeof(sample->name) - 1);
+    sample->name[sizeof(sample->name) - 1] = '\0';
+    sample->task_id = end->xTaskNumber;
+    sample->status = STATS_TASK_MATCHED;
+    sample->run_time = task_elapsed_time;
+    sample->run_time_accumulated = res->time;
+    sample->percentage = percentage_time;
+    sample->min_stack = res->min_stack;
+    set_task_sample_state(sample, end);
+    sample->ready = start->eCurrentState == eReady && end->eCurrentState == eReady;
+    sample->starved = sample->ready && percentage_time < STARVED_PERCENT;
+}
+
+static void set_task_sample_unmatched(stats_task_sample_t *sample, const TaskStatus_t *task, stats_task_status_t status) {
+    memset(sample, 0, sizeof(*sample));
+    strncpy(sample->name, task->pcTaskName, sizeof(sample->name) - 1);
+    sample->task_id = task->xTaskNumber;
+    sample->status = status;
+    set_task_sample_state(sample, task);
+}
+
+//Per-window counters over the tasks that lived through the whole window
+void stats_window_count_states(stats_window_t *window) {
+    memset(window->state_count, 0, sizeof(window->state_count));
+    window->inherited_num = 0;
+    window->starved_num = 0;
+    for (int i = 0; i < window->task_num; i++) {
+        const stats_task_sample_t *task = &window->tasks[i];
+        if (task->status != STATS_TASK_MATCHED) {
+            continue;
+        }
+        window->state_count[task->state]++;
+        if (task->priority != task->base_priority) {
+            window->inherited_num++;
+        }
+        if (task->starved) {
+            window->starved_num++;
+        }
+    }
+}
+
+static void sample_heap(stats_window_t *window) {
+    static const uint32_t caps[STATS_HEAP_NUM] = {
+        [STATS_HEAP_INTERNAL] = MALLOC_CAP_INTERNAL,
+        [STATS_HEAP_DMA] = MALLOC_CAP_DMA,
+        [STATS_HEAP_SPIRAM] = MALLOC_CAP_SPIRAM,
+    };
+    for (int i = 0; i < STATS_HEAP_NUM; i++) {
+        stats_heap_sample_t *heap = &window->heap[i];
+        heap->free_size = heap_caps_get_free_size(caps[i]);
+        heap->min_free_size = heap_caps_get_minimum_free_size(caps[i]);
+        heap->largest_free_block = heap_caps_get_largest_free_block(caps[i]);
+        //Share of free memory that cannot be handed out as one block. The sizes are read one after
+        //the other, so an allocation freed in between can make the largest block the larger one.
+        uint64_t largest_percent = heap->free_size ? (uint64_t)heap->largest_free_block * 100 / heap->free_size : 100;
+        heap->fragmentation = 100 - (uint8_t)(largest_percent < 100 ? largest_percent : 100);
+    }
+}
+
+//Window that stats_task is filling; never handed out by stats_get_window
+static stats_window_t *get_next_window(void) {
+    return &s_history[s_history_count % (HISTORY_NUM + 1)];
+}
+
+static void publish_window(void) {
+    __atomic_store_n(&s_history_count, s_history_count + 1, __ATOMIC_RELEASE);
+    //Readers must see the new count before any write to the slot it frees up (see stats_get_window)
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+//The history count doubles as a sequence lock. Window seq is kept in its slot until window
+//seq + HISTORY_NUM + 1 starts to be filled, which only happens after that many windows are
+//published, so a copy is whole if the count has not got that far by the end of it. Copying
+//without a lock keeps interrupts enabled however many tasks a window holds.
+esp_err_t stats_get_window(uint32_t age, stats_window_t *window) {
+    while (true) {
+        uint32_t count = __atomic_load_n(&s_history_count, __ATOMIC_ACQUIRE);
+        if (age >= HISTORY_NUM || age >= count) {
+            return ESP_ERR_NOT_FOUND;
+        }
+        uint32_t seq = count - 1 - age;
+        memcpy(window, &s_history[seq % (HISTORY_NUM + 1)], sizeof(*window));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s_history_count, __ATOMIC_RELAXED) - seq <= HISTORY_NUM) {
+            return ESP_OK;
+        }
+        //The slot was refilled while copying, so the reader was held up for several windows; try again
+    }
+}
+
+//Report text is collected here and handed out when full and at the end of each window. A
+//report longer than the buffer is handed out in several pieces, each ending at a line end,
+//so that line based outputs never see a row split. The buffer is not sized for the whole
+//report, since STATS_WINDOW_TASK_NUM may be large. Only the sink task prints.
+static struct {
+    char buf[TEXT_BUF_SIZE];
+    size_t len;
+    size_t line_end;        //length of the complete lines in buf
+    stats_text_out_t out;
+    void *arg;
+} s_text;
+
+static void text_flush(void) {
+    if (s_text.len > 0) {
+        s_text.out(s_text.buf, s_text.len, s_text.arg);
+        s_text.len = 0;
+        s_text.line_end = 0;
+    }
+}
+
+//Make room for len more bytes; the line being written plus len stays far below TEXT_BUF_SIZE
+static char *text_reserve(size_t len) {
+    if (s_text.len + len > TEXT_BUF_SIZE) {
+        //Hand out the complete lines and keep the one being written
+        size_t line_len = s_text.len - s_text.line_end;
+        s_text.out(s_text.buf, s_text.line_end, s_text.arg);
+        memmove(s_text.buf, s_text.buf + s_text.line_end, line_len);
+        s_text.len = line_len;
+        s_text.line_end = 0;
+    }
+    return s_text.buf + s_text.len;
+}
+
+static void put_strn(const char *str, size_t max_len) {
+    size_t len = strnlen(str, max_len);
+    memcpy(text_reserve(len), str, len);
+    s_text.len += len;
+}
+
+//Line ends only come at the end of the strings passed here
+static void put_str(const char *str) {
+    size_t len = strlen(str);
+    memcpy(text_reserve(len), str, len);
+    s_text.len += len;
+    if (len > 0 && str[len - 1] == '\n') {
+        s_text.line_end = s_text.len;
+    }
+}
+
+static void put_u64(uint64_t value) {
+    char digits[20];
+    int n = 0;
+    while (value > UINT32_MAX) {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    }
+    //The rest in 32 bits, which keeps 32 bit targets off the 64 bit division for most values
+    uint32_t low = value;
+    do {
+        digits[n++] = '0' + low % 10;
+        low /= 10;
+    } while (low > 0);
+    char *dst = text_reserve(n);
+    for (int i = 0; i < n; i++) {
+        dst[i] = digits[n - 1 - i];
+    }
+    s_text.len += n;
+}
+
+static void put_u32(uint32_t value) {
+    put_u64(value);
+}
+
+static void stdout_out(const char *text, size_t len, void *arg) {
+    fwrite(text, 1, len, stdout);
+}
+
+void stats_window_print(const stats_window_t *window) {
+    stats_window_format(window, stdout_out, NULL);
+}
+
+void stats_window_format(const stats_window_t *window, stats_text_out_t out, void *arg) {
+    s_text.out = out;
+    s_text.arg = arg;
+    s_text.len = 0;
+    s_text.line_end = 0;
+
+    uint32_t stack_low_num = 0, stack_reclaimable = 0;
+#if CONFIG_STATS_ADAPTIVE
+    //Windows differ in length, so each report gives its own
+    put_str("Length: ");
+    put_u32((uint64_t)window->elapsed * 1000 / RUN_TIME_CLOCK_HZ);
+    put_str(" ms\n");
+#endif
+    put_str("| Task | Run Time | Run Time(Accumulated) | Percentage | Min Free Stack\n");
+    put_str("| --- | --- | --- | --- | ---\n");
+    for (int i = 0; i < window->task_num; i++) {
+        const stats_task_sample_t *task = &window->tasks[i];
+        if (task->status != STATS_TASK_MATCHED) {
+            continue;
+        }
+        bool stack_low = task->min_stack < STACK_HEADROOM_MIN;
+        if (stack_low) {
+            stack_low_num++;
+        } else {
+            stack_reclaimable += task->min_stack - STACK_HEADROOM_MIN;
+        }
+        put_str("| ");
+        put_strn(task->name, sizeof(task->name));
+        put_str(" | ");
+        put_u32(task->run_time);
+        put_str(" | ");
+        if (window->unrecorded & STATS_WINDOW_NO_ACCUMULATED) {
+            put_str("-");
+        } else {
+            put_u64(task->run_time_accumulated);
+        }
+        put_str(" | ");
+        put_u32(task->percentage);
+        put_str("% | ");
+        put_u32(task->min_stack);
+        put_str(stack_low ? " (low)\n" : "\n");
+    }
+
+    //Print unmatched tasks
+    for (int i = 0; i < window->task_num; i++) {
+        if (window->tasks[i].status == STATS_TASK_DELETED) {
+            put_str("| ");
+            put_strn(window->tasks[i].name, sizeof(window->tasks[i].name));
+            put_str(" | Deleted\n");
+        }
+    }
+    for (int i = 0; i < window->task_num; i++) {
+        if (window->tasks[i].status == STATS_TASK_CREATED) {
+            put_str("| ");
+            put_strn(window->tasks[i].name, sizeof(window->tasks[i].name));
+            put_str(" | Created\n");
+        }
+    }
+
+    put_str("Stack: ");
+    put_u32(stack_low_num);
+    put_str(" task(s) below ");
+    put_u32(STACK_HEADROOM_MIN);
+    put_str(" bytes free, ");
+    put_u32(stack_reclaimable);
+    put_str(" bytes reclaimable\n");
+
+    put_str("States: ");
+    put_u32(window->state_count[STATS_TASK_RUNNING]);
+    put_str(" running, ");
+    put_u32(window->state_count[STATS_TASK_READY]);
+    put_str(" ready, ");
+    put_u32(window->state_count[STATS_TASK_BLOCKED]);
+    put_str(" blocked, ");
+    put_u32(window->state_count[STATS_TASK_SUSPENDED]);
+    put_str(" suspended\n");
+    if (window->inherited_num > 0 || window->starved_num > 0) {
+        for (int i = 0; i < window->task_num; i++) {
+            const stats_task_sample_t *task = &window->tasks[i];
+            if (task->status != STATS_TASK_MATCHED) {
+                continue;
+            }
+            if (task->priority != task->base_priority) {
+                put_str("Priority inherited: ");
+                put_strn(task->name, sizeof(task->name));
+                put_str(" (");
+                put_u32(task->base_priority);
+                put_str(" -> ");
+                put_u32(task->priority);
+                put_str(")\n");
+            }
+            if (task->starved) {
+                put_str("Ready but starved: ");
+                put_strn(task->name, sizeof(task->name));
+                put_str(" (priority ");
+                put_u32(task->priority);
+                put_str(", ");
+                put_u32(task->percentage);
+                put_str("%)\n");
+            }
+        }
+    }
+
+    static const char *heap_names[STATS_HEAP_NUM] = {
+        [STATS_HEAP_INTERNAL] = "internal",
+        [STATS_HEAP_DMA] = "dma",
+        [STATS_HEAP_SPIRAM] = "spiram",
+    };
+    put_str("| Heap | Free | Min Free | Largest Free Block | Fragmentation\n");
+    put_str("| --- | --- | --- | --- | ---\n");
+    for (int i = 0; i < STATS_HEAP_NUM; i++) {
+        const stats_heap_sample_t *heap = &window->heap[i];
+        if (heap->free_size == 0 && heap->min_free_size == 0) {
+            continue;   //No memory with these capabilities
+        }
+        put_str("| ");
+        put_str(heap_names[i]);
+        put_str(" | ");
+        put_u32(heap->free_size);
+        if (window->unrecorded & STATS_WINDOW_NO_HEAP_DETAIL) {
+            put_str(" | - | - | -\n");
+            continue;
+        }
+        put_str(" | ");
+        put_u32(heap->min_free_size);
+        put_str(" | ");
+        put_u32(heap->largest_free_block);
+        put_str(" | ");
+        put_u32(heap->fragmentation);
+        put_str("%\n");
+    }
+    text_flush();
+}
+
+esp_err_t stats_snapshot_take(stats_snapshot_t *snapshot) {
+    //Get current task states
+    snapshot->task_num = uxTaskGetSystemState(snapshot->tasks, STATS_SNAPSHOT_TASK_NUM, &snapshot->run_time);
+    if (snapshot->task_num == 0) {
+        ESP_LOGE(TAG, "%u tasks exist, more than CONFIG_STATS_SNAPSHOT_TASK_NUM",
+                 (unsigned)uxTaskGetNumberOfTasks());
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+static void swap_task_status(TaskStatus_t *a, TaskStatus_t *b) {
+    TaskStatus_t tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+UBaseType_t stats_snapshot_match(stats_snapshot_t *start, stats_snapshot_t *end) {
+    UBaseType_t matched = 0;
+    //Match each task in start to those in end, moving pairs to the front of both
+    for (UBaseType_t i = 0; i < start->task_num; i++) {
+        for (UBaseType_t j = matched; j < end->task_num; j++) {
+            //A new task may reuse a deleted task's TCB, so compare task numbers as well
+            if (start->tasks[i].xHandle == end->tasks[j].xHandle &&
+                start->tasks[i].xTaskNumber == end->tasks[j].xTaskNumber) {
+                swap_task_status(&start->tasks[i], &start->tasks[matched]);
+                swap_task_status(&end->tasks[j], &end->tasks[matched]);
+                matched++;
+                break;
+            }
+        }
+    }
+    return matched;
+}
+
+void stats_window_build(stats_window_t *window, const stats_snapshot_t *start, const stats_snapshot_t *end,
+                        UBaseType_t matched) {
+    //Calculate total_elapsed_time in units of run time stats clock period.
+    uint32_t total_elapsed_time = end->run_time - start->run_time;
+    window->elapsed = total_elapsed_time;
+    window->unrecorded = 0;
+    window->task_num = 0;
+
+    for (UBaseType_t i = 0; i < matched; i++) {
+        if (window->task_num < STATS_WINDOW_TASK_NUM) {
+            set_task_sample(&window->tasks[window->task_num++], &start->tasks[i], &end->tasks[i], total_elapsed_time);
+        } else {
+            //No row left, but keep the task's accumulated info, which is freed after a window without it
+            accumulated_info_t buf;
+            accumulate_task(&start->tasks[i], &end->tasks[i], &buf);
+        }
+    }
+    //Record unmatched tasks
+    for (UBaseType_t i = matched; i < start->task_num && window->task_num < STATS_WINDOW_TASK_NUM; i++) {
+        set_task_sample_unmatched(&window->tasks[window->task_num++], &start->tasks[i], STATS_TASK_DELETED);
+    }
+    for (UBaseType_t i = matched; i < end->task_num && window->task_num < STATS_WINDOW_TASK_NUM; i++) {
+        set_task_sample_unmatched(&window->tasks[window->task_num++], &end->tasks[i], STATS_TASK_CREATED);
+    }
+
+    stats_window_count_states(window);
+    end_calc_accumulated_info();
+}
+
 /**
  * @brief   Function to print the CPU usage of tasks over a given duration.
  *
@@ -87,140 +529,108 @@ static void end_calc_accumulated_info(void) {
  * uxTaskGetSystemState() twice separated by a delay, then calculating the
  * differences of task run times before and after the delay.
  *
+ * The results, together with a heap sample taken at the end of the window, are
+ * kept in a history of the last HISTORY_NUM windows (see stats_get_window) and
+ * queued for the sinks, which print them from the sink task (see stats_sink.h).
+ *
  * @note    If any tasks are added or removed during the delay, the stats of
  *          those tasks will not be printed.
  * @note    This function should be called from a high priority task to minimize
  *          inaccuracies with delays.
  * @note    When running in dual core mode, each core will correspond to 50% of
  *          the run time.
+ * @note    Task states and priorities are taken from the end of the window. A
+ *          task that was ready at both ends but got less than STARVED_PERCENT
+ *          of the CPU is reported as starved.
+ * @note    Min Free Stack is the lowest stack high water mark seen for the task
+ *          since it first appeared. Stack above STACK_HEADROOM_MIN in it is
+ *          counted as reclaimable.
  *
  * @param   xTicksToWait    Period of stats measurement
  *
  * @return
  *  - ESP_OK                Success
- *  - ESP_ERR_NO_MEM        Insufficient memory to allocated internal arrays
- *  - ESP_ERR_INVALID_SIZE  Insufficient array size for uxTaskGetSystemState. Trying increasing ARRAY_SIZE_OFFSET
+ *  - ESP_ERR_INVALID_SIZE  Insufficient array size for uxTaskGetSystemState. Trying increasing CONFIG_STATS_SNAPSHOT_TASK_NUM
  *  - ESP_ERR_INVALID_STATE Delay duration too short
  */
 static esp_err_t print_real_time_stats(TickType_t xTicksToWait)
 {
-    TaskStatus_t *start_array = NULL, *end_array = NULL;
-    UBaseType_t start_array_size, end_array_size;
-    uint32_t start_run_time, end_run_time;
     esp_err_t ret;
 
-    //Allocate array to store current task states
-    start_array_size = uxTaskGetNumberOfTasks() + ARRAY_SIZE_OFFSET;
-    start_array = malloc(sizeof(TaskStatus_t) * start_array_size);
-    if (start_array == NULL) {
-        ret = ESP_ERR_NO_MEM;
-        goto exit;
-    }
-    //Get current task states
-    start_array_size = uxTaskGetSystemState(start_array, start_array_size, &start_run_time);
-    if (start_array_size == 0) {
-        ret = ESP_ERR_INVALID_SIZE;
-        goto exit;
+    ret = stats_snapshot_take(&s_start);
+    if (ret != ESP_OK) {
+        return ret;
     }
 
     vTaskDelay(xTicksToWait);
 
-    //Allocate array to store tasks states post delay
-    end_array_size = uxTaskGetNumberOfTasks() + ARRAY_SIZE_OFFSET;
-    end_array = malloc(sizeof(TaskStatus_t) * end_array_size);
-    if (end_array == NULL) {
-        ret = ESP_ERR_NO_MEM;
-        goto exit;
-    }
-    //Get post delay task states
-    end_array_size = uxTaskGetSystemState(end_array, end_array_size, &end_run_time);
-    if (end_array_size == 0) {
-        ret = ESP_ERR_INVALID_SIZE;
-        goto exit;
+    ret = stats_snapshot_take(&s_end);
+    if (ret != ESP_OK) {
+        return ret;
     }
 
-    //Calculate total_elapsed_time in units of run time stats clock period.
-    uint32_t total_elapsed_time = (end_run_time - start_run_time);
-    if (total_elapsed_time == 0) {
-        ret = ESP_ERR_INVALID_STATE;
-        goto exit;
-    }
-
-    printf("| Task | Run Time | Run Time(Accumulated) | Percentage\n");
-    printf("| --- | --- | --- | ---\n");
-    //Match each task in start_array to those in the end_array
-    for (int i = 0; i < start_array_size; i++) {
-        int k = -1;
-        for (int j = 0; j < end_array_size; j++) {
-            if (start_array[i].xHandle == end_array[j].xHandle) {
-                k = j;
-                //Mark that task have been matched by overwriting their handles
-                start_array[i].xHandle = NULL;
-                end_array[j].xHandle = NULL;
-                break;
-            }
-        }
-        //Check if matching task found
-        if (k >= 0) {
-            uint32_t task_elapsed_time = end_array[k].ulRunTimeCounter - start_array[i].ulRunTimeCounter;
-            uint32_t percentage_time = (task_elapsed_time * 100UL) / (total_elapsed_time * portNUM_PROCESSORS);
-
-            accumulated_info_t buf = {
-                .task_name = (char *)start_array[i].pcTaskName,
-                .time = task_elapsed_time,
-            };
-            set_accumulated_info(&buf);
-            accumulated_info_t *res = get_accumulated_info(start_array[i].pcTaskName);
-
-            printf("| %s | %d | %lld | %d%%\n", start_array[i].pcTaskName, task_elapsed_time, res->time, percentage_time);
-        }
+    if (s_end.run_time == s_start.run_time) {
+        return ESP_ERR_INVALID_STATE;
     }
 
-    //Print unmatched tasks
-    for (int i = 0; i < start_array_size; i++) {
-        if (start_array[i].xHandle != NULL) {
-            printf("| %s | Deleted\n", start_array[i].pcTaskName);
-        }
-    }
-    for (int i = 0; i < end_array_size; i++) {
-        if (end_array[i].xHandle != NULL) {
-            printf("| %s | Created\n", end_array[i].pcTaskName);
-        }
-    }
-
-    end_calc_accumulated_info();
-    ret = ESP_OK;
+    stats_window_t *window = get_next_window();
+    window->seq = s_history_count;
+    stats_window_build(window, &s_start, &s_end, stats_snapshot_match(&s_start, &s_end));
+    sample_heap(window);
+    publish_window();
+#if CONFIG_STATS_BLACKBOX
+    stats_blackbox_record(window);
+#endif
+    stats_sink_submit(window);
+    stats_detect_window(window);
+#if CONFIG_STATS_QUOTA
+    stats_quota_window(window, &s_end);
+#endif
+#if CONFIG_STATS_ADAPTIVE
+    s_window_ticks = stats_adapt_next(window, xTicksToWait);
+#endif
+    return ESP_OK;
+}
 
-exit:    //Common return path
-    free(start_array);
-    free(end_array);
+esp_err_t stats_monitor_run_once(TickType_t xTicksToWait) {
+    esp_err_t ret = print_real_time_stats(xTicksToWait);
+    //No sink task runs on the host, emit here
+    stats_sink_process(0);
     return ret;
 }
 
+TickType_t stats_monitor_next_ticks(void) {
+    return s_window_ticks;
+}
+
 static void stats_task(void *arg)
 {
-    //Print real time stats periodically
+    //Measure real time stats periodically; the sink task prints them
     while (1) {
-        printf("\n\nGetting real time stats over %d ticks\n", STATS_TICKS);
-        if (print_real_time_stats(STATS_TICKS) == ESP_OK) {
-            printf("Real time stats obtained\n");
-        } else {
-            printf("Error getting real time stats\n");
+        esp_err_t ret = print_real_time_stats(s_window_ticks);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Error getting real time stats (%d)", ret);
         }
         vTaskDelay(pdMS_TO_TICKS(1));
     }
 }
 
 void stats_init(void) {
+#if CONFIG_STATS_METRICS
+    stats_metrics_init();
+#endif
+    stats_sink_init();
+#if CONFIG_STATS_CPU_LOAD
+    stats_cpu_load_init();
+#endif
+#if CONFIG_STATS_BLACKBOX
+    stats_blackbox_init();
+#endif
+#if CONFIG_STATS_LOG
+    stats_log_init();
+#endif
     //Create and start stats task
-    xTaskCreatePinnedToCore(stats_task, "stats", 4096, NULL, STATS_TASK_PRIO, NULL, tskNO_AFFINITY);
-}
-
-static void accumulate_time(int64_t *timer, int64_t start_time, int64_t end_time) {
-    int64_t duration = end_time - start_time;
-    *timer += duration;
-    // ESP_LOGW(TAG, "duration=%lld", duration);
-    // ESP_LOGW(TAG, "accumulate time=%lld", *timer);
+    xTaskCreatePinnedToCore(stats_task, "stats", STATS_TASK_STACK, NULL, STATS_TASK_PRIO, NULL, tskNO_AFFINITY);
 }
 
 stats_run_time_t *stats_run_time_init(const char* name) {
@@ -228,22 +638,58 @@ stats_run_time_t *stats_run_time_init(const char* name) {
     assert(buf != NULL);
     strcpy(buf->name, name);
     buf->time = 0;
+    buf->self_time = 0;
     buf->start = 0;
     buf->state = STATS_MEASURE_STOP;
+#if CONFIG_STATS_METRICS
+    buf->count = 0;
+    memset(buf->buckets, 0, sizeof(buf->buckets));
+    stats_metrics_register(buf);
+#endif
     return buf;
 }
 
-void stats_run_time_start(stats_run_time_t *handler) {
+stats_run_time_t *stats_run_time_init_once(stats_run_time_t **slot, const char *name) {
+    stats_run_time_t *handler = stats_run_time_init(name);
+    stats_run_time_t *expected = NULL;
+    if (!__atomic_compare_exchange_n(slot, &expected, handler, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        //Another task created the handle first, use that one
+        stats_run_time_free(handler);
+        return expected;
+    }
+    return handler;
+}
+
+bool stats_run_time_try_start(stats_run_time_t *handler) {
+    if (handler == NULL) {
+        return false;
+    }
+    //Claimed atomically, so of two tasks starting the same handle only one measures
+    stats_measure_state_t expected = STATS_MEASURE_STOP;
+    if (!__atomic_compare_exchange_n(&handler->state, &expected, STATS_MEASURE_START, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return false;
+    }
+#if CONFIG_STATS_RUN_TIME_NESTING
+    stats_zone_push(handler);
+#endif
+    handler->start = esp_timer_get_time();
+#if CONFIG_STATS_TRACE_EVENTS
+    stats_trace_record(handler, 'B', handler->start);
+#endif
+    return true;
+}
+
+bool stats_run_time_start(stats_run_time_t *handler) {
     if (handler == NULL) {
         ESP_LOGE(TAG, "handler is NULL");
-        return;
+        return false;
     }
-    if (handler->state == STATS_MEASURE_START) {
+    if (!stats_run_time_try_start(handler)) {
         ESP_LOGE(TAG, "run time measurement is already started");
-        return;
+        return false;
     }
-    handler->state = STATS_MEASURE_START;
-    handler->start = esp_timer_get_time();
+    return true;
 }
 
 void stats_run_time_stop(stats_run_time_t *handler) {
@@ -255,8 +701,27 @@ void stats_run_time_stop(stats_run_time_t *handler) {
         ESP_LOGE(TAG, "run time measurement is not started");
         return;
     }
-    handler->state = STATS_MEASURE_STOP;
-    handler->time += esp_timer_get_time() - handler->start;
+    int64_t now = esp_timer_get_time();
+    int64_t elapsed = now - handler->start;
+#if CONFIG_STATS_TRACE_EVENTS
+    stats_trace_record(handler, 'E', now);
+#endif
+    handler->time += elapsed;
+#if CONFIG_STATS_RUN_TIME_NESTING
+    handler->self_time += elapsed - stats_zone_pop(handler, elapsed);
+#else
+    handler->self_time += elapsed;
+#endif
+#if CONFIG_STATS_METRICS
+    int bucket = 0;
+    for (int64_t bound = 10; bucket < STATS_RUN_TIME_BUCKET_NUM - 1 && elapsed > bound; bound *= 10) {
+        bucket++;
+    }
+    handler->buckets[bucket]++;
+    handler->count++;
+#endif
+    //Last, so the next start sees the totals of this measurement
+    __atomic_store_n(&handler->state, STATS_MEASURE_STOP, __ATOMIC_RELEASE);
 }
 
 void stats_run_time_free(stats_run_time_t *handler) {
@@ -264,6 +729,12 @@ void stats_run_time_free(stats_run_time_t *handler) {
         ESP_LOGE(TAG, "handler is NULL");
         return;
     }
+#if CONFIG_STATS_RUN_TIME_NESTING
+    stats_zone_forget(handler);
+#endif
+#if CONFIG_STATS_METRICS
+    stats_metrics_unregister(handler);
+#endif
     free(handler);
     handler = NULL;
 }
@@ -273,5 +744,11 @@ void stats_run_time_print(const stats_run_time_t *handler) {
         ESP_LOGE(TAG, "handler is NULL");
         return;
     }
-    ESP_LOGI(TAG, "run time: %s=%lld", handler->name, handler->time);
-}
\ No newline at end of file
+#if CONFIG_STATS_RUN_TIME_NESTING
+    ESP_LOGI(TAG, "run time: %s=%" PRId64 " (self=%" PRId64 ")", handler->name, handler->time, handler->self_time);
+#else
+    ESP_LOGI(TAG, "run time: %s=%" PRId64, handler->name, handler->time);
+#endif
+}
+
+#endif // STATS_ENABLED
@@ -1,23 +1,282 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef CONFIG_STATS_ENABLE
+#define STATS_ENABLED 1
+#else
+#define STATS_ENABLED 0
+#endif
 
 typedef enum {
     STATS_MEASURE_STOP = 0,
     STATS_MEASURE_START
 } stats_measure_state_t;
 
+#define STATS_RUN_TIME_BUCKET_NUM   8   //up to 10 us, 100 us, ... 10 s, and longer
+
 typedef struct {
     char name[16];
     int64_t time;
+    int64_t self_time;  //time not spent in nested measurements of the same task
     int64_t start;
     stats_measure_state_t state;
+#if CONFIG_STATS_METRICS
+    uint32_t count;     //measurements stopped
+    uint32_t buckets[STATS_RUN_TIME_BUCKET_NUM];    //measurements by duration
+#endif
 } stats_run_time_t;
 
+#ifndef STATS_WINDOW_TASK_NUM
+#if STATS_ENABLED
+#define STATS_WINDOW_TASK_NUM   CONFIG_STATS_WINDOW_TASK_NUM  //Tasks recorded per window, created and deleted ones included
+#else
+#define STATS_WINDOW_TASK_NUM   1
+#endif
+#endif
+#define STATS_TASK_NO_AFFINITY  (-1)
+
+typedef enum {
+    STATS_TASK_MATCHED = 0,     //ran through the whole window
+    STATS_TASK_CREATED,
+    STATS_TASK_DELETED,
+} stats_task_status_t;
+
+//Mirrors eTaskState, sampled at the end of the window
+typedef enum {
+    STATS_TASK_RUNNING = 0,
+    STATS_TASK_READY,
+    STATS_TASK_BLOCKED,
+    STATS_TASK_SUSPENDED,
+    STATS_TASK_STATE_NUM
+} stats_task_state_t;
+
+typedef struct {
+    char name[16];
+    uint32_t task_id;               //TaskStatus_t::xTaskNumber
+    stats_task_status_t status;
+    stats_task_state_t state;
+    uint8_t priority;               //current priority, may be inherited
+    uint8_t base_priority;
+    int8_t core;                    //core the task is pinned to, or STATS_TASK_NO_AFFINITY
+    bool ready;                     //ready at both ends of the window
+    bool starved;                   //ready, but got almost no CPU
+    uint32_t run_time;              //run time stats clock periods in this window
+    uint64_t run_time_accumulated;
+    uint32_t percentage;
+    uint32_t min_stack;             //lowest free stack seen so far, in bytes
+} stats_task_sample_t;
+
+typedef enum {
+    STATS_HEAP_INTERNAL = 0,
+    STATS_HEAP_DMA,
+    STATS_HEAP_SPIRAM,
+    STATS_HEAP_NUM
+} stats_heap_t;
+
+typedef struct {
+    uint32_t free_size;
+    uint32_t min_free_size;
+    uint32_t largest_free_block;
+    uint8_t fragmentation;          //percent of free memory outside the largest block
+} stats_heap_sample_t;
+
+//Fields a window does not hold, such as one read back from the black box
+#define STATS_WINDOW_NO_ACCUMULATED     (1 << 0)    //run_time_accumulated
+#define STATS_WINDOW_NO_HEAP_DETAIL     (1 << 1)    //min_free_size, largest_free_block and fragmentation
+
+typedef struct {
+    uint32_t seq;
+    uint32_t elapsed;               //window length in run time stats clock periods
+    uint8_t unrecorded;             //STATS_WINDOW_NO_* flags
+    uint16_t task_num;
+    uint16_t state_count[STATS_TASK_STATE_NUM];
+    uint16_t inherited_num;         //tasks running above their base priority
+    uint16_t starved_num;
+    stats_task_sample_t tasks[STATS_WINDOW_TASK_NUM];
+    stats_heap_sample_t heap[STATS_HEAP_NUM];
+} stats_window_t;
+
+typedef enum {
+    STATS_EVENT_PRIORITY_INVERSION = 0, //a ready task got less CPU than a lower priority one for several windows
+    STATS_EVENT_LONG_INHERITANCE,       //a task kept an inherited priority for several windows
+    STATS_EVENT_QUOTA_OVERRUN,          //a task used more CPU than its quota for several windows
+} stats_event_type_t;
+
+//Passed to the event handler from the monitor task; the task pointers are only valid during the call
+typedef struct {
+    stats_event_type_t type;
+    uint32_t seq;                       //window the event was detected in
+    const stats_task_sample_t *task;    //higher priority task, the inheriting task, or the task over quota
+    const stats_task_sample_t *other;   //lower priority task that ran instead, NULL for inheritance
+    uint32_t windows;                   //consecutive windows the condition has held
+} stats_event_t;
+
+typedef void (*stats_event_handler_t)(const stats_event_t *event, void *arg);
+
+//What the monitor does to a task that stays over its CPU quota
+typedef enum {
+    STATS_QUOTA_NOTIFY = 0,         //set STATS_QUOTA_NOTIFY_BIT in its notification value, so it can shed load
+    STATS_QUOTA_LOWER_PRIORITY,     //lower its base priority by one, down to 1
+    STATS_QUOTA_SUSPEND,
+} stats_quota_action_t;
+
+#define STATS_QUOTA_NOTIFY_BIT  (1UL << 31)
+
+#if STATS_ENABLED
+
 void stats_init(void);
+void stats_set_event_handler(stats_event_handler_t handler, void *arg);
 void stats_reset_accumulated_infos(void);
+esp_err_t stats_get_window(uint32_t age, stats_window_t *window);
 
 stats_run_time_t *stats_run_time_init(const char *name);
-void stats_run_time_start(stats_run_time_t *handler);
+stats_run_time_t *stats_run_time_init_once(stats_run_time_t **slot, const char *name);
+//false, and nothing to stop, if the handle is NULL or already running (a recursive or concurrent call)
+bool stats_run_time_start(stats_run_time_t *handler);
+//As stats_run_time_start, without logging a refusal; for guards that expect them
+bool stats_run_time_try_start(stats_run_time_t *handler);
 void stats_run_time_stop(stats_run_time_t *handler);
 void stats_run_time_free(stats_run_time_t *handler);
-void stats_run_time_print(const stats_run_time_t *handler);
\ No newline at end of file
+void stats_run_time_print(const stats_run_time_t *handler);
+
+#if CONFIG_STATS_RUN_TIME_NESTING
+void stats_run_time_print_tree(void);
+void stats_run_time_reset_tree(void);
+#else
+static inline void stats_run_time_print_tree(void) {}
+static inline void stats_run_time_reset_tree(void) {}
+#endif
+
+#if CONFIG_STATS_TRACE_EVENTS
+void stats_trace_enable(bool enable);
+void stats_trace_clear(void);
+void stats_trace_dump(void);
+#else
+static inline void stats_trace_enable(bool enable) { (void)enable; }
+static inline void stats_trace_clear(void) {}
+static inline void stats_trace_dump(void) {}
+#endif
+
+#if CONFIG_STATS_PROFILER
+//Sample the code running on every core hz times a second (0: CONFIG_STATS_PROFILER_HZ)
+esp_err_t stats_profiler_start(uint32_t hz);
+void stats_profiler_stop(void);
+//Print the samples for tools/stats_profile.py, and clear them
+void stats_profiler_dump(void);
+#else
+static inline esp_err_t stats_profiler_start(uint32_t hz) { (void)hz; return ESP_ERR_NOT_SUPPORTED; }
+static inline void stats_profiler_stop(void) {}
+static inline void stats_profiler_dump(void) {}
+#endif
+
+#if CONFIG_STATS_CPU_LOAD
+esp_err_t stats_cpu_load_init(void);
+uint32_t stats_cpu_load_get(int core);
+#else
+static inline esp_err_t stats_cpu_load_init(void) { return ESP_OK; }
+static inline uint32_t stats_cpu_load_get(int core) { (void)core; return 0; }
+#endif
+
+#if CONFIG_STATS_CTXSW_TRACE
+esp_err_t stats_ctxsw_print(bool timeline);
+void stats_ctxsw_clear(void);
+#else
+static inline esp_err_t stats_ctxsw_print(bool timeline) { (void)timeline; return ESP_OK; }
+static inline void stats_ctxsw_clear(void) {}
+#endif
+
+#if CONFIG_STATS_BLACKBOX
+esp_err_t stats_blackbox_read(uint32_t age, stats_window_t *window);
+#else
+static inline esp_err_t stats_blackbox_read(uint32_t age, stats_window_t *window) { (void)age; (void)window; return ESP_ERR_NOT_SUPPORTED; }
+#endif
+
+#if CONFIG_STATS_LOG
+esp_err_t stats_log_flush(void);
+esp_err_t stats_log_read_last(stats_window_t *windows, size_t num, size_t *read_num);
+#else
+static inline esp_err_t stats_log_flush(void) { return ESP_OK; }
+static inline esp_err_t stats_log_read_last(stats_window_t *windows, size_t num, size_t *read_num) { (void)windows; (void)num; *read_num = 0; return ESP_ERR_NOT_SUPPORTED; }
+#endif
+
+#if CONFIG_STATS_METRICS
+//Write task, heap and run time metrics as OpenMetrics text into buf. *len is the length the
+//whole text needs; ESP_ERR_INVALID_SIZE if that does not fit in size (with its terminating NUL).
+esp_err_t stats_metrics_render(char *buf, size_t size, size_t *len);
+#else
+static inline esp_err_t stats_metrics_render(char *buf, size_t size, size_t *len) { (void)buf; (void)size; *len = 0; return ESP_ERR_NOT_SUPPORTED; }
+#endif
+
+#if CONFIG_STATS_NET
+//Stream windows to TCP and UDP clients on port (0: CONFIG_STATS_NET_PORT). Call once the network is up.
+esp_err_t stats_net_start(uint16_t port);
+void stats_net_stop(void);
+#else
+static inline esp_err_t stats_net_start(uint16_t port) { (void)port; return ESP_ERR_NOT_SUPPORTED; }
+static inline void stats_net_stop(void) {}
+#endif
+
+#if CONFIG_STATS_QUOTA
+//Give the tasks named task_name a budget of percent of one core per window. Once a task has been
+//over it for windows windows in a row, action is taken, and taken again every windows windows the
+//overrun lasts. A lowered priority is restored, and a suspended task resumed, after windows
+//windows within the budget. Setting a quota again replaces it.
+esp_err_t stats_quota_set(const char *task_name, uint32_t percent, uint32_t windows, stats_quota_action_t action);
+//Remove the quota; the next window restores what it changed
+esp_err_t stats_quota_clear(const char *task_name);
+#else
+static inline esp_err_t stats_quota_set(const char *task_name, uint32_t percent, uint32_t windows, stats_quota_action_t action) { (void)task_name; (void)percent; (void)windows; (void)action; return ESP_ERR_NOT_SUPPORTED; }
+static inline esp_err_t stats_quota_clear(const char *task_name) { (void)task_name; return ESP_ERR_NOT_SUPPORTED; }
+#endif
+
+#else // STATS_ENABLED
+
+//Instrumentation disabled: keep call sites compiling, but leave no code behind.
+//stats_run_time_init returns NULL, which every other call accepts.
+static inline void stats_init(void) {}
+static inline void stats_reset_accumulated_infos(void) {}
+static inline void stats_set_event_handler(stats_event_handler_t handler, void *arg) { (void)handler; (void)arg; }
+static inline esp_err_t stats_get_window(uint32_t age, stats_window_t *window) { (void)age; (void)window; return ESP_ERR_NOT_SUPPORTED; }
+
+static inline stats_run_time_t *stats_run_time_init(const char *name) { (void)name; return NULL; }
+static inline stats_run_time_t *stats_run_time_init_once(stats_run_time_t **slot, const char *name) { (void)slot; (void)name; return NULL; }
+static inline bool stats_run_time_start(stats_run_time_t *handler) { (void)handler; return false; }
+static inline bool stats_run_time_try_start(stats_run_time_t *handler) { (void)handler; return false; }
+static inline void stats_run_time_stop(stats_run_time_t *handler) { (void)handler; }
+static inline void stats_run_time_free(stats_run_time_t *handler) { (void)handler; }
+static inline void stats_run_time_print(const stats_run_time_t *handler) { (void)handler; }
+static inline void stats_run_time_print_tree(void) {}
+static inline void stats_run_time_reset_tree(void) {}
+static inline void stats_trace_enable(bool enable) { (void)enable; }
+static inline void stats_trace_clear(void) {}
+static inline void stats_trace_dump(void) {}
+static inline esp_err_t stats_profiler_start(uint32_t hz) { (void)hz; return ESP_ERR_NOT_SUPPORTED; }
+static inline void stats_profiler_stop(void) {}
+static inline void stats_profiler_dump(void) {}
+static inline esp_err_t stats_ctxsw_print(bool timeline) { (void)timeline; return ESP_OK; }
+static inline void stats_ctxsw_clear(void) {}
+static inline esp_err_t stats_cpu_load_init(void) { return ESP_OK; }
+static inline uint32_t stats_cpu_load_get(int core) { (void)core; return 0; }
+static inline esp_err_t stats_log_flush(void) { return ESP_OK; }
+static inline esp_err_t stats_log_read_last(stats_window_t *windows, size_t num, size_t *read_num) { (void)windows; (void)num; *read_num = 0; return ESP_ERR_NOT_SUPPORTED; }
+static inline esp_err_t stats_blackbox_read(uint32_t age, stats_window_t *window) { (void)age; (void)window; return ESP_ERR_NOT_SUPPORTED; }
+static inline esp_err_t stats_net_start(uint16_t port) { (void)port; return ESP_ERR_NOT_SUPPORTED; }
+static inline void stats_net_stop(void) {}
+static inline esp_err_t stats_metrics_render(char *buf, size_t size, size_t *len) { (void)buf; (void)size; *len = 0; return ESP_ERR_NOT_SUPPORTED; }
+static inline esp_err_t stats_quota_set(const char *task_name, uint32_t percent, uint32_t windows, stats_quota_action_t action) { (void)task_name; (void)percent; (void)windows; (void)action; return ESP_ERR_NOT_SUPPORTED; }
+static inline esp_err_t stats_quota_clear(const char *task_name) { (void)task_name; return ESP_ERR_NOT_SUPPORTED; }
+
+#endif // STATS_ENABLED
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,92 @@
+/* Adaptive window length
+
+   Picks the length of the next window from the one just finished. A window in
+   which some task's share of a core moved sharply since the previous window,
+   or in which a task was created or deleted, drops the length to MIN_TICKS;
+   a steady window makes it a quarter longer, up to MAX_TICKS.
+
+   A move is sharp when it reaches CHANGE_PERCENT in a window of MIN_TICKS.
+   Longer windows average the load over more time, which shrinks its swings
+   by the square root of the length, so the threshold shrinks with it.
+
+   Dropping at once and growing slowly gives short windows from the start of
+   a change and for as long as the load keeps moving, paid for by long
+   windows while it is steady.
+*/
+
+#include "string.h"
+#include "freertos/FreeRTOS.h"
+#include "stats_priv.h"
+
+#if STATS_ENABLED && CONFIG_STATS_ADAPTIVE
+
+#define MIN_TICKS       pdMS_TO_TICKS(CONFIG_STATS_ADAPTIVE_MIN_MS)
+#define MAX_TICKS       pdMS_TO_TICKS(CONFIG_STATS_ADAPTIVE_MAX_MS)
+#define CHANGE_PERCENT  CONFIG_STATS_ADAPTIVE_CHANGE_PERCENT
+
+//The clamp below would otherwise give every window MAX_TICKS
+_Static_assert(CONFIG_STATS_ADAPTIVE_MIN_MS <= CONFIG_STATS_ADAPTIVE_MAX_MS,
+               "CONFIG_STATS_ADAPTIVE_MIN_MS is above CONFIG_STATS_ADAPTIVE_MAX_MS");
+
+typedef struct {
+    uint32_t task_id;
+    uint32_t share;         //percent of one core
+} share_t;
+
+//Shares in the previous window, in its row order
+static share_t s_shares[STATS_WINDOW_TASK_NUM];
+static uint16_t s_share_num;
+
+static uint32_t get_share(const stats_task_sample_t *task, uint32_t elapsed) {
+    return (uint64_t)task->run_time * 100 / elapsed;
+}
+
+//Largest change of a task's share since the previous window, in percent of a core
+static uint32_t max_change(const stats_window_t *window) {
+    uint32_t change = 0;
+    for (int i = 0; i < window->task_num; i++) {
+        const stats_task_sample_t *task = &window->tasks[i];
+        if (task->status != STATS_TASK_MATCHED) {
+            //Tasks come and go at the start and end of activity
+            return CHANGE_PERCENT;
+        }
+        //Rows keep their order from window to window unless tasks come and go
+        int j = i;
+        if (j >= s_share_num || s_shares[j].task_id != task->task_id) {
+            for (j = 0; j < s_share_num && s_shares[j].task_id != task->task_id; j++) {
+            }
+        }
+        if (j == s_share_num) {
+            continue;
+        }
+        uint32_t share = get_share(task, window->elapsed);
+        uint32_t diff = share > s_shares[j].share ? share - s_shares[j].share : s_shares[j].share - share;
+        change = diff > change ? diff : change;
+    }
+    return change;
+}
+
+TickType_t stats_adapt_next(const stats_window_t *window, TickType_t ticks) {
+    if (window->elapsed == 0) {
+        return ticks;
+    }
+    //The first window has nothing to compare with, and counts as steady
+    uint32_t change = s_share_num > 0 ? max_change(window) : 0;
+    s_share_num = 0;
+    for (int i = 0; i < window->task_num; i++) {
+        if (window->tasks[i].status == STATS_TASK_MATCHED) {
+            s_shares[s_share_num].task_id = window->tasks[i].task_id;
+            s_shares[s_share_num].share = get_share(&window->tasks[i], window->elapsed);
+            s_share_num++;
+        }
+    }
+    //change >= CHANGE_PERCENT * sqrt(MIN_TICKS / ticks)
+    if ((uint64_t)change * change * ticks >= (uint64_t)CHANGE_PERCENT * CHANGE_PERCENT * MIN_TICKS) {
+        ticks = MIN_TICKS;
+    } else {
+        ticks += ticks / 4 > 0 ? ticks / 4 : 1;
+    }
+    return ticks < MIN_TICKS ? MIN_TICKS : ticks > MAX_TICKS ? MAX_TICKS : ticks;
+}
+
+#endif // STATS_ENABLED && CONFIG_STATS_ADAPTIVE
@@ -0,0 +1,192 @@
+/* Black box of the last windows, kept across resets
+
+   The last CONFIG_STATS_BLACKBOX_WINDOWS windows are kept in RTC memory that
+   is not initialised at startup, so they survive a software, panic or
+   watchdog reset (not a power cycle). Each slot holds the run time, share,
+   state and stack of the CONFIG_STATS_BLACKBOX_TASK_NUM busiest tasks of a
+   window, with the task names cut to BLACKBOX_NAME_LEN characters.
+
+   Only the monitor task writes, so no lock is needed: a slot's checksum is
+   cleared before it is rewritten and set after, and the head moves on last.
+   A reset in the middle leaves one slot with a bad checksum, which is
+   skipped. On the next boot the slots written before the reset are passed to
+   the sinks once, oldest first, and stay readable with stats_blackbox_read()
+   until they are reused. The accumulated run time and the heap figures other
+   than the free size are not kept, and are marked unrecorded in those windows.
+*/
+
+#include <inttypes.h>
+#include "string.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+#include "stats_priv.h"
+
+#if STATS_ENABLED && CONFIG_STATS_BLACKBOX
+
+#define BLACKBOX_WINDOWS    CONFIG_STATS_BLACKBOX_WINDOWS
+#define BLACKBOX_TASK_NUM   CONFIG_STATS_BLACKBOX_TASK_NUM
+#define BLACKBOX_NAME_LEN   12
+#define BLACKBOX_VERSION    2       //Raise when a field changes meaning but not size
+#define BLACKBOX_MAGIC      ((0x53424200 | BLACKBOX_VERSION) ^ (uint32_t)sizeof(blackbox_t))  //Changes with the layout
+#define REPLAY_WAIT_TICKS   pdMS_TO_TICKS(100)  //for the sink task, per window replayed
+
+typedef struct {
+    char name[BLACKBOX_NAME_LEN];   //not terminated when BLACKBOX_NAME_LEN long
+    uint32_t run_time;
+    uint16_t min_stack;             //saturated at 65535
+    uint8_t percentage;
+    uint8_t priority;
+    uint8_t base_priority;
+    uint8_t flags;                  //status | state << 2 | starved << 4
+    uint8_t reserved[2];
+} blackbox_task_t;
+
+typedef struct {
+    uint32_t crc;                   //of the rest of the slot, 0 while it is written
+    uint32_t seq;
+    uint32_t elapsed;
+    uint32_t heap_free[STATS_HEAP_NUM];
+    uint16_t task_num;
+    uint16_t reserved;
+    blackbox_task_t tasks[BLACKBOX_TASK_NUM];
+} blackbox_slot_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t head;                  //slots written since the black box was cleared
+    blackbox_slot_t slots[BLACKBOX_WINDOWS];
+} blackbox_t;
+
+//RTC slow memory is 8 KB on most targets and shared with the ULP and deep sleep data
+_Static_assert(sizeof(blackbox_t) <= 4096,
+               "black box over 4 KB of RTC memory, lower CONFIG_STATS_BLACKBOX_WINDOWS or _TASK_NUM");
+
+static const char *TAG = "stats_blackbox";
+static RTC_NOINIT_ATTR blackbox_t s_blackbox;
+static uint32_t s_boot_head;        //head when this boot started; older slots are from before the reset
+
+static uint32_t slot_crc(const blackbox_slot_t *slot) {
+    return esp_rom_crc32_le(0, (const uint8_t *)slot + sizeof(slot->crc), sizeof(*slot) - sizeof(slot->crc));
+}
+
+static void slot_to_window(const blackbox_slot_t *slot, stats_window_t *window) {
+    memset(window, 0, sizeof(*window));
+    window->seq = slot->seq;
+    window->elapsed = slot->elapsed;
+    window->unrecorded = STATS_WINDOW_NO_ACCUMULATED | STATS_WINDOW_NO_HEAP_DETAIL;
+    window->task_num = slot->task_num;
+    for (int i = 0; i < slot->task_num; i++) {
+        const blackbox_task_t *from = &slot->tasks[i];
+        stats_task_sample_t *task = &window->tasks[i];
+        memcpy(task->name, from->name, BLACKBOX_NAME_LEN);
+        task->task_id = i;          //Ids of the previous boot mean nothing now
+        task->status = from->flags & 0x03;
+        task->state = (from->flags >> 2) & 0x03;
+        task->starved = (from->flags >> 4) & 0x01;
+        task->priority = from->priority;
+        task->base_priority = from->base_priority;
+        task->core = STATS_TASK_NO_AFFINITY;
+        task->run_time = from->run_time;
+        task->percentage = from->percentage;
+        task->min_stack = from->min_stack;
+    }
+    stats_window_count_states(window);
+    for (int i = 0; i < STATS_HEAP_NUM; i++) {
+        window->heap[i].free_size = slot->heap_free[i];
+    }
+}
+
+void stats_blackbox_init(void) {
+    if (s_blackbox.magic != BLACKBOX_MAGIC) {
+        //Power on, or a firmware with another layout
+        memset(&s_blackbox, 0, sizeof(s_blackbox));
+        s_blackbox.magic = BLACKBOX_MAGIC;
+    }
+    s_boot_head = s_blackbox.head;
+
+    uint32_t kept = s_boot_head < BLACKBOX_WINDOWS ? s_boot_head : BLACKBOX_WINDOWS;
+    if (kept == 0) {
+        return;
+    }
+    stats_window_t *window = malloc(sizeof(stats_window_t));
+    if (window == NULL) {
+        ESP_LOGE(TAG, "no memory to replay the black box");
+        return;
+    }
+    ESP_LOGW(TAG, "%" PRIu32 " window(s) from before the last reset (reason %d) follow, oldest first",
+             kept, esp_reset_reason());
+    for (uint32_t age = kept; age-- > 0;) {
+        esp_err_t ret = stats_blackbox_read(age, window);
+        if (ret == ESP_ERR_INVALID_CRC) {
+            ESP_LOGW(TAG, "window being written at the reset is lost");
+            continue;
+        }
+        if (ret == ESP_OK && stats_sink_submit_wait(window, REPLAY_WAIT_TICKS) != ESP_OK) {
+            ESP_LOGW(TAG, "sink queue full, window %" PRIu32 " not replayed", window->seq);
+        }
+    }
+    free(window);
+}
+
+esp_err_t stats_blackbox_read(uint32_t age, stats_window_t *window) {
+    uint32_t written = s_blackbox.head - s_boot_head;
+    uint32_t kept = s_boot_head < BLACKBOX_WINDOWS ? s_boot_head : BLACKBOX_WINDOWS;
+    //Slots reused in this boot no longer hold windows of the previous one
+    if (s_blackbox.magic != BLACKBOX_MAGIC || age + written >= kept) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    const blackbox_slot_t *slot = &s_blackbox.slots[(s_boot_head - 1 - age) % BLACKBOX_WINDOWS];
+    if (slot->crc != slot_crc(slot)) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    slot_to_window(slot, window);
+    return ESP_OK;
+}
+
+void stats_blackbox_record(const stats_window_t *window) {
+    blackbox_slot_t *slot = &s_blackbox.slots[s_blackbox.head % BLACKBOX_WINDOWS];
+    slot->crc = 0;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+    //Keep the busiest tasks when there is no room for all of them
+    bool taken[STATS_WINDOW_TASK_NUM] = { 0 };
+    int task_num = window->task_num < BLACKBOX_TASK_NUM ? window->task_num : BLACKBOX_TASK_NUM;
+    for (int i = 0; i < task_num; i++) {
+        int busiest = -1;
+        for (int j = 0; j < window->task_num; j++) {
+            if (!taken[j] && (busiest < 0 || window->tasks[j].run_time > window->tasks[busiest].run_time)) {
+                busiest = j;
+            }
+        }
+        taken[busiest] = true;
+        const stats_task_sample_t *from = &window->tasks[busiest];
+        blackbox_task_t *task = &slot->tasks[i];
+        memcpy(task->name, from->name, BLACKBOX_NAME_LEN);
+        task->run_time = from->run_time;
+        task->min_stack = from->min_stack < UINT16_MAX ? from->min_stack : UINT16_MAX;
+        task->percentage = from->percentage;
+        task->priority = from->priority;
+        task->base_priority = from->base_priority;
+        task->flags = from->status | from->state << 2 | from->starved << 4;
+        memset(task->reserved, 0, sizeof(task->reserved));
+    }
+    memset(&slot->tasks[task_num], 0, sizeof(slot->tasks[0]) * (BLACKBOX_TASK_NUM - task_num));
+    slot->seq = window->seq;
+    slot->elapsed = window->elapsed;
+    for (int i = 0; i < STATS_HEAP_NUM; i++) {
+        slot->heap_free[i] = window->heap[i].free_size;
+    }
+    slot->task_num = task_num;
+    slot->reserved = 0;
+
+    uint32_t crc = slot_crc(slot);
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    slot->crc = crc;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    s_blackbox.head++;
+}
+
+#endif // STATS_ENABLED && CONFIG_STATS_BLACKBOX
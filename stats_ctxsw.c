@@ -0,0 +1,185 @@
+/* Context switch trace
+
+   traceTASK_SWITCHED_IN/OUT (see stats_ctxsw.h) record every switch into a ring
+   per core. Each ring has exactly one writer, the scheduler of that core,
+   running with interrupts masked, so recording needs no lock. Readers copy the
+   ring and discard whatever the writer overwrote meanwhile.
+*/
+
+#include <inttypes.h>
+#include "string.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "stats_priv.h"
+#include "stats_ctxsw.h"
+
+#if STATS_ENABLED && CONFIG_STATS_CTXSW_TRACE
+
+#define CTXSW_EVENT_NUM     CONFIG_STATS_CTXSW_EVENT_NUM
+#define CTXSW_TASK_NUM      32
+
+typedef struct {
+    uint32_t timestamp;     //run time stats clock
+    TaskHandle_t task;
+    bool in;
+} ctxsw_event_t;
+
+typedef struct {
+    uint32_t head;
+    ctxsw_event_t events[CTXSW_EVENT_NUM];
+} ctxsw_ring_t;
+
+typedef struct {
+    TaskHandle_t task;
+    uint32_t switch_in;
+    uint32_t slices;        //completed in/out pairs
+    uint64_t slice_time;
+    uint32_t max_slice;
+} ctxsw_task_info_t;
+
+static const char *TAG = "stats_ctxsw";
+static ctxsw_ring_t s_ctxsw_rings[portNUM_PROCESSORS];
+
+static inline void record_switch(bool in) {
+    ctxsw_ring_t *ring = &s_ctxsw_rings[xPortGetCoreID()];
+    uint32_t head = ring->head;
+    ctxsw_event_t *event = &ring->events[head % CTXSW_EVENT_NUM];
+    event->timestamp = portGET_RUN_TIME_COUNTER_VALUE();
+    event->task = xTaskGetCurrentTaskHandle();
+    event->in = in;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void stats_ctxsw_switched_in(void) {
+    record_switch(true);
+}
+
+void stats_ctxsw_switched_out(void) {
+    record_switch(false);
+}
+
+//Copy the valid part of a ring, oldest first. Returns the number of events copied.
+static uint32_t copy_ring(int core, ctxsw_event_t *dst, uint32_t *dropped) {
+    ctxsw_ring_t *ring = &s_ctxsw_rings[core];
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t count = head < CTXSW_EVENT_NUM ? head : CTXSW_EVENT_NUM;
+    for (uint32_t i = 0; i < count; i++) {
+        dst[i] = ring->events[(head - count + i) % CTXSW_EVENT_NUM];
+    }
+    //Events the writer reached while copying may be torn: drop them
+    uint32_t overwritten = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - head;
+    if (overwritten >= count) {
+        overwritten = count;
+    }
+    *dropped = (head - count) + overwritten;
+    memmove(dst, dst + overwritten, sizeof(ctxsw_event_t) * (count - overwritten));
+    return count - overwritten;
+}
+
+//Deleted tasks' handles are dangling, so names come from a snapshot of live tasks
+static const char *get_task_name(const TaskStatus_t *tasks, UBaseType_t task_num, TaskHandle_t task) {
+    for (UBaseType_t i = 0; i < task_num; i++) {
+        if (tasks[i].xHandle == task) {
+            return tasks[i].pcTaskName;
+        }
+    }
+    return "(deleted)";
+}
+
+static ctxsw_task_info_t *get_task_info(ctxsw_task_info_t *infos, int *num, TaskHandle_t task) {
+    for (int i = 0; i < *num; i++) {
+        if (infos[i].task == task) {
+            return &infos[i];
+        }
+    }
+    if (*num >= CTXSW_TASK_NUM) {
+        return NULL;
+    }
+    ctxsw_task_info_t *info = &infos[(*num)++];
+    memset(info, 0, sizeof(*info));
+    info->task = task;
+    return info;
+}
+
+/**
+ * @brief   Print per-task context switch statistics from the recorded switches.
+ *
+ * For every task seen in the rings this prints how often it was switched in,
+ * and the average and longest time it ran before being switched out, in units
+ * of the run time stats clock. With timeline set, the raw switch events of each
+ * core are printed as well.
+ *
+ * @return
+ *  - ESP_OK                Success
+ *  - ESP_ERR_NO_MEM        Insufficient memory to copy the rings
+ */
+esp_err_t stats_ctxsw_print(bool timeline) {
+    ctxsw_event_t *events = malloc(sizeof(ctxsw_event_t) * CTXSW_EVENT_NUM);
+    ctxsw_task_info_t *infos = malloc(sizeof(ctxsw_task_info_t) * CTXSW_TASK_NUM);
+    UBaseType_t task_num = uxTaskGetNumberOfTasks() + 5;
+    TaskStatus_t *tasks = malloc(sizeof(TaskStatus_t) * task_num);
+    int info_num = 0;
+    esp_err_t ret = ESP_ERR_NO_MEM;
+    if (events == NULL || infos == NULL || tasks == NULL) {
+        goto exit;
+    }
+    task_num = uxTaskGetSystemState(tasks, task_num, NULL);
+
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        uint32_t dropped;
+        uint32_t count = copy_ring(core, events, &dropped);
+        if (timeline) {
+            printf("Core %d switches (%" PRIu32 " dropped)\n", core, dropped);
+        }
+        const ctxsw_event_t *last_in = NULL;
+        for (uint32_t i = 0; i < count; i++) {
+            const ctxsw_event_t *event = &events[i];
+            if (timeline) {
+                printf("%" PRIu32 " %s %s\n", event->timestamp, event->in ? "in " : "out",
+                       get_task_name(tasks, task_num, event->task));
+            }
+            ctxsw_task_info_t *info = get_task_info(infos, &info_num, event->task);
+            if (info == NULL) {
+                ESP_LOGE(TAG, "error: context switch task buffer is full");
+                continue;
+            }
+            if (event->in) {
+                info->switch_in++;
+                last_in = event;
+            } else if (last_in != NULL && last_in->task == event->task) {
+                uint32_t slice = event->timestamp - last_in->timestamp;
+                info->slices++;
+                info->slice_time += slice;
+                if (slice > info->max_slice) {
+                    info->max_slice = slice;
+                }
+                last_in = NULL;
+            }
+        }
+    }
+
+    printf("| Task | Switches | Avg Slice | Max Slice\n");
+    printf("| --- | --- | --- | ---\n");
+    for (int i = 0; i < info_num; i++) {
+        uint32_t avg = infos[i].slices ? (uint32_t)(infos[i].slice_time / infos[i].slices) : 0;
+        printf("| %s | %" PRIu32 " | %" PRIu32 " | %" PRIu32 "\n", get_task_name(tasks, task_num, infos[i].task),
+               infos[i].switch_in, avg, infos[i].max_slice);
+    }
+    ret = ESP_OK;
+
+exit:
+    free(events);
+    free(infos);
+    free(tasks);
+    return ret;
+}
+
+void stats_ctxsw_clear(void) {
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        __atomic_store_n(&s_ctxsw_rings[core].head, 0, __ATOMIC_RELEASE);
+    }
+}
+
+#endif // STATS_ENABLED && CONFIG_STATS_CTXSW_TRACE
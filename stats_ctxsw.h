@@ -0,0 +1,25 @@
+#pragma once
+
+//FreeRTOS trace hooks for CONFIG_STATS_CTXSW_TRACE.
+//
+//The hooks must be compiled into FreeRTOS itself, so force-include this header
+//into the freertos component, e.g. in the project CMakeLists.txt:
+//
+//  idf_component_get_property(freertos_lib freertos COMPONENT_LIB)
+//  target_compile_options(${freertos_lib} PRIVATE -include "${perfmon_dir}/stats_ctxsw.h")
+//
+//Both hooks run inside the scheduler with interrupts masked on the switching core.
+
+#include "sdkconfig.h"
+
+#if CONFIG_STATS_ENABLE && CONFIG_STATS_CTXSW_TRACE
+
+void stats_ctxsw_switched_in(void);
+void stats_ctxsw_switched_out(void);
+
+#undef traceTASK_SWITCHED_IN
+#define traceTASK_SWITCHED_IN()     stats_ctxsw_switched_in()
+#undef traceTASK_SWITCHED_OUT
+#define traceTASK_SWITCHED_OUT()    stats_ctxsw_switched_out()
+
+#endif
@@ -0,0 +1,162 @@
+/* Priority inversion and starvation detector
+
+   Runs on every finished window. An event is raised when a task that was
+   ready for the whole window got less CPU than a task of lower priority that
+   can run on the same core, in INVERSION_WINDOWS_MIN windows in a row, or
+   when a task has been running above its base priority (priority inheritance)
+   for INHERITANCE_WINDOWS_MAX windows in a row.
+
+   The idle tasks are never the lower priority side: on a lightly loaded
+   system they get most of the CPU, and any task that happens to be ready at
+   both ends of a window would be flagged against them. An inversion is
+   raised once, when its streak reaches INVERSION_WINDOWS_MIN, and again
+   only after a window without it.
+*/
+
+#include <inttypes.h>
+#include "string.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "stats_priv.h"
+
+#if STATS_ENABLED
+
+#define INHERITANCE_WINDOWS_MAX 3   //Consecutive windows of inherited priority before an event is raised
+#define INVERSION_WINDOWS_MIN   3   //Consecutive windows of the same inversion before an event is raised
+
+typedef struct {
+    uint32_t task_id;
+    uint16_t windows;
+} inheritance_info_t;
+
+//Streak of one pair: the starved task and the lower priority task that got the most CPU instead
+typedef struct {
+    uint32_t task_id;
+    uint32_t other_id;
+    uint16_t windows;
+} inversion_info_t;
+
+static const char *TAG = "stats_detect";
+static stats_event_handler_t s_event_handler;
+static void *s_event_handler_arg;
+static inheritance_info_t s_inheritance_infos[STATS_WINDOW_TASK_NUM];
+static inversion_info_t s_inversion_infos[STATS_WINDOW_TASK_NUM];
+
+void stats_set_event_handler(stats_event_handler_t handler, void *arg) {
+    s_event_handler = handler;
+    s_event_handler_arg = arg;
+}
+
+void stats_event_raise(const stats_event_t *event) {
+    if (event->type == STATS_EVENT_PRIORITY_INVERSION) {
+        ESP_LOGW(TAG, "priority inversion: %s (priority %d) got %" PRIu32 "%%, %s (priority %d) got %" PRIu32
+                 "%% for %" PRIu32 " windows", event->task->name, event->task->priority, event->task->percentage,
+                 event->other->name, event->other->priority, event->other->percentage, event->windows);
+    } else if (event->type == STATS_EVENT_QUOTA_OVERRUN) {
+        ESP_LOGW(TAG, "quota overrun: %s has been over its CPU quota for %" PRIu32 " windows",
+                 event->task->name, event->windows);
+    } else {
+        ESP_LOGW(TAG, "priority inheritance: %s has run at %d instead of %d for %" PRIu32 " windows",
+                 event->task->name, event->task->priority, event->task->base_priority, event->windows);
+    }
+    if (s_event_handler != NULL) {
+        s_event_handler(event, s_event_handler_arg);
+    }
+}
+
+static void detect_inversion(const stats_window_t *window) {
+    static inversion_info_t infos[STATS_WINDOW_TASK_NUM];
+    int info_num = 0;
+    for (int i = 0; i < window->task_num; i++) {
+        const stats_task_sample_t *high = &window->tasks[i];
+        if (high->status != STATS_TASK_MATCHED || !high->ready) {
+            continue;
+        }
+        //Report the lower priority task that got the most CPU
+        const stats_task_sample_t *low = NULL;
+        for (int j = 0; j < window->task_num; j++) {
+            const stats_task_sample_t *task = &window->tasks[j];
+            //Tasks pinned to different cores do not compete for the same CPU
+            if (task->core != high->core && task->core != STATS_TASK_NO_AFFINITY &&
+                high->core != STATS_TASK_NO_AFFINITY) {
+                continue;
+            }
+            if (task->status == STATS_TASK_MATCHED && task->priority > tskIDLE_PRIORITY &&
+                task->priority < high->priority && task->run_time > high->run_time &&
+                (low == NULL || task->run_time > low->run_time)) {
+                low = task;
+            }
+        }
+        if (low == NULL) {
+            continue;
+        }
+        //Continue the pair's streak from the previous window, if there was one
+        uint32_t windows = 1;
+        for (int j = 0; j < STATS_WINDOW_TASK_NUM && s_inversion_infos[j].windows > 0; j++) {
+            if (s_inversion_infos[j].task_id == high->task_id && s_inversion_infos[j].other_id == low->task_id) {
+                windows = s_inversion_infos[j].windows + 1;
+                break;
+            }
+        }
+        infos[info_num].task_id = high->task_id;
+        infos[info_num].other_id = low->task_id;
+        infos[info_num].windows = windows < UINT16_MAX ? windows : UINT16_MAX;
+        info_num++;
+        if (windows == INVERSION_WINDOWS_MIN) {
+            stats_event_t event = {
+                .type = STATS_EVENT_PRIORITY_INVERSION,
+                .seq = window->seq,
+                .task = high,
+                .other = low,
+                .windows = windows,
+            };
+            stats_event_raise(&event);
+        }
+    }
+    //Pairs not inverted in this window end their streak
+    memset(s_inversion_infos, 0, sizeof(s_inversion_infos));
+    memcpy(s_inversion_infos, infos, sizeof(inversion_info_t) * info_num);
+}
+
+static void detect_long_inheritance(const stats_window_t *window) {
+    static inheritance_info_t infos[STATS_WINDOW_TASK_NUM];
+    int info_num = 0;
+    for (int i = 0; i < window->task_num; i++) {
+        const stats_task_sample_t *task = &window->tasks[i];
+        if (task->status != STATS_TASK_MATCHED || task->priority == task->base_priority ||
+            info_num >= STATS_WINDOW_TASK_NUM) {
+            continue;
+        }
+        //Continue the streak from the previous window, if there was one
+        uint16_t windows = 1;
+        for (int j = 0; j < STATS_WINDOW_TASK_NUM && s_inheritance_infos[j].windows > 0; j++) {
+            if (s_inheritance_infos[j].task_id == task->task_id) {
+                windows = s_inheritance_infos[j].windows + 1;
+                break;
+            }
+        }
+        infos[info_num].task_id = task->task_id;
+        infos[info_num].windows = windows;
+        info_num++;
+        if (windows >= INHERITANCE_WINDOWS_MAX) {
+            stats_event_t event = {
+                .type = STATS_EVENT_LONG_INHERITANCE,
+                .seq = window->seq,
+                .task = task,
+                .other = NULL,
+                .windows = windows,
+            };
+            stats_event_raise(&event);
+        }
+    }
+    //Tasks not inheriting in this window end their streak
+    memset(s_inheritance_infos, 0, sizeof(s_inheritance_infos));
+    memcpy(s_inheritance_infos, infos, sizeof(inheritance_info_t) * info_num);
+}
+
+void stats_detect_window(const stats_window_t *window) {
+    detect_inversion(window);
+    detect_long_inheritance(window);
+}
+
+#endif // STATS_ENABLED
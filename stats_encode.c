@@ -0,0 +1,330 @@
+/* Delta and varint encoding of monitor windows
+
+   Record layout, all integers as LEB128 varints (zz: zigzag coded difference
+   to the reference value):
+
+     length                     bytes that follow
+     flags                      RECORD_KEYFRAME, RECORD_TASK_SET, and the
+                                window's STATS_WINDOW_NO_* flags shifted left by 2
+     zz seq, zz elapsed
+     zz state_count[], zz inherited_num, zz starved_num
+     zz free, min free, largest block, fragmentation of each heap
+     [task set]                 only with RECORD_TASK_SET
+       task_num
+       per task: task id minus the previous task's id,
+                 then, for tasks not in the reference window, name length,
+                 name and zz core
+     per task: status, state, ready and starved packed in one byte,
+               zz priority, zz base_priority, zz run_time,
+               zz run_time_accumulated minus (reference + run_time),
+               zz percentage, zz min_stack
+
+   The reference of a keyframe is an all-zero window, so its differences are
+   the values themselves. Otherwise it is the previous window, and each task
+   is compared with the task of the same id in it, or with zero if it is new.
+*/
+
+#include "string.h"
+#include "stats_encode.h"
+
+#if STATS_ENABLED
+
+#define RECORD_KEYFRAME         0x01
+#define RECORD_TASK_SET         0x02    //the task ids follow; otherwise they are those of the previous window
+#define RECORD_UNRECORDED_SHIFT 2       //the window's STATS_WINDOW_NO_* flags are kept above these
+#define LENGTH_SIZE_MAX         5       //varint bytes for the record length
+
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+} writer_t;
+
+typedef struct {
+    const uint8_t *buf;
+    size_t len;
+    size_t pos;
+    bool error;
+} reader_t;
+
+static const stats_task_sample_t s_zero_task;
+static const stats_window_t s_zero_window;
+
+static void put_byte(writer_t *writer, uint8_t byte) {
+    if (writer->len < writer->size) {
+        writer->buf[writer->len] = byte;
+    }
+    writer->len++;  //Keeps counting past the end so overflow can be detected once at the end
+}
+
+static void put_uvarint(writer_t *writer, uint64_t value) {
+    while (value >= 0x80) {
+        put_byte(writer, (uint8_t)value | 0x80);
+        value >>= 7;
+    }
+    put_byte(writer, (uint8_t)value);
+}
+
+static void put_svarint(writer_t *writer, int64_t value) {
+    put_uvarint(writer, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+static uint8_t get_byte(reader_t *reader) {
+    if (reader->pos >= reader->len) {
+        reader->error = true;
+        return 0;
+    }
+    return reader->buf[reader->pos++];
+}
+
+static uint64_t get_uvarint(reader_t *reader) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t byte = get_byte(reader);
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+    reader->error = true;
+    return 0;
+}
+
+static int64_t get_svarint(reader_t *reader) {
+    uint64_t value = get_uvarint(reader);
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+//Task of the reference window with this id. Ids are visited in increasing order, *pos keeps the place.
+static const stats_task_sample_t *find_ref_task(const stats_window_t *ref, int *pos, uint32_t task_id) {
+    while (*pos < ref->task_num && ref->tasks[*pos].task_id < task_id) {
+        (*pos)++;
+    }
+    if (*pos < ref->task_num && ref->tasks[*pos].task_id == task_id) {
+        return &ref->tasks[*pos];
+    }
+    return NULL;
+}
+
+static void put_window_fields(writer_t *writer, const stats_window_t *window, const stats_window_t *ref) {
+    put_svarint(writer, (int64_t)window->seq - ref->seq);
+    put_svarint(writer, (int64_t)window->elapsed - ref->elapsed);
+    for (int i = 0; i < STATS_TASK_STATE_NUM; i++) {
+        put_svarint(writer, (int64_t)window->state_count[i] - ref->state_count[i]);
+    }
+    put_svarint(writer, (int64_t)window->inherited_num - ref->inherited_num);
+    put_svarint(writer, (int64_t)window->starved_num - ref->starved_num);
+    for (int i = 0; i < STATS_HEAP_NUM; i++) {
+        const stats_heap_sample_t *heap = &window->heap[i], *ref_heap = &ref->heap[i];
+        put_svarint(writer, (int64_t)heap->free_size - ref_heap->free_size);
+        put_svarint(writer, (int64_t)heap->min_free_size - ref_heap->min_free_size);
+        put_svarint(writer, (int64_t)heap->largest_free_block - ref_heap->largest_free_block);
+        put_svarint(writer, (int64_t)heap->fragmentation - ref_heap->fragmentation);
+    }
+}
+
+static void get_window_fields(reader_t *reader, stats_window_t *window, const stats_window_t *ref) {
+    window->seq = ref->seq + get_svarint(reader);
+    window->elapsed = ref->elapsed + get_svarint(reader);
+    for (int i = 0; i < STATS_TASK_STATE_NUM; i++) {
+        window->state_count[i] = ref->state_count[i] + get_svarint(reader);
+    }
+    window->inherited_num = ref->inherited_num + get_svarint(reader);
+    window->starved_num = ref->starved_num + get_svarint(reader);
+    for (int i = 0; i < STATS_HEAP_NUM; i++) {
+        stats_heap_sample_t *heap = &window->heap[i];
+        const stats_heap_sample_t *ref_heap = &ref->heap[i];
+        heap->free_size = ref_heap->free_size + get_svarint(reader);
+        heap->min_free_size = ref_heap->min_free_size + get_svarint(reader);
+        heap->largest_free_block = ref_heap->largest_free_block + get_svarint(reader);
+        heap->fragmentation = ref_heap->fragmentation + get_svarint(reader);
+    }
+}
+
+static void put_task_fields(writer_t *writer, const stats_task_sample_t *task, const stats_task_sample_t *ref) {
+    put_byte(writer, task->status | task->state << 2 | task->ready << 4 | task->starved << 5);
+    put_svarint(writer, (int64_t)task->priority - ref->priority);
+    put_svarint(writer, (int64_t)task->base_priority - ref->base_priority);
+    put_svarint(writer, (int64_t)task->run_time - ref->run_time);
+    //Usually zero: the accumulated time grows by this window's run time
+    put_svarint(writer, (int64_t)(task->run_time_accumulated - ref->run_time_accumulated - task->run_time));
+    put_svarint(writer, (int64_t)task->percentage - ref->percentage);
+    put_svarint(writer, (int64_t)task->min_stack - ref->min_stack);
+}
+
+static void get_task_fields(reader_t *reader, stats_task_sample_t *task, const stats_task_sample_t *ref) {
+    uint8_t flags = get_byte(reader);
+    task->status = flags & 0x03;
+    task->state = (flags >> 2) & 0x03;
+    task->ready = (flags >> 4) & 0x01;
+    task->starved = (flags >> 5) & 0x01;
+    task->priority = ref->priority + get_svarint(reader);
+    task->base_priority = ref->base_priority + get_svarint(reader);
+    task->run_time = ref->run_time + get_svarint(reader);
+    task->run_time_accumulated = ref->run_time_accumulated + task->run_time + get_svarint(reader);
+    task->percentage = ref->percentage + get_svarint(reader);
+    task->min_stack = ref->min_stack + get_svarint(reader);
+}
+
+void stats_encoder_init(stats_encoder_t *encoder, uint32_t keyframe_interval) {
+    memset(&encoder->prev, 0, sizeof(encoder->prev));
+    encoder->window_count = 0;
+    encoder->keyframe_interval = keyframe_interval > 0 ? keyframe_interval : 1;
+}
+
+void stats_encoder_force_keyframe(stats_encoder_t *encoder) {
+    encoder->window_count = 0;
+}
+
+esp_err_t stats_encode_window(stats_encoder_t *encoder, const stats_window_t *window,
+                              uint8_t *buf, size_t size, size_t *len) {
+    //Order the tasks by id, so that unchanged task sets look the same in every window
+    uint16_t order[STATS_WINDOW_TASK_NUM];
+    int task_num = window->task_num;
+    for (int i = 0; i < task_num; i++) {
+        int j = i;
+        for (; j > 0 && window->tasks[order[j - 1]].task_id > window->tasks[i].task_id; j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+
+    bool keyframe = encoder->window_count % encoder->keyframe_interval == 0;
+    const stats_window_t *ref = keyframe ? &s_zero_window : &encoder->prev;
+    bool task_set_changed = keyframe || task_num != encoder->prev.task_num;
+    for (int i = 0; i < task_num && !task_set_changed; i++) {
+        task_set_changed = window->tasks[order[i]].task_id != encoder->prev.tasks[i].task_id;
+    }
+
+    //The body goes after room for the longest length prefix and is moved down once its length is known
+    writer_t writer = {
+        .buf = size > LENGTH_SIZE_MAX ? buf + LENGTH_SIZE_MAX : NULL,
+        .size = size > LENGTH_SIZE_MAX ? size - LENGTH_SIZE_MAX : 0,
+    };
+    put_byte(&writer, (keyframe ? RECORD_KEYFRAME : 0) | (task_set_changed ? RECORD_TASK_SET : 0) |
+                      window->unrecorded << RECORD_UNRECORDED_SHIFT);
+    put_window_fields(&writer, window, ref);
+    if (task_set_changed) {
+        put_uvarint(&writer, task_num);
+        uint32_t last_id = 0;
+        int pos = 0;
+        for (int i = 0; i < task_num; i++) {
+            const stats_task_sample_t *task = &window->tasks[order[i]];
+            put_uvarint(&writer, task->task_id - last_id);
+            last_id = task->task_id;
+            if (find_ref_task(ref, &pos, task->task_id) == NULL) {
+                size_t name_len = strnlen(task->name, sizeof(task->name) - 1);
+                put_byte(&writer, name_len);
+                for (size_t c = 0; c < name_len; c++) {
+                    put_byte(&writer, task->name[c]);
+                }
+                put_svarint(&writer, task->core);
+            }
+        }
+    }
+    int pos = 0;
+    for (int i = 0; i < task_num; i++) {
+        const stats_task_sample_t *task = &window->tasks[order[i]];
+        const stats_task_sample_t *ref_task = find_ref_task(ref, &pos, task->task_id);
+        put_task_fields(&writer, task, ref_task != NULL ? ref_task : &s_zero_task);
+    }
+    if (writer.len > writer.size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    writer_t prefix = { .buf = buf, .size = LENGTH_SIZE_MAX };
+    put_uvarint(&prefix, writer.len);
+    memmove(buf + prefix.len, writer.buf, writer.len);
+    *len = prefix.len + writer.len;
+
+    //Keep the window, in the order the decoder will see it, as the next reference
+    encoder->prev = *window;
+    for (int i = 0; i < task_num; i++) {
+        encoder->prev.tasks[i] = window->tasks[order[i]];
+    }
+    encoder->window_count++;
+    return ESP_OK;
+}
+
+void stats_decoder_init(stats_decoder_t *decoder) {
+    memset(&decoder->prev, 0, sizeof(decoder->prev));
+    decoder->synced = false;
+}
+
+esp_err_t stats_decode_window(stats_decoder_t *decoder, const uint8_t *buf, size_t len,
+                              stats_window_t *window, size_t *used) {
+    reader_t prefix = { .buf = buf, .len = len < LENGTH_SIZE_MAX ? len : LENGTH_SIZE_MAX };
+    uint64_t body_len = get_uvarint(&prefix);
+    if (prefix.error) {
+        return len < LENGTH_SIZE_MAX ? ESP_ERR_INVALID_SIZE : ESP_ERR_INVALID_CRC;
+    }
+    if (body_len > len - prefix.pos) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *used = prefix.pos + body_len;
+
+    reader_t reader = { .buf = buf + prefix.pos, .len = body_len };
+    uint8_t flags = get_byte(&reader);
+    bool keyframe = flags & RECORD_KEYFRAME;
+    if (!keyframe && !decoder->synced) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    const stats_window_t *ref = keyframe ? &s_zero_window : &decoder->prev;
+
+    memset(window, 0, sizeof(*window));
+    window->unrecorded = flags >> RECORD_UNRECORDED_SHIFT;
+    get_window_fields(&reader, window, ref);
+    if (flags & RECORD_TASK_SET) {
+        uint64_t task_num = get_uvarint(&reader);
+        if (task_num > STATS_WINDOW_TASK_NUM) {
+            reader.error = true;
+            task_num = 0;
+        }
+        window->task_num = task_num;
+        uint32_t task_id = 0;
+        int pos = 0;
+        for (int i = 0; i < window->task_num; i++) {
+            stats_task_sample_t *task = &window->tasks[i];
+            task_id += get_uvarint(&reader);
+            task->task_id = task_id;
+            const stats_task_sample_t *ref_task = find_ref_task(ref, &pos, task_id);
+            if (ref_task != NULL) {
+                memcpy(task->name, ref_task->name, sizeof(task->name));
+                task->core = ref_task->core;
+                continue;
+            }
+            size_t name_len = get_byte(&reader);
+            if (name_len >= sizeof(task->name)) {
+                reader.error = true;
+                break;
+            }
+            for (size_t c = 0; c < name_len; c++) {
+                task->name[c] = get_byte(&reader);
+            }
+            task->core = get_svarint(&reader);
+        }
+    } else {
+        window->task_num = ref->task_num;
+        for (int i = 0; i < window->task_num; i++) {
+            memcpy(window->tasks[i].name, ref->tasks[i].name, sizeof(window->tasks[i].name));
+            window->tasks[i].task_id = ref->tasks[i].task_id;
+            window->tasks[i].core = ref->tasks[i].core;
+        }
+    }
+    int pos = 0;
+    for (int i = 0; i < window->task_num && !reader.error; i++) {
+        stats_task_sample_t *task = &window->tasks[i];
+        const stats_task_sample_t *ref_task = find_ref_task(ref, &pos, task->task_id);
+        get_task_fields(&reader, task, ref_task != NULL ? ref_task : &s_zero_task);
+    }
+
+    if (reader.error || reader.pos != reader.len) {
+        decoder->synced = false;
+        return ESP_ERR_INVALID_CRC;
+    }
+    decoder->prev = *window;
+    decoder->synced = true;
+    return ESP_OK;
+}
+
+#endif // STATS_ENABLED
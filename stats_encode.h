@@ -0,0 +1,60 @@
+#pragma once
+
+//Compact binary encoding of monitor windows, for shipping them over a slow link.
+//
+//Each window becomes one record. A keyframe holds the whole window; the
+//records in between hold only the differences to the window before, as
+//zigzag varints, and list the task ids only when the set of tasks changed.
+//Decoding needs every record since the last keyframe, so a decoder that
+//starts in the middle of a stream skips records until the next keyframe.
+//
+//Decoded windows have their tasks ordered by task id.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "stats.h"
+
+//Largest record stats_encode_window can write
+#define STATS_ENCODE_SIZE_MAX   (96 + 56 * STATS_WINDOW_TASK_NUM)
+
+typedef struct {
+    stats_window_t prev;        //last window encoded, tasks ordered by id
+    uint32_t window_count;      //windows since the last keyframe
+    uint32_t keyframe_interval;
+} stats_encoder_t;
+
+typedef struct {
+    stats_window_t prev;        //last window decoded
+    bool synced;                //a keyframe has been decoded
+} stats_decoder_t;
+
+#if STATS_ENABLED
+
+//keyframe_interval: a keyframe is written every this many windows; 1 writes only keyframes
+void stats_encoder_init(stats_encoder_t *encoder, uint32_t keyframe_interval);
+//Make the next record a keyframe, e.g. after the receiver lost data
+void stats_encoder_force_keyframe(stats_encoder_t *encoder);
+//Encode one window into buf. ESP_ERR_INVALID_SIZE if it does not fit, in which case nothing changes.
+esp_err_t stats_encode_window(stats_encoder_t *encoder, const stats_window_t *window,
+                              uint8_t *buf, size_t size, size_t *len);
+
+void stats_decoder_init(stats_decoder_t *decoder);
+//Decode the record at the start of buf; *used is set to its length when it is complete.
+//ESP_ERR_INVALID_SIZE: buf holds only part of the record.
+//ESP_ERR_NOT_FOUND: a delta record arrived before any keyframe and was skipped.
+//ESP_ERR_INVALID_CRC: the record is malformed; the decoder waits for the next keyframe.
+esp_err_t stats_decode_window(stats_decoder_t *decoder, const uint8_t *buf, size_t len,
+                              stats_window_t *window, size_t *used);
+
+#else // STATS_ENABLED
+
+static inline void stats_encoder_init(stats_encoder_t *encoder, uint32_t keyframe_interval) { (void)encoder; (void)keyframe_interval; }
+static inline void stats_encoder_force_keyframe(stats_encoder_t *encoder) { (void)encoder; }
+static inline esp_err_t stats_encode_window(stats_encoder_t *encoder, const stats_window_t *window,
+                                            uint8_t *buf, size_t size, size_t *len) { (void)encoder; (void)window; (void)buf; (void)size; (void)len; return ESP_ERR_NOT_SUPPORTED; }
+static inline void stats_decoder_init(stats_decoder_t *decoder) { (void)decoder; }
+static inline esp_err_t stats_decode_window(stats_decoder_t *decoder, const uint8_t *buf, size_t len,
+                                            stats_window_t *window, size_t *used) { (void)decoder; (void)buf; (void)len; (void)window; (void)used; return ESP_ERR_NOT_SUPPORTED; }
+
+#endif // STATS_ENABLED
@@ -0,0 +1,221 @@
+/* JSON text of monitor windows and run time handles
+
+   Each call of next_piece() formats one piece of the text into
+   stats_json_t::piece, chosen by step and index; the readers copy pieces out
+   and only ask for the next one when the current one is used up. Nothing but
+   the position is kept between calls, so a stats_json_t can be dropped at any
+   point.
+*/
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include "string.h"
+#include "esp_log.h"
+#include "stats_json.h"
+
+#if STATS_ENABLED
+
+enum {
+    STEP_WINDOW_HEAD = 0,
+    STEP_WINDOW_HEAP,
+    STEP_WINDOW_TASKS,
+    STEP_WINDOW_TASK,
+    STEP_WINDOW_TAIL,
+    STEP_RUN_TIMES_HEAD,
+    STEP_RUN_TIME,
+    STEP_RUN_TIMES_TAIL,
+    STEP_DONE,
+};
+
+static const char *const s_heap_names[STATS_HEAP_NUM] = { "internal", "dma", "spiram" };
+static const char *const s_status_names[] = { "matched", "created", "deleted" };
+static const char *const s_state_names[STATS_TASK_STATE_NUM] = { "running", "ready", "blocked", "suspended" };
+static const char *TAG = "stats_json";
+
+//A cut piece is malformed JSON; STATS_JSON_PIECE_SIZE is sized for the longest one, so this is a bug
+static void piece_overflow(stats_json_t *json) {
+    ESP_LOGE(TAG, "piece over STATS_JSON_PIECE_SIZE cut at step %" PRIu32, json->step);
+    assert(false);
+}
+
+static void put(stats_json_t *json, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    size_t room = sizeof(json->piece) - json->piece_len;
+    int len = vsnprintf(json->piece + json->piece_len, room, format, args);
+    va_end(args);
+    if (len < 0) {
+        return;
+    }
+    if ((size_t)len >= room) {
+        piece_overflow(json);
+        len = room - 1;
+    }
+    json->piece_len += len;
+}
+
+//Bytes from 0x80 up are escaped too, as FreeRTOS names need not be UTF-8
+static void put_string(stats_json_t *json, const char *value, size_t max_len) {
+    put(json, "\"");
+    for (size_t i = 0; i < max_len && value[i] != '\0'; i++) {
+        unsigned char c = value[i];
+        if (c == '"' || c == '\\') {
+            put(json, "\\%c", c);
+        } else if (c < 0x20 || c >= 0x80) {
+            put(json, "\\u%04x", c);
+        } else if (json->piece_len < sizeof(json->piece) - 1) {
+            json->piece[json->piece_len++] = c;
+        } else {
+            piece_overflow(json);
+            break;
+        }
+    }
+    put(json, "\"");
+}
+
+static void put_window_head(stats_json_t *json, const stats_window_t *window) {
+    put(json, "{\"seq\":%" PRIu32 ",\"elapsed\":%" PRIu32 ",\"states\":{", window->seq, window->elapsed);
+    for (int i = 0; i < STATS_TASK_STATE_NUM; i++) {
+        put(json, "%s\"%s\":%u", i > 0 ? "," : "", s_state_names[i], window->state_count[i]);
+    }
+    put(json, "},\"inherited_num\":%u,\"starved_num\":%u,\"heap\":{", window->inherited_num, window->starved_num);
+}
+
+static void put_heap(stats_json_t *json, int i, const stats_window_t *window) {
+    const stats_heap_sample_t *heap = &window->heap[i];
+    put(json, "%s\"%s\":{\"free\":%" PRIu32, i > 0 ? "," : "", s_heap_names[i], heap->free_size);
+    if (window->unrecorded & STATS_WINDOW_NO_HEAP_DETAIL) {
+        put(json, ",\"min_free\":null,\"largest_free_block\":null,\"fragmentation\":null}");
+        return;
+    }
+    put(json, ",\"min_free\":%" PRIu32 ",\"largest_free_block\":%" PRIu32 ",\"fragmentation\":%u}",
+        heap->min_free_size, heap->largest_free_block, heap->fragmentation);
+}
+
+static void put_task(stats_json_t *json, int i, const stats_window_t *window) {
+    const stats_task_sample_t *task = &window->tasks[i];
+    put(json, i > 0 ? ",{\"name\":" : "{\"name\":");
+    put_string(json, task->name, sizeof(task->name));
+    put(json, ",\"id\":%" PRIu32 ",\"status\":\"%s\",\"state\":\"%s\",\"priority\":%u,\"base_priority\":%u,"
+              "\"core\":%d,\"ready\":%s,\"starved\":%s,\"run_time\":%" PRIu32,
+        task->task_id, s_status_names[task->status], s_state_names[task->state], task->priority,
+        task->base_priority, task->core, task->ready ? "true" : "false", task->starved ? "true" : "false",
+        task->run_time);
+    if (window->unrecorded & STATS_WINDOW_NO_ACCUMULATED) {
+        put(json, ",\"run_time_accumulated\":null");
+    } else {
+        put(json, ",\"run_time_accumulated\":%" PRIu64, task->run_time_accumulated);
+    }
+    put(json, ",\"percentage\":%" PRIu32 ",\"min_stack\":%" PRIu32 "}", task->percentage, task->min_stack);
+}
+
+static void put_run_time(stats_json_t *json, int i, const stats_run_time_t *handler) {
+    put(json, i > 0 ? ",{\"name\":" : "{\"name\":");
+    put_string(json, handler->name, sizeof(handler->name));
+    put(json, ",\"time\":%" PRId64 ",\"self_time\":%" PRId64, handler->time, handler->self_time);
+#if CONFIG_STATS_METRICS
+    put(json, ",\"count\":%" PRIu32 ",\"buckets\":[", handler->count);
+    for (int b = 0; b < STATS_RUN_TIME_BUCKET_NUM; b++) {
+        put(json, b > 0 ? ",%" PRIu32 : "%" PRIu32, handler->buckets[b]);
+    }
+    put(json, "]");
+#endif
+    put(json, "}");
+}
+
+//Format the next piece; false when the text is complete
+static bool next_piece(stats_json_t *json) {
+    json->piece_len = 0;
+    json->piece_pos = 0;
+    switch (json->step) {
+    case STEP_WINDOW_HEAD:
+        put_window_head(json, json->window);
+        json->step = STEP_WINDOW_HEAP;
+        json->index = 0;
+        break;
+    case STEP_WINDOW_HEAP:
+        put_heap(json, json->index, json->window);
+        if (++json->index == STATS_HEAP_NUM) {
+            json->step = STEP_WINDOW_TASKS;
+        }
+        break;
+    case STEP_WINDOW_TASKS:
+        put(json, "},\"tasks\":[");
+        json->step = json->window->task_num > 0 ? STEP_WINDOW_TASK : STEP_WINDOW_TAIL;
+        json->index = 0;
+        break;
+    case STEP_WINDOW_TASK:
+        put_task(json, json->index, json->window);
+        if (++json->index == json->window->task_num) {
+            json->step = STEP_WINDOW_TAIL;
+        }
+        break;
+    case STEP_WINDOW_TAIL:
+        put(json, "]}");
+        json->step = STEP_DONE;
+        break;
+    case STEP_RUN_TIMES_HEAD:
+        put(json, "[");
+        json->step = json->handler_num > 0 ? STEP_RUN_TIME : STEP_RUN_TIMES_TAIL;
+        json->index = 0;
+        break;
+    case STEP_RUN_TIME:
+        put_run_time(json, json->index, json->handlers[json->index]);
+        if (++json->index == json->handler_num) {
+            json->step = STEP_RUN_TIMES_TAIL;
+        }
+        break;
+    case STEP_RUN_TIMES_TAIL:
+        put(json, "]");
+        json->step = STEP_DONE;
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+void stats_json_window(stats_json_t *json, const stats_window_t *window) {
+    json->window = window;
+    json->step = STEP_WINDOW_HEAD;
+    json->piece_len = 0;
+    json->piece_pos = 0;
+}
+
+void stats_json_run_times(stats_json_t *json, const stats_run_time_t *const *handlers, size_t num) {
+    json->handlers = handlers;
+    json->handler_num = num;
+    json->step = STEP_RUN_TIMES_HEAD;
+    json->piece_len = 0;
+    json->piece_pos = 0;
+}
+
+size_t stats_json_read(stats_json_t *json, char *buf, size_t size) {
+    size_t len = 0;
+    while (len < size) {
+        if (json->piece_pos == json->piece_len && !next_piece(json)) {
+            break;
+        }
+        size_t n = json->piece_len - json->piece_pos;
+        n = n < size - len ? n : size - len;
+        memcpy(buf + len, json->piece + json->piece_pos, n);
+        json->piece_pos += n;
+        len += n;
+    }
+    return len;
+}
+
+esp_err_t stats_json_write(stats_json_t *json, stats_json_write_t write, void *arg) {
+    while (json->piece_pos < json->piece_len || next_piece(json)) {
+        esp_err_t ret = write(json->piece + json->piece_pos, json->piece_len - json->piece_pos, arg);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        json->piece_pos = json->piece_len;
+    }
+    return ESP_OK;
+}
+
+#endif // STATS_ENABLED
@@ -0,0 +1,59 @@
+#pragma once
+
+//JSON text of monitor windows and run time handles, written without the heap.
+//
+//The text is produced piece by piece (a window header, one heap, one task, ...)
+//into a small buffer inside stats_json_t, so any amount of it can be taken at
+//a time: stats_json_read copies as much as fits in the caller's buffer and
+//continues where it stopped on the next call, and stats_json_write hands each
+//piece to a callback. The window or handles must stay unchanged until the
+//whole text is out.
+//
+//Window:
+//  {"seq":3,"elapsed":1000000,"states":{"running":2,"ready":1,"blocked":5,"suspended":0},
+//   "inherited_num":0,"starved_num":0,
+//   "heap":{"internal":{"free":..,"min_free":..,"largest_free_block":..,"fragmentation":..},"dma":{..},"spiram":{..}},
+//   "tasks":[{"name":"wifi","id":3,"status":"matched","state":"blocked","priority":23,"base_priority":23,
+//             "core":0,"ready":false,"starved":false,"run_time":..,"run_time_accumulated":..,"percentage":10,
+//             "min_stack":2048},..]}
+//Run time handles (count and buckets with CONFIG_STATS_METRICS), times in microseconds:
+//  [{"name":"parse","time":..,"self_time":..,"count":..,"buckets":[..]},..]
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "stats.h"
+
+#define STATS_JSON_PIECE_SIZE   384     //longest piece: one task with a fully escaped name
+
+typedef esp_err_t (*stats_json_write_t)(const char *data, size_t len, void *arg);
+
+typedef struct {
+    const stats_window_t *window;
+    const stats_run_time_t *const *handlers;
+    size_t handler_num;
+    uint32_t step;              //kind of piece produced next
+    uint32_t index;             //heap, task or handle within the step
+    uint16_t piece_len;
+    uint16_t piece_pos;         //bytes of the piece already taken
+    char piece[STATS_JSON_PIECE_SIZE];
+} stats_json_t;
+
+#if STATS_ENABLED
+
+void stats_json_window(stats_json_t *json, const stats_window_t *window);
+void stats_json_run_times(stats_json_t *json, const stats_run_time_t *const *handlers, size_t num);
+//Copy the next part of the text into buf, and return its length; 0 once the whole text is out
+size_t stats_json_read(stats_json_t *json, char *buf, size_t size);
+//Pass the rest of the text to write, piece by piece. If write fails, its error is returned and
+//the next call starts again with the piece it refused.
+esp_err_t stats_json_write(stats_json_t *json, stats_json_write_t write, void *arg);
+
+#else // STATS_ENABLED
+
+static inline void stats_json_window(stats_json_t *json, const stats_window_t *window) { (void)json; (void)window; }
+static inline void stats_json_run_times(stats_json_t *json, const stats_run_time_t *const *handlers, size_t num) { (void)json; (void)handlers; (void)num; }
+static inline size_t stats_json_read(stats_json_t *json, char *buf, size_t size) { (void)json; (void)buf; (void)size; return 0; }
+static inline esp_err_t stats_json_write(stats_json_t *json, stats_json_write_t write, void *arg) { (void)json; (void)write; (void)arg; return ESP_OK; }
+
+#endif // STATS_ENABLED
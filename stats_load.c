@@ -0,0 +1,102 @@
+/* CPU load meter
+
+   Measures, per core, the time the idle task ran from its run time counter.
+   The tick hook of each core reads the counter of that core's idle task, and
+   every LOAD_WINDOW_TICKS ticks publishes the share of the window not spent
+   in it as the core's load. Work that runs between ticks is counted as well
+   as work the ticks interrupt. Reading the load is a single load, so control
+   code can poll it as often as it likes without touching the scheduler.
+
+   The idle task's counter only moves when it is switched out, and a core
+   with nothing else to run may stay in it for many ticks. While the idle task
+   is running, the time since it was switched in is added to the counter. The
+   switch in is located to the tick period it happened in, so a window may be
+   off by half a tick at each end.
+*/
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_freertos_hooks.h"
+#include "stats_priv.h"
+
+#if STATS_ENABLED && CONFIG_STATS_CPU_LOAD
+
+#define LOAD_WINDOW_TICKS   CONFIG_STATS_CPU_LOAD_WINDOW_TICKS
+
+typedef struct {
+    TaskHandle_t idle_task;     //taken on the core's first tick
+    uint32_t ticks;
+    uint32_t tick_time;         //run time clock at the last tick
+    uint32_t idle_counter;      //idle task's run time counter at the last tick
+    bool idle_running;          //idle task running at the last tick, switched in at idle_since
+    uint32_t idle_since;
+    uint32_t window_time;       //run time clock and idle time at the start of the window
+    uint32_t window_idle;
+    uint32_t load;              //percent, published once per window
+} load_meter_t;
+
+static const char *TAG = "stats_load";
+static load_meter_t s_load_meters[portNUM_PROCESSORS];
+static bool s_load_initialized;
+
+//Runs on the core it measures, so "current" and "idle" are that core's tasks
+static void IRAM_ATTR load_tick_hook(void) {
+    load_meter_t *meter = &s_load_meters[xPortGetCoreID()];
+    uint32_t now = portGET_RUN_TIME_COUNTER_VALUE();
+    uint32_t counter = ulTaskGetIdleRunTimeCounter();
+    if (meter->idle_task == NULL) {
+        meter->idle_task = xTaskGetIdleTaskHandle();
+        meter->tick_time = now;
+        meter->idle_counter = counter;
+        meter->window_time = now;
+        meter->window_idle = counter;
+    }
+    bool idle_running = xTaskGetCurrentTaskHandle() == meter->idle_task;
+    if (idle_running && (!meter->idle_running || counter != meter->idle_counter)) {
+        //Switched in since the last tick; take the middle of the tick period
+        meter->idle_since = meter->tick_time + (now - meter->tick_time) / 2;
+    }
+    meter->idle_running = idle_running;
+    meter->idle_counter = counter;
+    meter->tick_time = now;
+
+    if (++meter->ticks >= LOAD_WINDOW_TICKS) {
+        uint32_t idle = counter + (idle_running ? now - meter->idle_since : 0);
+        uint32_t elapsed = now - meter->window_time;
+        uint32_t idle_elapsed = idle - meter->window_idle;
+        if (elapsed > 0) {
+            uint32_t idle_percent = (uint64_t)idle_elapsed * 100 / elapsed;
+            __atomic_store_n(&meter->load, idle_percent < 100 ? 100 - idle_percent : 0, __ATOMIC_RELAXED);
+        }
+        meter->ticks = 0;
+        meter->window_time = now;
+        meter->window_idle = idle;
+    }
+}
+
+esp_err_t stats_cpu_load_init(void) {
+    if (s_load_initialized) {
+        return ESP_OK;
+    }
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        esp_err_t ret = esp_register_freertos_tick_hook_for_cpu(load_tick_hook, core);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "failed to register tick hook on core %d", core);
+            return ret;
+        }
+    }
+    s_load_initialized = true;
+    return ESP_OK;
+}
+
+uint32_t stats_cpu_load_get(int core) {
+    if (core < 0 || core >= portNUM_PROCESSORS) {
+        return 0;
+    }
+    return __atomic_load_n(&s_load_meters[core].load, __ATOMIC_RELAXED);
+}
+
+#endif // STATS_ENABLED && CONFIG_STATS_CPU_LOAD
@@ -0,0 +1,319 @@
+/* Persistent window log in a flash partition
+
+   The log is a sink (stats_sink.h), so it is written from the sink task.
+   Windows are encoded with stats_encode.h and collected in a RAM batch, which
+   is written to flash in one go every CONFIG_STATS_LOG_BATCH_WINDOWS windows.
+   Each batch starts with a keyframe, so it can be decoded on its own.
+
+   The partition is used as a ring of 4 KB sectors, written in order and
+   erased just before reuse, so every sector wears at the same rate:
+
+     sector: log_sector_header_t, batch, batch, ..., erased space
+     batch:  log_batch_header_t, encoded window records, padding to 4 bytes
+
+   Sector sequence numbers give the order of the sectors. A batch whose
+   checksum does not match (power lost while writing it) ends its sector.
+   After a reset, writing resumes behind the last good batch, or in the next
+   sector when the last batch was torn.
+*/
+
+#include <inttypes.h>
+#include "string.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "stats_priv.h"
+#include "stats_encode.h"
+#include "stats_sink.h"
+
+#if STATS_ENABLED && CONFIG_STATS_LOG
+
+#define LOG_SECTOR_SIZE     4096
+#define LOG_SECTOR_MAGIC    0x474f4c53  //"SLOG"
+#define LOG_BATCH_MAGIC     0x4253      //"SB"
+#define LOG_BATCH_WINDOWS   CONFIG_STATS_LOG_BATCH_WINDOWS
+#define LOG_BATCH_SIZE      CONFIG_STATS_LOG_BATCH_SIZE
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t crc;               //of magic and seq
+    uint32_t reserved;
+} log_sector_header_t;
+
+typedef struct {
+    uint16_t magic;             //0xffff: erased, no more batches in this sector
+    uint16_t len;               //record bytes that follow
+    uint32_t crc;               //of the records
+} log_batch_header_t;
+
+_Static_assert(sizeof(log_sector_header_t) + sizeof(log_batch_header_t) + LOG_BATCH_SIZE <= LOG_SECTOR_SIZE,
+               "CONFIG_STATS_LOG_BATCH_SIZE does not fit in a flash sector");
+
+static const char *TAG = "stats_log";
+static const esp_partition_t *s_partition;
+static SemaphoreHandle_t s_lock;
+static StaticSemaphore_t s_lock_buffer;
+static uint32_t s_sector_num;
+static uint32_t s_sector;       //sector being written
+static uint32_t s_sector_seq;
+static uint32_t s_offset;       //next free byte in s_sector
+static stats_encoder_t s_encoder;
+static uint8_t s_batch[sizeof(log_batch_header_t) + LOG_BATCH_SIZE];
+static size_t s_batch_len;      //record bytes in s_batch
+static uint32_t s_batch_windows;
+static stats_decoder_t s_read_decoder;
+static stats_window_t s_read_window;
+
+static void log_sink_write(const stats_window_t *window, void *arg);
+
+static const esp_partition_t *find_partition(void) {
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+                                                                CONFIG_STATS_LOG_PARTITION_LABEL);
+    if (partition == NULL) {
+        ESP_LOGW(TAG, "no \"%s\" partition", CONFIG_STATS_LOG_PARTITION_LABEL);
+    } else if (partition->size < 2 * LOG_SECTOR_SIZE) {
+        ESP_LOGW(TAG, "\"%s\" partition is too small", CONFIG_STATS_LOG_PARTITION_LABEL);
+        partition = NULL;
+    }
+    return partition;
+}
+
+static uint32_t sector_header_crc(const log_sector_header_t *header) {
+    return esp_rom_crc32_le(0, (const uint8_t *)header, offsetof(log_sector_header_t, crc));
+}
+
+//Sequence number of the sector, or 0 if it has no valid header
+static uint32_t read_sector_seq(const esp_partition_t *partition, uint32_t sector) {
+    log_sector_header_t header;
+    if (esp_partition_read(partition, sector * LOG_SECTOR_SIZE, &header, sizeof(header)) != ESP_OK ||
+        header.magic != LOG_SECTOR_MAGIC || header.crc != sector_header_crc(&header)) {
+        return 0;
+    }
+    return header.seq;
+}
+
+//Check the batch at offset and read its records into buf. Returns the record length, or -1 at the end of the sector.
+static int read_batch(const esp_partition_t *partition, uint32_t sector, uint32_t offset, uint8_t *buf) {
+    log_batch_header_t header;
+    if (offset + sizeof(header) > LOG_SECTOR_SIZE ||
+        esp_partition_read(partition, sector * LOG_SECTOR_SIZE + offset, &header, sizeof(header)) != ESP_OK ||
+        header.magic != LOG_BATCH_MAGIC || header.len > LOG_BATCH_SIZE ||
+        offset + sizeof(header) + header.len > LOG_SECTOR_SIZE ||
+        esp_partition_read(partition, sector * LOG_SECTOR_SIZE + offset + sizeof(header), buf, header.len) != ESP_OK ||
+        esp_rom_crc32_le(0, buf, header.len) != header.crc) {
+        return -1;
+    }
+    return header.len;
+}
+
+static uint32_t batch_size(size_t len) {
+    return (sizeof(log_batch_header_t) + len + 3) & ~3;
+}
+
+static esp_err_t start_sector(uint32_t sector, uint32_t seq) {
+    esp_err_t ret = esp_partition_erase_range(s_partition, sector * LOG_SECTOR_SIZE, LOG_SECTOR_SIZE);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    log_sector_header_t header = { .magic = LOG_SECTOR_MAGIC, .seq = seq, .reserved = 0xffffffff };
+    header.crc = sector_header_crc(&header);
+    ret = esp_partition_write(s_partition, sector * LOG_SECTOR_SIZE, &header, sizeof(header));
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    s_sector = sector;
+    s_sector_seq = seq;
+    s_offset = sizeof(header);
+    return ESP_OK;
+}
+
+esp_err_t stats_log_init(void) {
+    s_partition = find_partition();
+    if (s_partition == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    s_lock = xSemaphoreCreateMutexStatic(&s_lock_buffer);
+    s_sector_num = s_partition->size / LOG_SECTOR_SIZE;
+
+    //Continue in the newest sector
+    uint32_t newest = 0, newest_seq = 0;
+    for (uint32_t i = 0; i < s_sector_num; i++) {
+        uint32_t seq = read_sector_seq(s_partition, i);
+        if (seq > newest_seq) {
+            newest = i;
+            newest_seq = seq;
+        }
+    }
+    esp_err_t ret;
+    if (newest_seq == 0) {
+        ret = start_sector(0, 1);
+    } else {
+        uint32_t offset = sizeof(log_sector_header_t);
+        int len;
+        while ((len = read_batch(s_partition, newest, offset, s_batch)) >= 0) {
+            offset += batch_size(len);
+        }
+        //Only append behind the last batch if nothing was written past it
+        uint16_t magic = 0;
+        if (offset + sizeof(magic) <= LOG_SECTOR_SIZE) {
+            esp_partition_read(s_partition, newest * LOG_SECTOR_SIZE + offset, &magic, sizeof(magic));
+        }
+        if (magic == 0xffff) {
+            s_sector = newest;
+            s_sector_seq = newest_seq;
+            s_offset = offset;
+            ret = ESP_OK;
+        } else {
+            ret = start_sector((newest + 1) % s_sector_num, newest_seq + 1);
+        }
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "cannot prepare the log partition (%d)", ret);
+        s_partition = NULL;
+        return ret;
+    }
+    stats_encoder_init(&s_encoder, UINT32_MAX);     //Only the first window of each batch is a keyframe
+    s_batch_len = 0;
+    s_batch_windows = 0;
+    ESP_LOGI(TAG, "logging to sector %" PRIu32 " of %" PRIu32, s_sector, s_sector_num);
+    stats_sink_t sink = { .write = log_sink_write };
+    return stats_sink_add(&sink);
+}
+
+static esp_err_t flush_batch(void) {
+    if (s_batch_len == 0) {
+        return ESP_OK;
+    }
+    uint32_t size = batch_size(s_batch_len);
+    esp_err_t ret = ESP_OK;
+    if (s_offset + size > LOG_SECTOR_SIZE) {
+        ret = start_sector((s_sector + 1) % s_sector_num, s_sector_seq + 1);
+    }
+    if (ret == ESP_OK) {
+        log_batch_header_t header = {
+            .magic = LOG_BATCH_MAGIC,
+            .len = s_batch_len,
+            .crc = esp_rom_crc32_le(0, s_batch + sizeof(header), s_batch_len),
+        };
+        memcpy(s_batch, &header, sizeof(header));
+        memset(s_batch + sizeof(header) + s_batch_len, 0xff, size - sizeof(header) - s_batch_len);
+        ret = esp_partition_write(s_partition, s_sector * LOG_SECTOR_SIZE + s_offset, s_batch, size);
+        s_offset += size;
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "%" PRIu32 " windows lost, flash write failed (%d)", s_batch_windows, ret);
+    }
+    s_batch_len = 0;
+    s_batch_windows = 0;
+    stats_encoder_force_keyframe(&s_encoder);
+    return ret;
+}
+
+static void log_sink_write(const stats_window_t *window, void *arg) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    size_t len;
+    esp_err_t ret = stats_encode_window(&s_encoder, window, s_batch + sizeof(log_batch_header_t) + s_batch_len,
+                                        LOG_BATCH_SIZE - s_batch_len, &len);
+    if (ret == ESP_ERR_INVALID_SIZE && s_batch_len > 0) {
+        //Batch full, start a new one
+        flush_batch();
+        ret = stats_encode_window(&s_encoder, window, s_batch + sizeof(log_batch_header_t), LOG_BATCH_SIZE, &len);
+    }
+    if (ret == ESP_OK) {
+        s_batch_len += len;
+        if (++s_batch_windows >= LOG_BATCH_WINDOWS) {
+            ret = flush_batch();
+        }
+    } else {
+        ESP_LOGE(TAG, "window %" PRIu32 " does not fit in CONFIG_STATS_LOG_BATCH_SIZE", window->seq);
+    }
+    xSemaphoreGive(s_lock);
+}
+
+esp_err_t stats_log_flush(void) {
+    if (s_partition == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    esp_err_t ret = flush_batch();
+    xSemaphoreGive(s_lock);
+    return ret;
+}
+
+//Reverse windows[begin..end), swapping through s_read_window
+static void reverse_windows(stats_window_t *windows, size_t begin, size_t end) {
+    for (; begin + 1 < end; begin++, end--) {
+        s_read_window = windows[begin];
+        windows[begin] = windows[end - 1];
+        windows[end - 1] = s_read_window;
+    }
+}
+
+esp_err_t stats_log_read_last(stats_window_t *windows, size_t num, size_t *read_num) {
+    const esp_partition_t *partition = s_partition != NULL ? s_partition : find_partition();
+    if (partition == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (s_lock != NULL) {
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+    }
+    uint8_t *buf = malloc(LOG_BATCH_SIZE);
+    if (buf == NULL) {
+        if (s_lock != NULL) {
+            xSemaphoreGive(s_lock);
+        }
+        return ESP_ERR_NO_MEM;
+    }
+
+    //The oldest sector follows the newest one in the ring
+    uint32_t sector_num = partition->size / LOG_SECTOR_SIZE;
+    uint32_t newest = 0, newest_seq = 0;
+    for (uint32_t i = 0; i < sector_num; i++) {
+        uint32_t seq = read_sector_seq(partition, i);
+        if (seq > newest_seq) {
+            newest = i;
+            newest_seq = seq;
+        }
+    }
+
+    //Decode every window, keeping the last num of them in windows as a ring
+    size_t count = 0;
+    for (uint32_t i = 1; i <= sector_num && num > 0; i++) {
+        uint32_t sector = (newest + i) % sector_num;
+        uint32_t seq = read_sector_seq(partition, sector);
+        if (seq == 0 || seq > newest_seq || newest_seq - seq >= sector_num) {
+            continue;   //Erased, or left over from an older layout
+        }
+        uint32_t offset = sizeof(log_sector_header_t);
+        int len;
+        while ((len = read_batch(partition, sector, offset, buf)) >= 0) {
+            offset += batch_size(len);
+            stats_decoder_init(&s_read_decoder);
+            size_t pos = 0, used;
+            while (pos < (size_t)len &&
+                   stats_decode_window(&s_read_decoder, buf + pos, len - pos, &s_read_window, &used) == ESP_OK) {
+                windows[count % num] = s_read_window;
+                count++;
+                pos += used;
+            }
+        }
+    }
+    free(buf);
+    if (s_lock != NULL) {
+        xSemaphoreGive(s_lock);
+    }
+
+    //Rotate the ring so that the oldest window comes first
+    *read_num = count < num ? count : num;
+    if (count > num && count % num != 0) {
+        reverse_windows(windows, 0, count % num);
+        reverse_windows(windows, count % num, num);
+        reverse_windows(windows, 0, num);
+    }
+    return ESP_OK;
+}
+
+#endif // STATS_ENABLED && CONFIG_STATS_LOG
@@ -0,0 +1,264 @@
+/* OpenMetrics text exposition of task and run time metrics
+
+   stats_metrics_render() writes, into the caller's buffer:
+
+     esp_task_run_time_total          counter, run time stats clock periods since the task was first seen
+     esp_task_cpu_percent             gauge, share of the CPU in the last window
+     esp_task_stack_free_min_bytes    gauge, lowest free stack seen
+     esp_heap_free_bytes, esp_heap_free_min_bytes
+     esp_run_time_seconds             histogram of the stats_run_time_t measurements
+     esp_run_time_self_seconds_total  counter, time outside nested measurements
+
+   Tasks come from the last window (stats_get_window), labelled with their
+   name, task id and core; tasks deleted in it are left out. Run time handles
+   are found through a registry of the live ones. Handles with the same name
+   are reported together, since OpenMetrics does not allow two samples with
+   the same labels.
+
+   Histogram buckets are fixed at powers of ten from 10 us to 10 s, counted
+   by stats_run_time_stop() into stats_run_time_t::buckets.
+*/
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include "string.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "stats_priv.h"
+
+#if STATS_ENABLED && CONFIG_STATS_METRICS
+
+#define METRICS_TIMER_NUM   CONFIG_STATS_METRICS_TIMER_NUM
+
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;                 //bytes the whole output needs, may be more than size
+} metrics_writer_t;
+
+static const char *TAG = "stats_metrics";
+static const char *const s_bucket_bounds[STATS_RUN_TIME_BUCKET_NUM] = {
+    "1e-05", "0.0001", "0.001", "0.01", "0.1", "1.0", "10.0", "+Inf",
+};
+static const char *const s_heap_names[STATS_HEAP_NUM] = { "internal", "dma", "spiram" };
+static stats_run_time_t *s_timers[METRICS_TIMER_NUM];
+static portMUX_TYPE s_timers_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool s_timers_full;
+//Rendering needs a window and two timers; too large for the caller's stack
+static SemaphoreHandle_t s_lock;
+static StaticSemaphore_t s_lock_buffer;
+static stats_window_t s_window;
+static stats_run_time_t s_timer, s_other;
+
+void stats_metrics_init(void) {
+    s_lock = xSemaphoreCreateMutexStatic(&s_lock_buffer);
+}
+
+void stats_metrics_register(stats_run_time_t *handler) {
+    bool added = false;
+    portENTER_CRITICAL(&s_timers_lock);
+    for (int i = 0; i < METRICS_TIMER_NUM && !added; i++) {
+        if (s_timers[i] == NULL) {
+            s_timers[i] = handler;
+            added = true;
+        }
+    }
+    bool warn = !added && !s_timers_full;
+    s_timers_full |= !added;
+    portEXIT_CRITICAL(&s_timers_lock);
+    if (warn) {
+        ESP_LOGW(TAG, "more than %d run time handles, increase CONFIG_STATS_METRICS_TIMER_NUM", METRICS_TIMER_NUM);
+    }
+}
+
+void stats_metrics_unregister(const stats_run_time_t *handler) {
+    portENTER_CRITICAL(&s_timers_lock);
+    for (int i = 0; i < METRICS_TIMER_NUM; i++) {
+        if (s_timers[i] == handler) {
+            s_timers[i] = NULL;
+        }
+    }
+    portEXIT_CRITICAL(&s_timers_lock);
+}
+
+//Copy a registered handle, so it can be freed while it is formatted
+static bool copy_timer(int i, stats_run_time_t *timer) {
+    portENTER_CRITICAL(&s_timers_lock);
+    bool found = s_timers[i] != NULL;
+    if (found) {
+        *timer = *s_timers[i];
+    }
+    portEXIT_CRITICAL(&s_timers_lock);
+    return found;
+}
+
+static void put(metrics_writer_t *writer, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    size_t room = writer->len < writer->size ? writer->size - writer->len : 0;
+    int len = vsnprintf(room > 0 ? writer->buf + writer->len : NULL, room, format, args);
+    va_end(args);
+    writer->len += len > 0 ? len : 0;
+}
+
+static void put_label_value(metrics_writer_t *writer, const char *value, size_t max_len) {
+    for (size_t i = 0; i < max_len && value[i] != '\0'; i++) {
+        switch (value[i]) {
+        case '\\': put(writer, "\\\\"); break;
+        case '"': put(writer, "\\\""); break;
+        case '\n': put(writer, "\\n"); break;
+        default: put(writer, "%c", value[i]); break;
+        }
+    }
+}
+
+static void put_family(metrics_writer_t *writer, const char *name, const char *type, const char *unit,
+                       const char *help) {
+    put(writer, "# TYPE %s %s\n", name, type);
+    if (unit != NULL) {
+        put(writer, "# UNIT %s %s\n", name, unit);
+    }
+    put(writer, "# HELP %s %s\n", name, help);
+}
+
+static void put_task_labels(metrics_writer_t *writer, const stats_task_sample_t *task) {
+    put(writer, "{task=\"");
+    put_label_value(writer, task->name, sizeof(task->name));
+    if (task->core == STATS_TASK_NO_AFFINITY) {
+        put(writer, "\",id=\"%" PRIu32 "\",core=\"any\"}", task->task_id);
+    } else {
+        put(writer, "\",id=\"%" PRIu32 "\",core=\"%d\"}", task->task_id, task->core);
+    }
+}
+
+static void put_timer_labels(metrics_writer_t *writer, const stats_run_time_t *timer, const char *le) {
+    put(writer, "{timer=\"");
+    put_label_value(writer, timer->name, sizeof(timer->name));
+    if (le != NULL) {
+        put(writer, "\",le=\"%s", le);
+    }
+    put(writer, "\"}");
+}
+
+static void put_seconds(metrics_writer_t *writer, int64_t us) {
+    put(writer, " %" PRId64 ".%06" PRId64 "\n", us / 1000000, us % 1000000);
+}
+
+static void put_tasks(metrics_writer_t *writer) {
+    if (stats_get_window(0, &s_window) != ESP_OK) {
+        return;
+    }
+    put_family(writer, "esp_task_run_time", "counter", NULL,
+               "Run time since the task was first seen, in run time stats clock periods.");
+    for (int i = 0; i < s_window.task_num; i++) {
+        const stats_task_sample_t *task = &s_window.tasks[i];
+        if (task->status != STATS_TASK_DELETED) {
+            put(writer, "esp_task_run_time_total");
+            put_task_labels(writer, task);
+            put(writer, " %" PRIu64 "\n", task->run_time_accumulated);
+        }
+    }
+    put_family(writer, "esp_task_cpu_percent", "gauge", NULL, "Share of the CPU in the last window.");
+    for (int i = 0; i < s_window.task_num; i++) {
+        const stats_task_sample_t *task = &s_window.tasks[i];
+        if (task->status != STATS_TASK_DELETED) {
+            put(writer, "esp_task_cpu_percent");
+            put_task_labels(writer, task);
+            put(writer, " %" PRIu32 "\n", task->percentage);
+        }
+    }
+    put_family(writer, "esp_task_stack_free_min_bytes", "gauge", "bytes", "Lowest free stack seen.");
+    for (int i = 0; i < s_window.task_num; i++) {
+        const stats_task_sample_t *task = &s_window.tasks[i];
+        if (task->status != STATS_TASK_DELETED) {
+            put(writer, "esp_task_stack_free_min_bytes");
+            put_task_labels(writer, task);
+            put(writer, " %" PRIu32 "\n", task->min_stack);
+        }
+    }
+
+    put_family(writer, "esp_heap_free_bytes", "gauge", "bytes", "Free heap at the end of the last window.");
+    for (int i = 0; i < STATS_HEAP_NUM; i++) {
+        if (s_window.heap[i].free_size > 0) {
+            put(writer, "esp_heap_free_bytes{heap=\"%s\"} %" PRIu32 "\n", s_heap_names[i], s_window.heap[i].free_size);
+        }
+    }
+    put_family(writer, "esp_heap_free_min_bytes", "gauge", "bytes", "Lowest free heap since boot.");
+    for (int i = 0; i < STATS_HEAP_NUM; i++) {
+        if (s_window.heap[i].free_size > 0) {
+            put(writer, "esp_heap_free_min_bytes{heap=\"%s\"} %" PRIu32 "\n", s_heap_names[i],
+                s_window.heap[i].min_free_size);
+        }
+    }
+}
+
+//Sum the handles named like handle first into s_timer; false if an earlier handle has the name
+static bool collect_timer(int first) {
+    if (!copy_timer(first, &s_timer)) {
+        return false;
+    }
+    for (int i = 0; i < METRICS_TIMER_NUM; i++) {
+        if (i == first || !copy_timer(i, &s_other) || strncmp(s_other.name, s_timer.name, sizeof(s_timer.name))) {
+            continue;
+        }
+        if (i < first) {
+            return false;
+        }
+        s_timer.time += s_other.time;
+        s_timer.self_time += s_other.self_time;
+        s_timer.count += s_other.count;
+        for (int b = 0; b < STATS_RUN_TIME_BUCKET_NUM; b++) {
+            s_timer.buckets[b] += s_other.buckets[b];
+        }
+    }
+    return true;
+}
+
+static void put_timers(metrics_writer_t *writer) {
+    put_family(writer, "esp_run_time_seconds", "histogram", "seconds", "Run time measurements.");
+    for (int i = 0; i < METRICS_TIMER_NUM; i++) {
+        if (!collect_timer(i)) {
+            continue;
+        }
+        uint32_t count = 0;
+        for (int b = 0; b < STATS_RUN_TIME_BUCKET_NUM; b++) {
+            count += s_timer.buckets[b];
+            put(writer, "esp_run_time_seconds_bucket");
+            put_timer_labels(writer, &s_timer, s_bucket_bounds[b]);
+            put(writer, " %" PRIu32 "\n", count);
+        }
+        put(writer, "esp_run_time_seconds_count");
+        put_timer_labels(writer, &s_timer, NULL);
+        put(writer, " %" PRIu32 "\n", count);
+        put(writer, "esp_run_time_seconds_sum");
+        put_timer_labels(writer, &s_timer, NULL);
+        put_seconds(writer, s_timer.time);
+    }
+    put_family(writer, "esp_run_time_self_seconds", "counter", "seconds",
+               "Measured time not spent in nested measurements of the same task.");
+    for (int i = 0; i < METRICS_TIMER_NUM; i++) {
+        if (collect_timer(i)) {
+            put(writer, "esp_run_time_self_seconds_total");
+            put_timer_labels(writer, &s_timer, NULL);
+            put_seconds(writer, s_timer.self_time);
+        }
+    }
+}
+
+esp_err_t stats_metrics_render(char *buf, size_t size, size_t *len) {
+    if (s_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    metrics_writer_t writer = { .buf = buf, .size = size };
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    put_tasks(&writer);
+    put_timers(&writer);
+    put(&writer, "# EOF\n");
+    xSemaphoreGive(s_lock);
+    *len = writer.len;
+    return writer.len < size ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+#endif // STATS_ENABLED && CONFIG_STATS_METRICS
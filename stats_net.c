@@ -0,0 +1,340 @@
+/* Streaming server for live dashboards
+
+   Sends every window, encoded with stats_encode.h, to the clients subscribed
+   over TCP or UDP on one port, and as JSON text (stats_json.h) to TCP clients
+   on the next port. The server is a sink (stats_sink.h): the sink task encodes
+   each window once, straight from the queued window into a batch buffer, and
+   sends the same batch to every client, so more clients cost one send each
+   and no copies. Nothing is encoded while nobody is subscribed.
+
+   TCP: the connection receives the plain record stream, as written to a file
+   by stats_sink_file_t. A client that cannot take a whole batch without
+   blocking is dropped, since a partly sent record would break its stream.
+
+   JSON: a TCP connection to the next port receives one line of JSON per
+   window. The text is produced once per window, a buffer at a time, and each
+   buffer is sent to every JSON client; a client that cannot take a whole
+   buffer is dropped, as it would be left with a broken line.
+
+   UDP: any datagram to the port subscribes its sender for
+   CONFIG_STATS_NET_UDP_LEASE_S seconds; sending another renews it. Each batch
+   is one datagram, a net_datagram_header_t followed by whole records. A gap in
+   the datagram numbers means records were lost, so the client must wait for
+   the next keyframe.
+
+   New clients are taken between batches, and make the next record a keyframe.
+   Sockets are non-blocking and polled from the sink task, so the server needs
+   no task of its own.
+*/
+
+#include "string.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "stats_priv.h"
+#include "stats_encode.h"
+#include "stats_json.h"
+#include "stats_sink.h"
+
+#if STATS_ENABLED && CONFIG_STATS_NET
+
+#define NET_CLIENT_NUM      CONFIG_STATS_NET_CLIENT_NUM
+#define NET_UDP_LEASE_TICKS pdMS_TO_TICKS(CONFIG_STATS_NET_UDP_LEASE_S * 1000)
+//A batch always has room for the largest record
+#define NET_BATCH_SIZE      (CONFIG_STATS_NET_BATCH_SIZE > STATS_ENCODE_SIZE_MAX ? \
+                             CONFIG_STATS_NET_BATCH_SIZE : STATS_ENCODE_SIZE_MAX)
+
+typedef struct {
+    uint32_t seq;               //datagrams sent since the server started, little endian
+} net_datagram_header_t;
+
+typedef struct {
+    struct sockaddr_in addr;
+    TickType_t renewed;
+    bool used;
+} net_subscriber_t;
+
+static const char *TAG = "stats_net";
+static SemaphoreHandle_t s_lock;
+static StaticSemaphore_t s_lock_buffer;
+static int s_listen_fd = -1;
+static int s_udp_fd = -1;
+static int s_clients[NET_CLIENT_NUM];
+static net_subscriber_t s_subscribers[NET_CLIENT_NUM];
+static int s_client_num;        //TCP clients and UDP subscribers
+static int s_json_listen_fd = -1;
+static int s_json_clients[NET_CLIENT_NUM];
+static int s_json_client_num;
+static uint32_t s_datagram_seq;
+static stats_encoder_t s_encoder;
+static uint8_t s_batch[NET_BATCH_SIZE];
+static size_t s_batch_len;
+static stats_json_t s_json;
+static char s_json_buf[NET_BATCH_SIZE];
+
+static int open_socket(int type, uint16_t port) {
+    int fd = socket(AF_INET, type, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        (type == SOCK_STREAM && listen(fd, NET_CLIENT_NUM) != 0) ||
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void close_client(int *clients, int *client_num, int i) {
+    close(clients[i]);
+    clients[i] = -1;
+    (*client_num)--;
+}
+
+static void send_batch(void) {
+    if (s_batch_len == 0) {
+        return;
+    }
+    for (int i = 0; i < NET_CLIENT_NUM; i++) {
+        if (s_clients[i] >= 0 && send(s_clients[i], s_batch, s_batch_len, MSG_DONTWAIT | MSG_NOSIGNAL) !=
+                                   (ssize_t)s_batch_len) {
+            ESP_LOGW(TAG, "client %d too slow or gone, dropped", i);
+            close_client(s_clients, &s_client_num, i);
+        }
+    }
+
+    //Header and records go out together without copying them into one buffer
+    net_datagram_header_t header = { .seq = s_datagram_seq++ };
+    struct iovec iov[2] = {
+        { .iov_base = &header, .iov_len = sizeof(header) },
+        { .iov_base = s_batch, .iov_len = s_batch_len },
+    };
+    for (int i = 0; i < NET_CLIENT_NUM; i++) {
+        if (s_subscribers[i].used) {
+            struct msghdr msg = {
+                .msg_name = &s_subscribers[i].addr,
+                .msg_namelen = sizeof(s_subscribers[i].addr),
+                .msg_iov = iov,
+                .msg_iovlen = 2,
+            };
+            sendmsg(s_udp_fd, &msg, MSG_DONTWAIT);
+        }
+    }
+    s_batch_len = 0;
+}
+
+//Send the window as one line of JSON, a buffer at a time, to every JSON client
+static void send_json(const stats_window_t *window) {
+    stats_json_window(&s_json, window);
+    bool last = false;
+    while (!last && s_json_client_num > 0) {
+        size_t len = stats_json_read(&s_json, s_json_buf, sizeof(s_json_buf) - 1);
+        if (len < sizeof(s_json_buf) - 1) {
+            s_json_buf[len++] = '\n';
+            last = true;
+        }
+        for (int i = 0; i < NET_CLIENT_NUM; i++) {
+            if (s_json_clients[i] >= 0 &&
+                send(s_json_clients[i], s_json_buf, len, MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t)len) {
+                ESP_LOGW(TAG, "JSON client %d too slow or gone, dropped", i);
+                close_client(s_json_clients, &s_json_client_num, i);
+            }
+        }
+    }
+}
+
+static bool accept_clients(int listen_fd, int *clients, int *client_num) {
+    bool joined = false;
+    int fd;
+    while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+        int i = 0;
+        for (; i < NET_CLIENT_NUM && clients[i] >= 0; i++) {
+        }
+        if (i == NET_CLIENT_NUM) {
+            ESP_LOGW(TAG, "no room for another client");
+            close(fd);
+            continue;
+        }
+        clients[i] = fd;
+        (*client_num)++;
+        joined = true;
+    }
+    return joined;
+}
+
+static bool subscribe(const struct sockaddr_in *addr) {
+    int free_slot = -1;
+    for (int i = 0; i < NET_CLIENT_NUM; i++) {
+        if (s_subscribers[i].used && s_subscribers[i].addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+            s_subscribers[i].addr.sin_port == addr->sin_port) {
+            s_subscribers[i].renewed = xTaskGetTickCount();
+            return false;
+        }
+        if (!s_subscribers[i].used && free_slot < 0) {
+            free_slot = i;
+        }
+    }
+    if (free_slot < 0) {
+        ESP_LOGW(TAG, "no room for another UDP subscriber");
+        return false;
+    }
+    s_subscribers[free_slot] = (net_subscriber_t) {
+        .addr = *addr,
+        .renewed = xTaskGetTickCount(),
+        .used = true,
+    };
+    s_client_num++;
+    return true;
+}
+
+static void poll_clients(void) {
+    //JSON lines stand alone, so JSON clients need no keyframe
+    accept_clients(s_json_listen_fd, s_json_clients, &s_json_client_num);
+    bool joined = accept_clients(s_listen_fd, s_clients, &s_client_num);
+
+    uint8_t byte;
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    while (recvfrom(s_udp_fd, &byte, sizeof(byte), MSG_DONTWAIT, (struct sockaddr *)&addr, &addr_len) >= 0) {
+        joined |= subscribe(&addr);
+        addr_len = sizeof(addr);
+    }
+    TickType_t now = xTaskGetTickCount();
+    for (int i = 0; i < NET_CLIENT_NUM; i++) {
+        if (s_subscribers[i].used && now - s_subscribers[i].renewed > NET_UDP_LEASE_TICKS) {
+            s_subscribers[i].used = false;
+            s_client_num--;
+        }
+    }
+
+    if (joined) {
+        //New clients can only start decoding at a keyframe
+        stats_encoder_force_keyframe(&s_encoder);
+    }
+}
+
+static void net_sink_write(const stats_window_t *window, void *arg) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_json_client_num > 0) {
+        send_json(window);
+    }
+    if (s_client_num == 0) {
+        stats_encoder_force_keyframe(&s_encoder);
+        xSemaphoreGive(s_lock);
+        return;
+    }
+    size_t len;
+    if (stats_encode_window(&s_encoder, window, s_batch + s_batch_len, sizeof(s_batch) - s_batch_len,
+                            &len) != ESP_OK) {
+        send_batch();
+        stats_encode_window(&s_encoder, window, s_batch, sizeof(s_batch), &len);
+    }
+    s_batch_len += len;
+    xSemaphoreGive(s_lock);
+}
+
+static void net_sink_flush(void *arg) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_listen_fd >= 0) {
+        send_batch();
+        poll_clients();
+    }
+    xSemaphoreGive(s_lock);
+}
+
+esp_err_t stats_net_start(uint16_t port) {
+    if (s_lock == NULL) {
+        s_lock = xSemaphoreCreateMutexStatic(&s_lock_buffer);
+    }
+    if (port == 0) {
+        port = CONFIG_STATS_NET_PORT;
+    }
+    if (port == UINT16_MAX) {
+        //No port after it for JSON
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_listen_fd >= 0) {
+        xSemaphoreGive(s_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_listen_fd = open_socket(SOCK_STREAM, port);
+    s_udp_fd = s_listen_fd >= 0 ? open_socket(SOCK_DGRAM, port) : -1;
+    s_json_listen_fd = s_udp_fd >= 0 ? open_socket(SOCK_STREAM, port + 1) : -1;
+    if (s_json_listen_fd < 0) {
+        ESP_LOGE(TAG, "cannot listen on ports %u and %u: errno %d", port, port + 1, errno);
+        if (s_listen_fd >= 0) {
+            close(s_listen_fd);
+            s_listen_fd = -1;
+        }
+        if (s_udp_fd >= 0) {
+            close(s_udp_fd);
+            s_udp_fd = -1;
+        }
+        xSemaphoreGive(s_lock);
+        return ESP_FAIL;
+    }
+    for (int i = 0; i < NET_CLIENT_NUM; i++) {
+        s_clients[i] = -1;
+        s_json_clients[i] = -1;
+        s_subscribers[i].used = false;
+    }
+    s_client_num = 0;
+    s_json_client_num = 0;
+    s_batch_len = 0;
+    stats_encoder_init(&s_encoder, CONFIG_STATS_NET_KEYFRAME_INTERVAL);
+    xSemaphoreGive(s_lock);
+
+    stats_sink_t sink = { .write = net_sink_write, .flush = net_sink_flush };
+    esp_err_t ret = stats_sink_add(&sink);
+    if (ret != ESP_OK) {
+        stats_net_stop();
+    }
+    return ret;
+}
+
+void stats_net_stop(void) {
+    if (s_lock == NULL) {
+        return;
+    }
+    stats_sink_t sink = { .write = net_sink_write, .flush = net_sink_flush };
+    stats_sink_remove(&sink);
+
+    //The sink task may still be in a batch that started before the removal
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < NET_CLIENT_NUM && s_listen_fd >= 0; i++) {
+        if (s_clients[i] >= 0) {
+            close_client(s_clients, &s_client_num, i);
+        }
+        if (s_json_clients[i] >= 0) {
+            close_client(s_json_clients, &s_json_client_num, i);
+        }
+    }
+    if (s_listen_fd >= 0) {
+        close(s_listen_fd);
+        close(s_udp_fd);
+        close(s_json_listen_fd);
+        s_listen_fd = -1;
+        s_udp_fd = -1;
+        s_json_listen_fd = -1;
+    }
+    s_client_num = 0;
+    s_json_client_num = 0;
+    xSemaphoreGive(s_lock);
+}
+
+#endif // STATS_ENABLED && CONFIG_STATS_NET
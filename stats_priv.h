@@ -0,0 +1,99 @@
+#pragma once
+
+//Internal interfaces shared between the stats_*.c files. Not part of the public API.
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "stats.h"
+
+#if STATS_ENABLED
+
+#ifndef STATS_SNAPSHOT_TASK_NUM
+#define STATS_SNAPSHOT_TASK_NUM CONFIG_STATS_SNAPSHOT_TASK_NUM
+#endif
+
+//Result of one uxTaskGetSystemState call
+typedef struct {
+    TaskStatus_t tasks[STATS_SNAPSHOT_TASK_NUM];
+    UBaseType_t task_num;
+    uint32_t run_time;
+} stats_snapshot_t;
+
+//The stages of one monitor pass, separate so the host benchmarks can time them
+esp_err_t stats_snapshot_take(stats_snapshot_t *snapshot);
+//Reorder both snapshots so that their first n entries are the same tasks, and return n
+UBaseType_t stats_snapshot_match(stats_snapshot_t *start, stats_snapshot_t *end);
+void stats_window_build(stats_window_t *window, const stats_snapshot_t *start, const stats_snapshot_t *end,
+                        UBaseType_t matched);
+//Rebuild state_count, inherited_num and starved_num from the matched rows
+void stats_window_count_states(stats_window_t *window);
+void stats_window_print(const stats_window_t *window);
+//Write the report stats_window_print prints to out instead, in one or more pieces of whole lines
+typedef void (*stats_text_out_t)(const char *text, size_t len, void *arg);
+void stats_window_format(const stats_window_t *window, stats_text_out_t out, void *arg);
+
+//One pass of the monitor task: measure over xTicksToWait, then report. Used by the host build.
+esp_err_t stats_monitor_run_once(TickType_t xTicksToWait);
+//Length of the window the monitor task measures next: CONFIG_STATS_PERIOD_MS, or the adaptive length
+TickType_t stats_monitor_next_ticks(void);
+void stats_detect_window(const stats_window_t *window);
+//Log the event and pass it to the handler set with stats_set_event_handler
+void stats_event_raise(const stats_event_t *event);
+
+//Queue a finished window for the sinks, and emit the queued ones from the sink task
+void stats_sink_init(void);
+esp_err_t stats_sink_submit(const stats_window_t *window);
+//As stats_sink_submit, waiting up to xTicksToWait instead of CONFIG_STATS_SINK_WAIT_MS
+esp_err_t stats_sink_submit_wait(const stats_window_t *window, TickType_t xTicksToWait);
+void stats_sink_process(TickType_t xTicksToWait);
+
+#if CONFIG_STATS_RUN_TIME_NESTING
+void stats_zone_push(stats_run_time_t *handler);
+int64_t stats_zone_pop(stats_run_time_t *handler, int64_t elapsed);
+void stats_zone_forget(const stats_run_time_t *handler);
+#endif
+
+#if CONFIG_STATS_BLACKBOX
+void stats_blackbox_init(void);
+void stats_blackbox_record(const stats_window_t *window);
+#endif
+
+#if CONFIG_STATS_LOG
+esp_err_t stats_log_init(void);
+#endif
+
+#if CONFIG_STATS_METRICS
+void stats_metrics_init(void);
+//Keep track of the live run time handles for stats_metrics_render
+void stats_metrics_register(stats_run_time_t *handler);
+void stats_metrics_unregister(const stats_run_time_t *handler);
+#endif
+
+#if CONFIG_STATS_QUOTA
+//Enforce the quotas on a finished window; its matched rows are the first entries of end
+void stats_quota_window(const stats_window_t *window, const stats_snapshot_t *end);
+#endif
+
+#if CONFIG_STATS_ADAPTIVE
+//Length of the window after this one, which was ticks long
+TickType_t stats_adapt_next(const stats_window_t *window, TickType_t ticks);
+#endif
+
+#if CONFIG_STATS_PROFILER
+#define STATS_PROFILER_DEPTH    CONFIG_STATS_PROFILER_DEPTH     //PCs kept per sample
+//Store a sample taken by the sampling interrupt of core: the interrupted PC, then return addresses
+void stats_profiler_record(int core, TaskHandle_t task, const uintptr_t *pcs, int depth);
+//Sampling interrupt on every core, from stats_profiler_port.c (host/fake_profiler.c on the host)
+esp_err_t stats_profiler_port_start(uint32_t hz);
+void stats_profiler_port_stop(void);
+//Address the image holding the sampled code is loaded at, 0 unless it is position independent
+uintptr_t stats_profiler_port_base(void);
+//Print a stats_profile,M line for each code region outside the image, for grouping unresolved samples
+void stats_profiler_port_dump_modules(void);
+#endif
+
+#if CONFIG_STATS_TRACE_EVENTS
+void stats_trace_record(const stats_run_time_t *handler, char type, int64_t timestamp);
+#endif
+
+#endif // STATS_ENABLED
@@ -0,0 +1,162 @@
+/* Statistical PC sampling profiler
+
+   A periodic interrupt on every core (a SIGPROF timer on the host) takes the
+   PC it interrupted, and optionally a few callers, and stores them with the
+   running task into that core's ring. Only the interrupt of a core writes to
+   its ring, so recording takes no lock. stats_profiler_dump() pauses
+   recording, waits for samples being stored on other cores, and prints the
+   rings as text; tools/stats_profile.py symbolises them against the ELF and writes
+   flat or folded (flame graph) profiles.
+
+   The sampling interrupt itself is in stats_profiler_port.c, and in
+   host/fake_profiler.c for the host build.
+*/
+
+#include <inttypes.h>
+#include "string.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "stats_priv.h"
+
+#if STATS_ENABLED && CONFIG_STATS_PROFILER
+
+#define PROFILER_SAMPLE_NUM     CONFIG_STATS_PROFILER_SAMPLE_NUM
+#define PROFILER_FORMAT_VER     1
+
+typedef struct {
+    uintptr_t task;
+    uintptr_t pcs[STATS_PROFILER_DEPTH];    //interrupted PC, then return addresses
+    uint8_t depth;                          //0 while the slot is being written
+} profiler_sample_t;
+
+typedef struct {
+    uint32_t head;      //total number of samples ever taken
+    profiler_sample_t samples[PROFILER_SAMPLE_NUM];
+} profiler_ring_t;
+
+static const char *TAG = "stats_profiler";
+static profiler_ring_t s_profiler_rings[portNUM_PROCESSORS];
+static bool s_profiler_enabled;
+static uint32_t s_profiler_recording;  //stats_profiler_record calls past the enabled check
+static uint32_t s_profiler_hz;
+
+void IRAM_ATTR stats_profiler_record(int core, TaskHandle_t task, const uintptr_t *pcs, int depth) {
+    //Counted before the check, so a dump that cleared the flag sees the count or stops this store
+    __atomic_add_fetch(&s_profiler_recording, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&s_profiler_enabled, __ATOMIC_SEQ_CST) || depth <= 0) {
+        __atomic_sub_fetch(&s_profiler_recording, 1, __ATOMIC_RELEASE);
+        return;
+    }
+    profiler_ring_t *ring = &s_profiler_rings[core];
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    profiler_sample_t *sample = &ring->samples[head % PROFILER_SAMPLE_NUM];
+    sample->depth = 0;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    sample->task = (uintptr_t)task;
+    for (int i = 0; i < depth && i < STATS_PROFILER_DEPTH; i++) {
+        sample->pcs[i] = pcs[i];
+    }
+    __atomic_store_n(&sample->depth, depth < STATS_PROFILER_DEPTH ? depth : STATS_PROFILER_DEPTH,
+                     __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    __atomic_sub_fetch(&s_profiler_recording, 1, __ATOMIC_RELEASE);
+}
+
+esp_err_t stats_profiler_start(uint32_t hz) {
+    if (hz == 0) {
+        hz = CONFIG_STATS_PROFILER_HZ;
+    }
+    if (s_profiler_hz != 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t ret = stats_profiler_port_start(hz);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "cannot start sampling at %" PRIu32 " Hz (%d)", hz, ret);
+        return ret;
+    }
+    s_profiler_hz = hz;
+    __atomic_store_n(&s_profiler_enabled, true, __ATOMIC_RELAXED);
+    return ESP_OK;
+}
+
+void stats_profiler_stop(void) {
+    if (s_profiler_hz == 0) {
+        return;
+    }
+    __atomic_store_n(&s_profiler_enabled, false, __ATOMIC_RELAXED);
+    stats_profiler_port_stop();
+    s_profiler_hz = 0;
+}
+
+static void dump_task_names(void) {
+    UBaseType_t array_size = uxTaskGetNumberOfTasks() + 5;
+    TaskStatus_t *array = malloc(sizeof(TaskStatus_t) * array_size);
+    if (array == NULL) {
+        ESP_LOGE(TAG, "no memory for task names");
+        return;
+    }
+    array_size = uxTaskGetSystemState(array, array_size, NULL);
+    for (UBaseType_t i = 0; i < array_size; i++) {
+        printf("stats_profile,T,%lx,%s\n", (unsigned long)(uintptr_t)array[i].xHandle, array[i].pcTaskName);
+    }
+    free(array);
+}
+
+/**
+ * @brief   Print the samples, oldest first, and clear the rings.
+ *
+ * Output lines are prefixed with "stats_profile," so they can be picked out of
+ * a console log:
+ *  - stats_profile,V,<format version>
+ *  - stats_profile,H,<sampling rate in Hz>
+ *  - stats_profile,B,<load address>                          to subtract before symbolising
+ *  - stats_profile,M,<start>,<end>,<name>                    code outside the ELF, e.g. ROM
+ *  - stats_profile,T,<task id>,<task name>                   live tasks only
+ *  - stats_profile,S,<core>,<task id>,<pc>[,<return address>...]
+ *  - stats_profile,D,<core>,<dropped samples>                ring wrapped
+ *
+ * Addresses are hex. Recording is paused while dumping; sampling goes on if
+ * the profiler is running. A sample being stored when the dump starts is
+ * waited for, so it cannot land in a ring after it was cleared.
+ */
+void stats_profiler_dump(void) {
+    bool enabled = __atomic_exchange_n(&s_profiler_enabled, false, __ATOMIC_SEQ_CST);
+    //The interrupts on other cores finish their store within a few microseconds
+    while (__atomic_load_n(&s_profiler_recording, __ATOMIC_SEQ_CST) != 0) {
+    }
+    printf("stats_profile,V,%d\n", PROFILER_FORMAT_VER);
+    printf("stats_profile,H,%" PRIu32 "\n", s_profiler_hz != 0 ? s_profiler_hz : (uint32_t)CONFIG_STATS_PROFILER_HZ);
+    printf("stats_profile,B,%lx\n", (unsigned long)stats_profiler_port_base());
+    stats_profiler_port_dump_modules();
+    dump_task_names();
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        profiler_ring_t *ring = &s_profiler_rings[core];
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint32_t count = head < PROFILER_SAMPLE_NUM ? head : PROFILER_SAMPLE_NUM;
+        if (head > PROFILER_SAMPLE_NUM) {
+            printf("stats_profile,D,%d,%" PRIu32 "\n", core, head - PROFILER_SAMPLE_NUM);
+        }
+        for (uint32_t n = head - count; n != head; n++) {
+            const profiler_sample_t *sample = &ring->samples[n % PROFILER_SAMPLE_NUM];
+            uint8_t depth = __atomic_load_n(&sample->depth, __ATOMIC_ACQUIRE);
+            if (depth == 0) {
+                continue;
+            }
+            printf("stats_profile,S,%d,%lx", core, (unsigned long)sample->task);
+            for (int i = 0; i < depth; i++) {
+                printf(",%lx", (unsigned long)sample->pcs[i]);
+            }
+            printf("\n");
+        }
+        __atomic_store_n(&ring->head, 0, __ATOMIC_RELAXED);
+        for (int i = 0; i < PROFILER_SAMPLE_NUM; i++) {
+            ring->samples[i].depth = 0;
+        }
+    }
+    __atomic_store_n(&s_profiler_enabled, enabled, __ATOMIC_SEQ_CST);
+}
+
+#endif // STATS_ENABLED && CONFIG_STATS_PROFILER
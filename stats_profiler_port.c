@@ -0,0 +1,173 @@
+/* Sampling interrupt of the profiler on ESP-IDF targets
+
+   One GPTimer per core, its level 3 interrupt allocated on that core through
+   esp_ipc, so every alarm samples the core it fires on.
+
+   Xtensa: the interrupted PC is in EPC3, which the window exceptions taken
+   while the handler runs do not touch (they use EPC1). Interrupt entry saves
+   the task's registers in a frame on its stack and points the task's
+   pxTopOfStack at it; the callers are walked from that frame when its PC is
+   the sampled one, that is when no other interrupt handler was interrupted.
+
+   RISC-V: the interrupted PC is in mepc, which nested interrupts restore
+   before they return. Without frame pointers the callers cannot be found
+   cheaply, so only the PC is recorded.
+
+   The host build uses host/fake_profiler.c instead.
+*/
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "esp_idf_version.h"
+#include "soc/soc.h"
+#include "stats_priv.h"
+
+#if STATS_ENABLED && CONFIG_STATS_PROFILER
+
+//GPTimer takes an interrupt priority from 5.1 on
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+
+#include "driver/gptimer.h"
+#include "esp_ipc.h"
+#if CONFIG_IDF_TARGET_ARCH_XTENSA
+#include "xtensa_context.h"
+#include "esp_debug_helpers.h"
+#endif
+
+#define SAMPLE_INTR_PRIORITY    3       //EPC3 on Xtensa
+#define SAMPLE_TIMER_HZ         1000000
+
+typedef struct {
+    uint32_t hz;
+    esp_err_t ret;
+} timer_setup_t;
+
+static gptimer_handle_t s_timers[portNUM_PROCESSORS];
+
+#if CONFIG_IDF_TARGET_ARCH_XTENSA
+//Return addresses keep the caller's window size in the top bits
+static inline uintptr_t IRAM_ATTR stack_pc(uint32_t pc) {
+    return (pc & 0x3fffffff) | 0x40000000;
+}
+#endif
+
+static bool IRAM_ATTR sample_on_alarm(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata, void *arg) {
+    int core = xPortGetCoreID();
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    uintptr_t pcs[STATS_PROFILER_DEPTH];
+    int depth = 1;
+#if CONFIG_IDF_TARGET_ARCH_XTENSA
+    uint32_t pc;
+    __asm__ __volatile__("rsr.epc3 %0" : "=a"(pc));
+    pcs[0] = pc;
+#if STATS_PROFILER_DEPTH > 1
+    const XtExcFrame *frame = (task != NULL) ? *(XtExcFrame *const *)task : NULL;
+    if (frame != NULL && frame->pc == pc) {
+        esp_backtrace_frame_t stack = { .pc = frame->pc, .sp = frame->a1, .next_pc = frame->a0 };
+        while (depth < STATS_PROFILER_DEPTH && stack.next_pc != 0 && esp_backtrace_get_next_frame(&stack)) {
+            pcs[depth++] = stack_pc(stack.pc);
+        }
+    }
+#endif
+#else
+    uintptr_t pc;
+    __asm__ __volatile__("csrr %0, mepc" : "=r"(pc));
+    pcs[0] = pc;
+#endif
+    stats_profiler_record(core, task, pcs, depth);
+    return false;
+}
+
+//Run on each core, so the timer's interrupt is allocated there
+static void timer_start_on_core(void *arg) {
+    timer_setup_t *setup = arg;
+    int core = xPortGetCoreID();
+    gptimer_config_t config = {
+        .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+        .direction = GPTIMER_COUNT_UP,
+        .resolution_hz = SAMPLE_TIMER_HZ,
+        .intr_priority = SAMPLE_INTR_PRIORITY,
+    };
+    gptimer_alarm_config_t alarm = {
+        .alarm_count = SAMPLE_TIMER_HZ / setup->hz,
+        .reload_count = 0,
+        .flags.auto_reload_on_alarm = true,
+    };
+    gptimer_event_callbacks_t callbacks = {
+        .on_alarm = sample_on_alarm,
+    };
+    setup->ret = gptimer_new_timer(&config, &s_timers[core]);
+    if (setup->ret != ESP_OK) {
+        return;
+    }
+    setup->ret = gptimer_set_alarm_action(s_timers[core], &alarm);
+    if (setup->ret == ESP_OK) {
+        setup->ret = gptimer_register_event_callbacks(s_timers[core], &callbacks, NULL);
+    }
+    if (setup->ret == ESP_OK) {
+        setup->ret = gptimer_enable(s_timers[core]);
+    }
+    if (setup->ret == ESP_OK) {
+        setup->ret = gptimer_start(s_timers[core]);
+    }
+}
+
+//Also on the timer's core, which its interrupt must be freed from
+static void timer_stop_on_core(void *arg) {
+    int core = xPortGetCoreID();
+    if (s_timers[core] == NULL) {
+        return;
+    }
+    gptimer_stop(s_timers[core]);
+    gptimer_disable(s_timers[core]);
+    gptimer_del_timer(s_timers[core]);
+    s_timers[core] = NULL;
+}
+
+esp_err_t stats_profiler_port_start(uint32_t hz) {
+    if (hz == 0 || hz > SAMPLE_TIMER_HZ / 10) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        timer_setup_t setup = { .hz = hz, .ret = ESP_OK };
+        esp_err_t ret = esp_ipc_call_blocking(core, timer_start_on_core, &setup);
+        if (ret == ESP_OK) {
+            ret = setup.ret;
+        }
+        if (ret != ESP_OK) {
+            stats_profiler_port_stop();
+            return ret;
+        }
+    }
+    return ESP_OK;
+}
+
+void stats_profiler_port_stop(void) {
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        esp_ipc_call_blocking(core, timer_stop_on_core, NULL);
+    }
+}
+
+#else // ESP_IDF_VERSION
+
+esp_err_t stats_profiler_port_start(uint32_t hz) {
+    (void)hz;
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void stats_profiler_port_stop(void) {}
+
+#endif // ESP_IDF_VERSION
+
+uintptr_t stats_profiler_port_base(void) {
+    return 0;
+}
+
+//The application is one image; only the mask ROM's code is outside it
+void stats_profiler_port_dump_modules(void) {
+    printf("stats_profile,M,%lx,%lx,rom\n", (unsigned long)SOC_IROM_MASK_LOW, (unsigned long)SOC_IROM_MASK_HIGH);
+}
+
+#endif // STATS_ENABLED && CONFIG_STATS_PROFILER
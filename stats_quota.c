@@ -0,0 +1,235 @@
+/* Per-task CPU quotas
+
+   Runs on every finished window, after the detectors. A task's use of the
+   window is its run time over the window length, in percent of one core, so a
+   task pinned to one core can use up to 100. Quotas are looked up by task
+   name; the action is taken on the handle the window's end snapshot has for
+   the task, and a priority or suspension is only restored through a handle
+   seen again in a later window, never one that may have been deleted.
+*/
+
+#include <inttypes.h>
+#include "string.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "stats_priv.h"
+
+#if STATS_ENABLED && CONFIG_STATS_QUOTA
+
+#define QUOTA_NUM       CONFIG_STATS_QUOTA_NUM
+#define PRIORITY_MIN    1   //Lowered priorities stay above the idle tasks
+
+typedef struct {
+    bool used;
+    bool released;                  //cleared; restore and free on the next window
+    char task_name[16];
+    uint32_t percent;
+    uint32_t windows;
+    stats_quota_action_t action;
+    TaskHandle_t task;              //task with a lowered priority or suspended, NULL if none
+    bool suspended;
+    UBaseType_t base_priority;      //priority to restore
+    uint32_t over;                  //consecutive windows over the budget
+    uint32_t under;                 //consecutive windows within it while task is set
+} quota_t;
+
+typedef struct {
+    const stats_task_sample_t *task;
+    uint32_t windows;
+} overrun_t;
+
+static const char *TAG = "stats_quota";
+static quota_t s_quotas[QUOTA_NUM];
+static SemaphoreHandle_t s_lock;    //created by the first stats_quota_set
+
+static quota_t *find_quota(const char *task_name) {
+    for (int i = 0; i < QUOTA_NUM; i++) {
+        if (s_quotas[i].used && strncmp(s_quotas[i].task_name, task_name, sizeof(s_quotas[i].task_name)) == 0) {
+            return &s_quotas[i];
+        }
+    }
+    return NULL;
+}
+
+//The lock, created on first use; two tasks setting their first quota at once create it once
+static SemaphoreHandle_t get_lock(void) {
+    SemaphoreHandle_t lock = __atomic_load_n(&s_lock, __ATOMIC_ACQUIRE);
+    if (lock != NULL) {
+        return lock;
+    }
+    lock = xSemaphoreCreateMutex();
+    if (lock == NULL) {
+        return NULL;
+    }
+    SemaphoreHandle_t expected = NULL;
+    if (!__atomic_compare_exchange_n(&s_lock, &expected, lock, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        //Another task created the lock first, use that one
+        vSemaphoreDelete(lock);
+        return expected;
+    }
+    return lock;
+}
+
+esp_err_t stats_quota_set(const char *task_name, uint32_t percent, uint32_t windows, stats_quota_action_t action) {
+    if (task_name == NULL || percent == 0 || percent > 100 || windows == 0 || action > STATS_QUOTA_SUSPEND) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    SemaphoreHandle_t lock = get_lock();
+    if (lock == NULL) {
+        ESP_LOGE(TAG, "no memory for the quota lock");
+        return ESP_ERR_NO_MEM;
+    }
+    xSemaphoreTake(lock, portMAX_DELAY);
+    quota_t *quota = find_quota(task_name);
+    for (int i = 0; i < QUOTA_NUM && quota == NULL; i++) {
+        if (!s_quotas[i].used) {
+            quota = &s_quotas[i];
+            memset(quota, 0, sizeof(*quota));
+            quota->used = true;
+            strncpy(quota->task_name, task_name, sizeof(quota->task_name) - 1);
+        }
+    }
+    if (quota == NULL) {
+        xSemaphoreGive(lock);
+        ESP_LOGE(TAG, "no room for the quota of %s", task_name);
+        return ESP_ERR_NO_MEM;
+    }
+    //A task still lowered or suspended by the old quota is restored by the new one
+    quota->released = false;
+    quota->percent = percent;
+    quota->windows = windows;
+    quota->action = action;
+    xSemaphoreGive(lock);
+    return ESP_OK;
+}
+
+esp_err_t stats_quota_clear(const char *task_name) {
+    SemaphoreHandle_t lock = __atomic_load_n(&s_lock, __ATOMIC_ACQUIRE);
+    if (lock == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    xSemaphoreTake(lock, portMAX_DELAY);
+    quota_t *quota = find_quota(task_name);
+    if (quota != NULL) {
+        quota->released = true;
+    }
+    xSemaphoreGive(lock);
+    return quota != NULL ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+static void restore(quota_t *quota) {
+    if (quota->suspended) {
+        vTaskResume(quota->task);
+        ESP_LOGI(TAG, "resumed %s", quota->task_name);
+    } else {
+        vTaskPrioritySet(quota->task, quota->base_priority);
+        ESP_LOGI(TAG, "restored %s to priority %u", quota->task_name, (unsigned)quota->base_priority);
+    }
+    quota->task = NULL;
+    quota->suspended = false;
+    quota->under = 0;
+}
+
+static void enforce(quota_t *quota, const stats_task_sample_t *sample, TaskHandle_t task) {
+    switch (quota->action) {
+    case STATS_QUOTA_NOTIFY:
+        xTaskNotify(task, STATS_QUOTA_NOTIFY_BIT, eSetBits);
+        break;
+    case STATS_QUOTA_LOWER_PRIORITY:
+        if (quota->task == NULL) {
+            quota->task = task;
+            quota->base_priority = sample->base_priority;
+        }
+        if (!quota->suspended && sample->base_priority > PRIORITY_MIN) {
+            vTaskPrioritySet(task, sample->base_priority - 1);
+        }
+        break;
+    case STATS_QUOTA_SUSPEND:
+        //The monitor must keep running to resume it
+        if (task == xTaskGetCurrentTaskHandle()) {
+            ESP_LOGE(TAG, "cannot suspend the monitor task");
+            break;
+        }
+        if (quota->task == NULL) {
+            quota->task = task;
+            quota->base_priority = sample->base_priority;
+        }
+        quota->suspended = true;
+        vTaskSuspend(task);
+        break;
+    }
+    quota->under = 0;
+}
+
+void stats_quota_window(const stats_window_t *window, const stats_snapshot_t *end) {
+    overrun_t overruns[QUOTA_NUM];
+    int overrun_num = 0;
+    SemaphoreHandle_t lock = __atomic_load_n(&s_lock, __ATOMIC_ACQUIRE);
+    if (lock == NULL || window->elapsed == 0) {
+        return;
+    }
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (int q = 0; q < QUOTA_NUM; q++) {
+        quota_t *quota = &s_quotas[q];
+        if (!quota->used) {
+            continue;
+        }
+        //Matched rows come first, in the order of the end snapshot
+        const stats_task_sample_t *sample = NULL;
+        TaskHandle_t task = NULL;
+        for (int i = 0; i < window->task_num && window->tasks[i].status == STATS_TASK_MATCHED; i++) {
+            if (strncmp(window->tasks[i].name, quota->task_name, sizeof(quota->task_name)) == 0) {
+                sample = &window->tasks[i];
+                task = end->tasks[i].xHandle;
+                break;
+            }
+        }
+        if (quota->task != NULL && quota->task != task) {
+            //Deleted, or replaced by another task of the same name
+            quota->task = NULL;
+            quota->suspended = false;
+        }
+        if (quota->released) {
+            if (quota->task != NULL) {
+                restore(quota);
+            }
+            quota->used = false;
+            continue;
+        }
+        if (sample == NULL) {
+            quota->over = 0;
+            continue;
+        }
+        uint32_t percent = (uint64_t)sample->run_time * 100 / window->elapsed;
+        if (percent > quota->percent) {
+            quota->over++;
+            if (quota->over % quota->windows == 0) {
+                enforce(quota, sample, task);
+                overruns[overrun_num].task = sample;
+                overruns[overrun_num].windows = quota->over;
+                overrun_num++;
+            }
+        } else {
+            quota->over = 0;
+            if (quota->task != NULL && ++quota->under >= quota->windows) {
+                restore(quota);
+            }
+        }
+    }
+    xSemaphoreGive(lock);
+    //Outside the lock, so the handler may change quotas
+    for (int i = 0; i < overrun_num; i++) {
+        stats_event_t event = {
+            .type = STATS_EVENT_QUOTA_OVERRUN,
+            .seq = window->seq,
+            .task = overruns[i].task,
+            .other = NULL,
+            .windows = overruns[i].windows,
+        };
+        stats_event_raise(&event);
+    }
+}
+
+#endif // STATS_ENABLED && CONFIG_STATS_QUOTA
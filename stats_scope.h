@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdbool.h>
+#include "stats.h"
+
+//Scope based run time measurement.
+//
+//  void handler(void) {
+//      STATS_RUN_TIME_SCOPE("handler");
+//      ...   //every return path stops the timer
+//  }
+//
+//The handle behind STATS_RUN_TIME_SCOPE is a function local static created on
+//first use, so each call site costs one stats_run_time_init per program run.
+//C uses the GCC cleanup attribute, C++ uses stats::run_time_scope.
+//
+//The handle is shared by every entry into the scope. When the function recurses,
+//or two tasks are in it at once, only the outermost (or first) entry measures;
+//the others neither start nor stop the timer.
+
+#define STATS_SCOPE_CONCAT_(a, b) a##b
+#define STATS_SCOPE_CONCAT(a, b) STATS_SCOPE_CONCAT_(a, b)
+
+#if STATS_ENABLED
+
+//Return *slot, creating the handle on the first call. Safe against concurrent first calls.
+static inline stats_run_time_t *stats_run_time_get_static(stats_run_time_t **slot, const char *name) {
+    stats_run_time_t *handler = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    return handler != NULL ? handler : stats_run_time_init_once(slot, name);
+}
+
+#ifdef __cplusplus
+
+namespace stats {
+
+template <bool (*Start)(stats_run_time_t *), void (*Stop)(stats_run_time_t *)>
+class basic_run_time_scope {
+public:
+    explicit basic_run_time_scope(stats_run_time_t *handler) : m_handler(Start(handler) ? handler : nullptr) {}
+    ~basic_run_time_scope() {
+        if (m_handler != nullptr) {
+            Stop(m_handler);
+        }
+    }
+
+    basic_run_time_scope(const basic_run_time_scope &) = delete;
+    basic_run_time_scope &operator=(const basic_run_time_scope &) = delete;
+
+private:
+    stats_run_time_t *m_handler;    //nullptr unless this scope started the timer
+};
+
+using run_time_scope = basic_run_time_scope<stats_run_time_try_start, stats_run_time_stop>;
+
+} // namespace stats
+
+#define STATS_RUN_TIME_SCOPE(name) \
+    static stats_run_time_t *STATS_SCOPE_CONCAT(s_stats_run_time_, __LINE__); \
+    stats::run_time_scope STATS_SCOPE_CONCAT(stats_run_time_scope_, __LINE__)( \
+        stats_run_time_get_static(&STATS_SCOPE_CONCAT(s_stats_run_time_, __LINE__), name))
+
+#else // __cplusplus
+
+//Return the handle if this scope started it, NULL otherwise
+static inline stats_run_time_t *stats_run_time_scope_begin(stats_run_time_t *handler) {
+    return stats_run_time_try_start(handler) ? handler : NULL;
+}
+
+static inline void stats_run_time_scope_end(stats_run_time_t **handler) {
+    if (*handler != NULL) {
+        stats_run_time_stop(*handler);
+    }
+}
+
+#define STATS_RUN_TIME_SCOPE(name) \
+    static stats_run_time_t *STATS_SCOPE_CONCAT(s_stats_run_time_, __LINE__); \
+    stats_run_time_t *STATS_SCOPE_CONCAT(stats_run_time_scope_, __LINE__) \
+        __attribute__((cleanup(stats_run_time_scope_end), unused)) = \
+        stats_run_time_scope_begin(stats_run_time_get_static(&STATS_SCOPE_CONCAT(s_stats_run_time_, __LINE__), name))
+
+#endif // __cplusplus
+
+#else // STATS_ENABLED
+
+#define STATS_RUN_TIME_SCOPE(name) do { (void)(name); } while (0)
+
+#endif // STATS_ENABLED
@@ -0,0 +1,280 @@
+/* Sink queue and the built-in sinks
+
+   The queue is a ring of window copies with one writer (the monitor task) and
+   one reader (the sink task), so it needs no lock: each side only moves its
+   own index, and a slot is reused only after the sink task has moved past it.
+*/
+
+#include <inttypes.h>
+#include "string.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "stats_priv.h"
+#include "stats_sink.h"
+
+#if STATS_ENABLED
+
+#define SINK_NUM            CONFIG_STATS_SINK_NUM
+#define SINK_QUEUE_LEN      CONFIG_STATS_SINK_QUEUE_LEN
+#define SINK_WAIT_TICKS     pdMS_TO_TICKS(CONFIG_STATS_SINK_WAIT_MS)
+#define SINK_TASK_PRIO      CONFIG_STATS_SINK_TASK_PRIORITY
+#define SINK_TASK_STACK     CONFIG_STATS_SINK_TASK_STACK_SIZE
+
+static const char *TAG = "stats_sink";
+static stats_sink_t s_sinks[SINK_NUM];
+static portMUX_TYPE s_sinks_lock = portMUX_INITIALIZER_UNLOCKED;
+static stats_window_t s_queue[SINK_QUEUE_LEN];
+static uint32_t s_queue_head;       //windows queued, moved by the monitor task
+static uint32_t s_queue_tail;       //windows emitted, moved by the sink task
+static uint32_t s_dropped;
+static uint32_t s_batch_gen;        //odd while the sink task emits a batch
+static TaskHandle_t s_sink_task;
+
+static void console_write(const stats_window_t *window, void *arg) {
+    printf("\n\nWindow %" PRIu32 "\n", window->seq);
+    stats_window_print(window);
+}
+
+static void console_flush(void *arg) {
+    fflush(stdout);
+}
+
+const stats_sink_t stats_sink_console = {
+    .write = console_write,
+    .flush = console_flush,
+};
+
+esp_err_t stats_sink_add(const stats_sink_t *sink) {
+    esp_err_t ret = ESP_ERR_NO_MEM;
+    portENTER_CRITICAL(&s_sinks_lock);
+    for (int i = 0; i < SINK_NUM; i++) {
+        if (s_sinks[i].write == NULL) {
+            s_sinks[i] = *sink;
+            ret = ESP_OK;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&s_sinks_lock);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "no room for another sink, increase CONFIG_STATS_SINK_NUM");
+    }
+    return ret;
+}
+
+esp_err_t stats_sink_remove(const stats_sink_t *sink) {
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    portENTER_CRITICAL(&s_sinks_lock);
+    for (int i = 0; i < SINK_NUM; i++) {
+        if (s_sinks[i].write == sink->write && s_sinks[i].arg == sink->arg) {
+            s_sinks[i] = (stats_sink_t) { 0 };
+            ret = ESP_OK;
+            break;
+        }
+    }
+    uint32_t gen = s_batch_gen;
+    portEXIT_CRITICAL(&s_sinks_lock);
+    //A batch that started before the removal may still use the sink; wait for it to end, unless
+    //this is the sink task itself, removing a sink from one of its callbacks
+    if (ret == ESP_OK && (gen & 1) && xTaskGetCurrentTaskHandle() != s_sink_task) {
+        while (__atomic_load_n(&s_batch_gen, __ATOMIC_ACQUIRE) == gen) {
+            vTaskDelay(1);
+        }
+    }
+    return ret;
+}
+
+uint32_t stats_sink_dropped(void) {
+    return __atomic_load_n(&s_dropped, __ATOMIC_RELAXED);
+}
+
+esp_err_t stats_sink_submit(const stats_window_t *window) {
+    return stats_sink_submit_wait(window, SINK_WAIT_TICKS);
+}
+
+esp_err_t stats_sink_submit_wait(const stats_window_t *window, TickType_t xTicksToWait) {
+    uint32_t head = s_queue_head;
+    //Wait for the sink task to make room, then give up on this window
+    TickType_t waited = 0;
+    while (head - __atomic_load_n(&s_queue_tail, __ATOMIC_ACQUIRE) == SINK_QUEUE_LEN) {
+        if (waited == xTicksToWait) {
+            __atomic_add_fetch(&s_dropped, 1, __ATOMIC_RELAXED);
+            return ESP_ERR_TIMEOUT;
+        }
+        vTaskDelay(1);
+        waited++;
+    }
+    s_queue[head % SINK_QUEUE_LEN] = *window;
+    __atomic_store_n(&s_queue_head, head + 1, __ATOMIC_RELEASE);
+    if (s_sink_task != NULL) {
+        xTaskNotifyGive(s_sink_task);
+    }
+    return ESP_OK;
+}
+
+void stats_sink_process(TickType_t xTicksToWait) {
+    uint32_t tail = s_queue_tail;
+    if (__atomic_load_n(&s_queue_head, __ATOMIC_ACQUIRE) == tail) {
+        ulTaskNotifyTake(pdTRUE, xTicksToWait);
+    }
+    uint32_t head = __atomic_load_n(&s_queue_head, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+        return;
+    }
+
+    //Emit everything queued as one batch, to the sinks there were when it started
+    stats_sink_t sinks[SINK_NUM];
+    portENTER_CRITICAL(&s_sinks_lock);
+    s_batch_gen++;
+    memcpy(sinks, s_sinks, sizeof(sinks));
+    portEXIT_CRITICAL(&s_sinks_lock);
+    for (; tail != head; tail++) {
+        for (int i = 0; i < SINK_NUM; i++) {
+            if (sinks[i].write != NULL) {
+                sinks[i].write(&s_queue[tail % SINK_QUEUE_LEN], sinks[i].arg);
+            }
+        }
+        //The slot can be reused as soon as every sink is done with it
+        __atomic_store_n(&s_queue_tail, tail + 1, __ATOMIC_RELEASE);
+    }
+    for (int i = 0; i < SINK_NUM; i++) {
+        if (sinks[i].write != NULL && sinks[i].flush != NULL) {
+            sinks[i].flush(sinks[i].arg);
+        }
+    }
+    //Sinks removed during the batch may be freed from here on
+    __atomic_add_fetch(&s_batch_gen, 1, __ATOMIC_RELEASE);
+}
+
+static void sink_task(void *arg) {
+    while (1) {
+        stats_sink_process(portMAX_DELAY);
+    }
+}
+
+void stats_sink_init(void) {
+#if CONFIG_STATS_SINK_CONSOLE
+    stats_sink_add(&stats_sink_console);
+#endif
+    xTaskCreatePinnedToCore(sink_task, "stats_sink", SINK_TASK_STACK, NULL, SINK_TASK_PRIO, &s_sink_task,
+                            tskNO_AFFINITY);
+}
+
+static void file_write(const stats_window_t *window, void *arg) {
+    stats_sink_file_t *ctx = arg;
+    size_t len;
+    if (stats_encode_window(&ctx->encoder, window, ctx->record, sizeof(ctx->record), &len) != ESP_OK) {
+        return;
+    }
+    if (fwrite(ctx->record, 1, len, ctx->file) != len) {
+        //The reader lost part of the stream; let it start again at a keyframe
+        clearerr(ctx->file);
+        ctx->dropped++;
+        stats_encoder_force_keyframe(&ctx->encoder);
+    }
+}
+
+static void file_flush(void *arg) {
+    stats_sink_file_t *ctx = arg;
+    fflush(ctx->file);
+}
+
+void stats_sink_file_init(stats_sink_file_t *ctx, FILE *file, uint32_t keyframe_interval, stats_sink_t *sink) {
+    ctx->file = file;
+    ctx->dropped = 0;
+    stats_encoder_init(&ctx->encoder, keyframe_interval);
+    *sink = (stats_sink_t) {
+        .write = file_write,
+        .flush = file_flush,
+        .arg = ctx,
+    };
+}
+
+static esp_err_t json_fwrite(const char *data, size_t len, void *arg) {
+    return fwrite(data, 1, len, arg) == len ? ESP_OK : ESP_FAIL;
+}
+
+static void json_write(const stats_window_t *window, void *arg) {
+    stats_sink_json_t *ctx = arg;
+    stats_json_window(&ctx->json, window);
+    if (stats_json_write(&ctx->json, json_fwrite, ctx->file) != ESP_OK || fputc('\n', ctx->file) == EOF) {
+        clearerr(ctx->file);
+        ctx->dropped++;
+    }
+}
+
+static void json_flush(void *arg) {
+    stats_sink_json_t *ctx = arg;
+    fflush(ctx->file);
+}
+
+void stats_sink_json_init(stats_sink_json_t *ctx, FILE *file, stats_sink_t *sink) {
+    ctx->file = file;
+    ctx->dropped = 0;
+    *sink = (stats_sink_t) {
+        .write = json_write,
+        .flush = json_flush,
+        .arg = ctx,
+    };
+}
+
+static void ring_write(const stats_window_t *window, void *arg) {
+    stats_sink_ring_t *ctx = arg;
+    size_t len;
+    if (stats_encode_window(&ctx->encoder, window, ctx->record, sizeof(ctx->record), &len) != ESP_OK) {
+        return;
+    }
+    size_t head = ctx->head;
+    if (ctx->size - (head - __atomic_load_n(&ctx->tail, __ATOMIC_ACQUIRE)) < len) {
+        ctx->dropped++;
+        stats_encoder_force_keyframe(&ctx->encoder);
+        return;
+    }
+    for (size_t i = 0; i < len; i++) {
+        ctx->buf[(head + i) % ctx->size] = ctx->record[i];
+    }
+    __atomic_store_n(&ctx->head, head + len, __ATOMIC_RELEASE);
+}
+
+void stats_sink_ring_init(stats_sink_ring_t *ctx, uint8_t *buf, size_t size, uint32_t keyframe_interval,
+                          stats_sink_t *sink) {
+    ctx->buf = buf;
+    ctx->size = size;
+    ctx->head = 0;
+    ctx->tail = 0;
+    ctx->dropped = 0;
+    stats_encoder_init(&ctx->encoder, keyframe_interval);
+    *sink = (stats_sink_t) {
+        .write = ring_write,
+        .arg = ctx,
+    };
+}
+
+size_t stats_sink_ring_read(stats_sink_ring_t *ctx, uint8_t *dst, size_t size) {
+    size_t head = __atomic_load_n(&ctx->head, __ATOMIC_ACQUIRE);
+    size_t tail = ctx->tail;
+    size_t copied = 0;
+    while (tail != head) {
+        //Records start with their body length as a varint
+        size_t body_len = 0, prefix_len = 0;
+        uint8_t byte;
+        do {
+            byte = ctx->buf[(tail + prefix_len) % ctx->size];
+            body_len |= (size_t)(byte & 0x7f) << (7 * prefix_len);
+            prefix_len++;
+        } while (byte & 0x80);
+        size_t len = prefix_len + body_len;
+        if (copied + len > size) {
+            break;
+        }
+        for (size_t i = 0; i < len; i++) {
+            dst[copied + i] = ctx->buf[(tail + i) % ctx->size];
+        }
+        copied += len;
+        tail += len;
+    }
+    __atomic_store_n(&ctx->tail, tail, __ATOMIC_RELEASE);
+    return copied;
+}
+
+#endif // STATS_ENABLED
@@ -0,0 +1,92 @@
+#pragma once
+
+//Outputs for the monitor's windows.
+//
+//The monitor task only queues each finished window. A lower priority sink task
+//takes everything queued, hands each window to every sink's write function and
+//then calls the sinks' flush functions once for the batch, so slow output
+//never delays the measurements. When the queue is full the monitor waits up to
+//CONFIG_STATS_SINK_WAIT_MS for room and then drops the window; dropped windows
+//are counted by stats_sink_dropped().
+//
+//A sink is a pair of functions, so a user callback is just a stats_sink_t.
+//Built in: the text report on the console, encoded records or JSON lines on a
+//FILE (a file, or a UART through its VFS path, e.g. "/dev/uart/1"), and encoded
+//records in a ring buffer that another task reads.
+
+#include <stdio.h>
+#include "stats.h"
+#include "stats_encode.h"
+#include "stats_json.h"
+
+typedef struct {
+    //Called from the sink task for each window of a batch
+    void (*write)(const stats_window_t *window, void *arg);
+    //Called after the last window of a batch; may be NULL
+    void (*flush)(void *arg);
+    void *arg;
+} stats_sink_t;
+
+//Encoded records written to a FILE
+typedef struct {
+    FILE *file;
+    stats_encoder_t encoder;
+    uint8_t record[STATS_ENCODE_SIZE_MAX];
+    uint32_t dropped;           //records that could not be written
+} stats_sink_file_t;
+
+//One line of JSON (stats_json.h) per window written to a FILE
+typedef struct {
+    FILE *file;
+    stats_json_t json;
+    uint32_t dropped;           //windows that could not be written
+} stats_sink_json_t;
+
+//Encoded records kept in a byte ring until stats_sink_ring_read takes them.
+//Lock free for one reading task.
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t head;                //bytes ever written
+    size_t tail;                //bytes ever read
+    stats_encoder_t encoder;
+    uint8_t record[STATS_ENCODE_SIZE_MAX];
+    uint32_t dropped;           //records that did not fit
+} stats_sink_ring_t;
+
+#if STATS_ENABLED
+
+extern const stats_sink_t stats_sink_console;
+
+//Sinks are copied; remove one by passing the same write function and arg. Once stats_sink_remove
+//returns, the sink is not called again and its arg may be freed; it waits for a batch in progress
+//to finish, except when called from a sink's own callback.
+esp_err_t stats_sink_add(const stats_sink_t *sink);
+esp_err_t stats_sink_remove(const stats_sink_t *sink);
+uint32_t stats_sink_dropped(void);
+
+//Fill *sink with a sink writing encoded records to file. A keyframe follows every failed write.
+void stats_sink_file_init(stats_sink_file_t *ctx, FILE *file, uint32_t keyframe_interval, stats_sink_t *sink);
+
+//Fill *sink with a sink writing a JSON line per window to file
+void stats_sink_json_init(stats_sink_json_t *ctx, FILE *file, stats_sink_t *sink);
+
+//Fill *sink with a sink keeping encoded records in buf. A keyframe follows every dropped record.
+void stats_sink_ring_init(stats_sink_ring_t *ctx, uint8_t *buf, size_t size, uint32_t keyframe_interval,
+                          stats_sink_t *sink);
+//Copy out as many whole records as fit in dst, and return their length
+size_t stats_sink_ring_read(stats_sink_ring_t *ctx, uint8_t *dst, size_t size);
+
+#else // STATS_ENABLED
+
+static const stats_sink_t stats_sink_console = { 0 };
+
+static inline esp_err_t stats_sink_add(const stats_sink_t *sink) { (void)sink; return ESP_OK; }
+static inline esp_err_t stats_sink_remove(const stats_sink_t *sink) { (void)sink; return ESP_OK; }
+static inline uint32_t stats_sink_dropped(void) { return 0; }
+static inline void stats_sink_file_init(stats_sink_file_t *ctx, FILE *file, uint32_t keyframe_interval, stats_sink_t *sink) { (void)ctx; (void)file; (void)keyframe_interval; *sink = (stats_sink_t) { 0 }; }
+static inline void stats_sink_json_init(stats_sink_json_t *ctx, FILE *file, stats_sink_t *sink) { (void)ctx; (void)file; *sink = (stats_sink_t) { 0 }; }
+static inline void stats_sink_ring_init(stats_sink_ring_t *ctx, uint8_t *buf, size_t size, uint32_t keyframe_interval, stats_sink_t *sink) { (void)ctx; (void)buf; (void)size; (void)keyframe_interval; *sink = (stats_sink_t) { 0 }; }
+static inline size_t stats_sink_ring_read(stats_sink_ring_t *ctx, uint8_t *dst, size_t size) { (void)ctx; (void)dst; (void)size; return 0; }
+
+#endif // STATS_ENABLED
@@ -0,0 +1,118 @@
+/* Run time event trace
+
+   Records a begin and an end event for every stats_run_time_start/stop pair
+   into a preallocated ring per core. stats_trace_dump() prints the rings as
+   text; tools/stats_trace_to_json.py turns that into Chrome trace event JSON
+   for chrome://tracing or Perfetto.
+*/
+
+#include <inttypes.h>
+#include "string.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "stats_priv.h"
+
+#if STATS_ENABLED && CONFIG_STATS_TRACE_EVENTS
+
+#define TRACE_EVENT_NUM     CONFIG_STATS_TRACE_EVENT_NUM
+#define TRACE_FORMAT_VER    1
+
+typedef struct {
+    int64_t timestamp;
+    uintptr_t task;
+    char name[sizeof(((stats_run_time_t *)0)->name)];
+    char type;          //'B' or 'E', 0 while the slot is being written
+} trace_event_t;
+
+typedef struct {
+    uint32_t head;      //total number of events ever claimed
+    trace_event_t events[TRACE_EVENT_NUM];
+} trace_ring_t;
+
+static const char *TAG = "stats_trace";
+static trace_ring_t s_trace_rings[portNUM_PROCESSORS];
+static bool s_trace_enabled = true;
+
+void stats_trace_record(const stats_run_time_t *handler, char type, int64_t timestamp) {
+    if (!__atomic_load_n(&s_trace_enabled, __ATOMIC_RELAXED)) {
+        return;
+    }
+    //Tasks on the same core may preempt each other, so claim the slot atomically
+    trace_ring_t *ring = &s_trace_rings[xPortGetCoreID()];
+    uint32_t idx = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED) % TRACE_EVENT_NUM;
+    trace_event_t *event = &ring->events[idx];
+    event->type = 0;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    event->timestamp = timestamp;
+    event->task = (uintptr_t)xTaskGetCurrentTaskHandle();
+    memcpy(event->name, handler->name, sizeof(event->name));
+    __atomic_store_n(&event->type, type, __ATOMIC_RELEASE);
+}
+
+void stats_trace_enable(bool enable) {
+    __atomic_store_n(&s_trace_enabled, enable, __ATOMIC_RELAXED);
+}
+
+void stats_trace_clear(void) {
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        __atomic_store_n(&s_trace_rings[core].head, 0, __ATOMIC_RELAXED);
+        for (int i = 0; i < TRACE_EVENT_NUM; i++) {
+            s_trace_rings[core].events[i].type = 0;
+        }
+    }
+}
+
+static void dump_task_names(void) {
+    UBaseType_t array_size = uxTaskGetNumberOfTasks() + 5;
+    TaskStatus_t *array = malloc(sizeof(TaskStatus_t) * array_size);
+    if (array == NULL) {
+        ESP_LOGE(TAG, "no memory for task names");
+        return;
+    }
+    array_size = uxTaskGetSystemState(array, array_size, NULL);
+    for (UBaseType_t i = 0; i < array_size; i++) {
+        printf("stats_trace,T,%lx,%s\n", (unsigned long)(uintptr_t)array[i].xHandle, array[i].pcTaskName);
+    }
+    free(array);
+}
+
+/**
+ * @brief   Print the recorded events, oldest first, and clear the rings.
+ *
+ * Output lines are prefixed with "stats_trace," so they can be picked out of a
+ * console log:
+ *  - stats_trace,V,<format version>
+ *  - stats_trace,T,<task id>,<task name>                    live tasks only
+ *  - stats_trace,E,<core>,<task id>,<B|E>,<time us>,<zone>
+ *  - stats_trace,D,<core>,<dropped events>                  ring wrapped
+ *
+ * Recording is paused while dumping.
+ */
+void stats_trace_dump(void) {
+    bool enabled = __atomic_exchange_n(&s_trace_enabled, false, __ATOMIC_RELAXED);
+    printf("stats_trace,V,%d\n", TRACE_FORMAT_VER);
+    dump_task_names();
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        trace_ring_t *ring = &s_trace_rings[core];
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint32_t count = head < TRACE_EVENT_NUM ? head : TRACE_EVENT_NUM;
+        if (head > TRACE_EVENT_NUM) {
+            printf("stats_trace,D,%d,%" PRIu32 "\n", core, head - TRACE_EVENT_NUM);
+        }
+        for (uint32_t n = head - count; n != head; n++) {
+            const trace_event_t *event = &ring->events[n % TRACE_EVENT_NUM];
+            char type = __atomic_load_n(&event->type, __ATOMIC_ACQUIRE);
+            if (type == 0) {
+                continue;
+            }
+            printf("stats_trace,E,%d,%lx,%c,%" PRId64 ",%.*s\n", core, (unsigned long)event->task, type,
+                   event->timestamp, (int)sizeof(event->name), event->name);
+        }
+    }
+    stats_trace_clear();
+    stats_trace_enable(enabled);
+}
+
+#endif // STATS_ENABLED && CONFIG_STATS_TRACE_EVENTS
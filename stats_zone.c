@@ -0,0 +1,230 @@
+/* Nested run time measurements
+
+   Every task that calls stats_run_time_start keeps a stack of the measurements
+   it has open. On stop, the elapsed time is added to the inclusive time of the
+   innermost zone and to the child time of its parent, which gives each zone its
+   exclusive (self) time. Zones are also recorded as a call tree so the same
+   handle reached through different callers is reported separately.
+
+   The stacks come from a static pool of ZONE_STACK_NUM, claimed by a task on
+   its first measurement and returned when it is deleted, so the measurement
+   path never allocates.
+*/
+
+#include <inttypes.h>
+#include "string.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "stats_priv.h"
+
+#if STATS_ENABLED && CONFIG_STATS_RUN_TIME_NESTING
+
+#define ZONE_DEPTH          CONFIG_STATS_ZONE_DEPTH
+#define ZONE_NODE_NUM       CONFIG_STATS_ZONE_NODE_NUM
+#define ZONE_STACK_NUM      CONFIG_STATS_ZONE_STACK_NUM
+#define ZONE_TLS_INDEX      CONFIG_STATS_ZONE_TLS_INDEX
+#define ZONE_NODE_NONE      (-1)
+#define ZONE_COPY_CHUNK     8   //nodes copied per critical section when printing
+
+typedef struct {
+    stats_run_time_t *handler;
+    int16_t node;
+    int64_t child_time;
+} zone_frame_t;
+
+typedef struct {
+    bool used;                  //claimed by a task
+    uint8_t depth;
+    zone_frame_t frames[ZONE_DEPTH];
+} zone_stack_t;
+
+typedef struct {
+    const stats_run_time_t *handler;    //NULL once the handle has been freed
+    char name[sizeof(((stats_run_time_t *)0)->name)];
+    int16_t parent;
+    int16_t first_child;
+    int16_t next_sibling;
+    uint32_t count;
+    int64_t inclusive;
+    int64_t exclusive;
+} zone_node_t;
+
+static const char *TAG = "stats_zone";
+static portMUX_TYPE s_zone_lock = portMUX_INITIALIZER_UNLOCKED;
+static zone_node_t s_zone_nodes[ZONE_NODE_NUM];
+static int16_t s_zone_node_used;
+static int16_t s_zone_first_root = ZONE_NODE_NONE;
+static zone_stack_t s_zone_stacks[ZONE_STACK_NUM];
+
+static void zone_stack_delete_cb(int index, void *stack) {
+    __atomic_store_n(&((zone_stack_t *)stack)->used, false, __ATOMIC_RELEASE);
+}
+
+static zone_stack_t *get_zone_stack(void) {
+    zone_stack_t *stack = pvTaskGetThreadLocalStoragePointer(NULL, ZONE_TLS_INDEX);
+    if (stack != NULL) {
+        return stack;
+    }
+    for (int i = 0; i < ZONE_STACK_NUM; i++) {
+        bool used = false;
+        if (__atomic_compare_exchange_n(&s_zone_stacks[i].used, &used, true, false, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED)) {
+            stack = &s_zone_stacks[i];
+            stack->depth = 0;
+            vTaskSetThreadLocalStoragePointerAndDelCallback(NULL, ZONE_TLS_INDEX, stack, zone_stack_delete_cb);
+            return stack;
+        }
+    }
+    ESP_LOGE(TAG, "no zone stack left, raise CONFIG_STATS_ZONE_STACK_NUM");
+    return NULL;
+}
+
+//Find or create the child of parent for handler. Called with s_zone_lock held.
+static int16_t get_zone_node(int16_t parent, const stats_run_time_t *handler) {
+    int16_t *link = (parent == ZONE_NODE_NONE) ? &s_zone_first_root : &s_zone_nodes[parent].first_child;
+    for (int16_t i = *link; i != ZONE_NODE_NONE; i = s_zone_nodes[i].next_sibling) {
+        if (s_zone_nodes[i].handler == handler) {
+            return i;
+        }
+    }
+    if (s_zone_node_used >= ZONE_NODE_NUM) {
+        return ZONE_NODE_NONE;
+    }
+    int16_t idx = s_zone_node_used++;
+    zone_node_t *node = &s_zone_nodes[idx];
+    node->handler = handler;
+    memcpy(node->name, handler->name, sizeof(node->name));
+    node->parent = parent;
+    node->first_child = ZONE_NODE_NONE;
+    node->next_sibling = *link;
+    node->count = 0;
+    node->inclusive = 0;
+    node->exclusive = 0;
+    *link = idx;
+    return idx;
+}
+
+void stats_zone_push(stats_run_time_t *handler) {
+    zone_stack_t *stack = get_zone_stack();
+    if (stack == NULL) {
+        return;
+    }
+    if (stack->depth >= ZONE_DEPTH) {
+        ESP_LOGE(TAG, "zone stack is full: %s", handler->name);
+        return;
+    }
+    //Zones nested below a node that did not fit stay out of the tree as well
+    int16_t parent = (stack->depth > 0) ? stack->frames[stack->depth - 1].node : ZONE_NODE_NONE;
+    int16_t node = ZONE_NODE_NONE;
+    if (stack->depth == 0 || parent != ZONE_NODE_NONE) {
+        portENTER_CRITICAL(&s_zone_lock);
+        node = get_zone_node(parent, handler);
+        portEXIT_CRITICAL(&s_zone_lock);
+        if (node == ZONE_NODE_NONE) {
+            ESP_LOGE(TAG, "error: zone node buffer is full");
+        }
+    }
+    zone_frame_t *frame = &stack->frames[stack->depth++];
+    frame->handler = handler;
+    frame->node = node;
+    frame->child_time = 0;
+}
+
+int64_t stats_zone_pop(stats_run_time_t *handler, int64_t elapsed) {
+    zone_stack_t *stack = pvTaskGetThreadLocalStoragePointer(NULL, ZONE_TLS_INDEX);
+    if (stack == NULL) {
+        return 0;
+    }
+    //Find the frame; zones opened after it and never closed are dropped
+    int depth = stack->depth;
+    while (depth > 0 && stack->frames[depth - 1].handler != handler) {
+        depth--;
+    }
+    if (depth == 0) {
+        //Started on another task or pushed while the stack was full
+        return 0;
+    }
+    if (depth != stack->depth) {
+        ESP_LOGE(TAG, "zone %s stopped while inner zones are open", handler->name);
+    }
+    zone_frame_t *frame = &stack->frames[depth - 1];
+    int64_t child_time = frame->child_time;
+    stack->depth = depth - 1;
+    if (stack->depth > 0) {
+        stack->frames[stack->depth - 1].child_time += elapsed;
+    }
+    if (frame->node != ZONE_NODE_NONE) {
+        portENTER_CRITICAL(&s_zone_lock);
+        zone_node_t *node = &s_zone_nodes[frame->node];
+        node->count++;
+        node->inclusive += elapsed;
+        node->exclusive += elapsed - child_time;
+        portEXIT_CRITICAL(&s_zone_lock);
+    }
+    return child_time;
+}
+
+void stats_zone_forget(const stats_run_time_t *handler) {
+    portENTER_CRITICAL(&s_zone_lock);
+    for (int i = 0; i < s_zone_node_used; i++) {
+        if (s_zone_nodes[i].handler == handler) {
+            s_zone_nodes[i].handler = NULL;
+        }
+    }
+    portEXIT_CRITICAL(&s_zone_lock);
+}
+
+void stats_run_time_print_tree(void) {
+    //Copy the tree so printing does not hold the lock, a few nodes per critical section so
+    //measurements on other cores are not held up for the whole copy. Nodes are only added, and
+    //only ever linked in at the head of a list, so every link copied points to a node that is
+    //copied too; nodes added while copying may be left out. The root is read with the last chunk.
+    static zone_node_t nodes[ZONE_NODE_NUM];
+    int16_t copied = 0;
+    int16_t used;
+    int16_t first_root;
+    do {
+        portENTER_CRITICAL(&s_zone_lock);
+        used = s_zone_node_used;
+        first_root = s_zone_first_root;
+        int16_t num = used - copied < ZONE_COPY_CHUNK ? used - copied : ZONE_COPY_CHUNK;
+        memcpy(&nodes[copied], &s_zone_nodes[copied], sizeof(zone_node_t) * num);
+        portEXIT_CRITICAL(&s_zone_lock);
+        copied += num;
+    } while (copied < used);
+
+    printf("| Zone | Calls | Inclusive | Exclusive\n");
+    printf("| --- | --- | --- | ---\n");
+    //Depth first walk, the tree is never deeper than a zone stack
+    int16_t path[ZONE_DEPTH];
+    int depth = 0;
+    int16_t idx = first_root;
+    while (idx != ZONE_NODE_NONE || depth > 0) {
+        if (idx == ZONE_NODE_NONE) {
+            idx = nodes[path[--depth]].next_sibling;
+            continue;
+        }
+        printf("| %*s%s | %" PRIu32 " | %" PRId64 " | %" PRId64 "\n", depth * 2, "", nodes[idx].name,
+               nodes[idx].count, nodes[idx].inclusive, nodes[idx].exclusive);
+        if (nodes[idx].first_child != ZONE_NODE_NONE && depth < ZONE_DEPTH) {
+            path[depth++] = idx;
+            idx = nodes[idx].first_child;
+        } else {
+            idx = nodes[idx].next_sibling;
+        }
+    }
+}
+
+void stats_run_time_reset_tree(void) {
+    //Open zones on other tasks still point at the nodes, so only clear the counters
+    portENTER_CRITICAL(&s_zone_lock);
+    for (int i = 0; i < s_zone_node_used; i++) {
+        s_zone_nodes[i].count = 0;
+        s_zone_nodes[i].inclusive = 0;
+        s_zone_nodes[i].exclusive = 0;
+    }
+    portEXIT_CRITICAL(&s_zone_lock);
+}
+
+#endif // STATS_ENABLED && CONFIG_STATS_RUN_TIME_NESTING
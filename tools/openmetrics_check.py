@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+"""Check stats_metrics_render() output against the OpenMetrics text format.
+
+Usage: openmetrics_check.py [exposition.txt]
+
+Reads stdin without a file. Uses the parser of prometheus_client when it is
+installed; otherwise checks the subset of the format the renderer writes:
+metadata before samples, sample names belonging to their family, escaped label
+values, no repeated label sets, cumulative histogram buckets ending in +Inf
+and equal to _count, and the closing "# EOF". Exits with 1 on the first error.
+"""
+
+import argparse
+import math
+import re
+import sys
+
+NAME = r'[a-zA-Z_:][a-zA-Z0-9_:]*'
+METADATA = re.compile(r'^# (TYPE|UNIT|HELP) (' + NAME + r') ?(.*)$')
+SAMPLE = re.compile(r'^(' + NAME + r')(\{(.*)\})? (\S+)$')
+LABEL = re.compile(r'([a-zA-Z_][a-zA-Z0-9_]*)="((?:[^"\\\n]|\\[\\"n])*)"(,|$)')
+TYPES = ('counter', 'gauge', 'histogram', 'summary', 'info', 'stateset', 'gaugehistogram', 'unknown')
+SUFFIXES = {
+    'counter': ('_total', '_created'),
+    'gauge': ('',),
+    'histogram': ('_bucket', '_count', '_sum', '_created'),
+}
+
+
+class CheckError(Exception):
+    pass
+
+
+def parse_labels(text, line_no):
+    labels = {}
+    pos = 0
+    while pos < len(text):
+        match = LABEL.match(text, pos)
+        if match is None:
+            raise CheckError(f'line {line_no}: bad labels "{text}"')
+        if match.group(1) in labels:
+            raise CheckError(f'line {line_no}: label {match.group(1)} repeated')
+        labels[match.group(1)] = match.group(2)
+        pos = match.end()
+    return labels
+
+
+def parse_value(text, line_no):
+    if text in ('+Inf', '-Inf', 'NaN'):
+        return float(text)
+    try:
+        return float(text)
+    except ValueError:
+        raise CheckError(f'line {line_no}: bad value "{text}"') from None
+
+
+def check_histogram(family, samples):
+    series = {}
+    for name, labels, value, line_no in samples:
+        key = tuple(sorted((k, v) for k, v in labels.items() if k != 'le'))
+        entry = series.setdefault(key, {'buckets': [], 'count': None})
+        if name == family + '_bucket':
+            if 'le' not in labels:
+                raise CheckError(f'line {line_no}: bucket without le')
+            entry['buckets'].append((parse_value(labels['le'], line_no), value, line_no))
+        elif name == family + '_count':
+            entry['count'] = value
+    for entry in series.values():
+        buckets = entry['buckets']
+        if not buckets or not math.isinf(buckets[-1][0]):
+            raise CheckError(f'{family}: buckets do not end with le="+Inf"')
+        for (bound, value, line_no), (prev_bound, prev_value, _) in zip(buckets[1:], buckets):
+            if bound <= prev_bound or value < prev_value:
+                raise CheckError(f'line {line_no}: buckets not increasing')
+        if entry['count'] is not None and entry['count'] != buckets[-1][1]:
+            raise CheckError(f'{family}: _count differs from the +Inf bucket')
+
+
+def check(text):
+    if not text.endswith('# EOF\n'):
+        raise CheckError('missing "# EOF" at the end')
+    families = {}
+    family = None
+    seen = set()
+    for line_no, line in enumerate(text[:-len('# EOF\n')].split('\n')[:-1], 1):
+        match = METADATA.match(line)
+        if match:
+            kind, name, value = match.groups()
+            if family is None or family['name'] != name:
+                if name in families:
+                    raise CheckError(f'line {line_no}: family {name} is not contiguous')
+                family = families[name] = {'name': name, 'type': 'unknown', 'samples': []}
+            if kind == 'TYPE':
+                if value not in TYPES or family['samples']:
+                    raise CheckError(f'line {line_no}: bad TYPE')
+                family['type'] = value
+            elif kind == 'UNIT' and not name.endswith('_' + value):
+                raise CheckError(f'line {line_no}: name does not end with its unit')
+            continue
+        match = SAMPLE.match(line)
+        if match is None:
+            raise CheckError(f'line {line_no}: not a sample or metadata: "{line}"')
+        name, _, label_text, value = match.groups()
+        if family is None or name[len(family['name']):] not in SUFFIXES.get(family['type'], ('',)) or \
+                not name.startswith(family['name']):
+            raise CheckError(f'line {line_no}: sample {name} outside its family')
+        labels = parse_labels(label_text or '', line_no)
+        key = (name, tuple(sorted(labels.items())))
+        if key in seen:
+            raise CheckError(f'line {line_no}: repeated sample')
+        seen.add(key)
+        family['samples'].append((name, labels, parse_value(value, line_no), line_no))
+    for family in families.values():
+        if family['type'] == 'histogram':
+            check_histogram(family['name'], family['samples'])
+    return sum(len(f['samples']) for f in families.values()), len(families)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('file', nargs='?', type=argparse.FileType('r'), default=sys.stdin)
+    text = parser.parse_args().file.read()
+    try:
+        from prometheus_client.openmetrics.parser import text_string_to_metric_families
+    except ImportError:
+        text_string_to_metric_families = None
+    try:
+        if text_string_to_metric_families is not None:
+            list(text_string_to_metric_families(text))
+        samples, families = check(text)
+    except (CheckError, ValueError) as error:
+        print(f'error: {error}', file=sys.stderr)
+        return 1
+    print(f'{samples} samples in {families} families', file=sys.stderr)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
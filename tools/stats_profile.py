@@ -0,0 +1,179 @@
+#!/usr/bin/env python3
+"""Symbolise stats_profiler_dump() output into flat or folded profiles.
+
+Usage: stats_profile.py [console.log] --elf app.elf [--folded] [-o FILE]
+
+Lines that do not contain "stats_profile," are ignored, so a raw console log
+can be fed in directly. Addresses are looked up with addr2line, picked from
+the ELF's machine type (the ESP-IDF Xtensa or RISC-V toolchain, or the host's
+own) unless --addr2line names one.
+
+The flat profile lists functions by the samples taken in them (self) and in
+them or their callees (total). Addresses the ELF does not cover are grouped
+by the module holding them ("[libc.so.6]", "[rom]"), or as "[unknown]". The
+folded profile has one line per distinct
+stack, "task;outer;...;inner count", for flamegraph.pl or speedscope.
+"""
+
+import argparse
+import bisect
+import collections
+import os
+import shutil
+import subprocess
+import sys
+
+PREFIX = 'stats_profile,'
+FORMAT_VERSION = 1
+EM_XTENSA = 94
+EM_RISCV = 243
+ADDR2LINE = {
+    EM_XTENSA: ('xtensa-esp-elf-addr2line', 'xtensa-esp32-elf-addr2line', 'xtensa-esp32s3-elf-addr2line',
+                'xtensa-esp32s2-elf-addr2line'),
+    EM_RISCV: ('riscv32-esp-elf-addr2line',),
+}
+
+
+class Profile:
+    def __init__(self):
+        self.hz = 0
+        self.base = 0
+        self.names = {}
+        self.modules = []       # (start, end, name), sorted
+        self.samples = []       # (core, task, [pc, return address, ...])
+        self.dropped = {}
+
+
+def parse(lines):
+    profile = Profile()
+    for line in lines:
+        line = line.rstrip('\r\n')
+        start = line.find(PREFIX)
+        if start < 0:
+            continue
+        fields = line[start + len(PREFIX):].split(',')
+        kind = fields[0]
+        if kind == 'V':
+            if int(fields[1]) != FORMAT_VERSION:
+                raise ValueError('unsupported profile format version ' + fields[1])
+        elif kind == 'H':
+            profile.hz = int(fields[1])
+        elif kind == 'B':
+            profile.base = int(fields[1], 16)
+        elif kind == 'M':
+            profile.modules.append((int(fields[1], 16), int(fields[2], 16), ','.join(fields[3:])))
+        elif kind == 'T':
+            profile.names[int(fields[1], 16)] = ','.join(fields[2:])
+        elif kind == 'D':
+            profile.dropped[int(fields[1])] = int(fields[2])
+        elif kind == 'S':
+            profile.samples.append((int(fields[1]), int(fields[2], 16), [int(pc, 16) for pc in fields[3:]]))
+    profile.modules.sort()
+    return profile
+
+
+def find_addr2line(elf):
+    with open(elf, 'rb') as file:
+        header = file.read(20)
+    if header[:4] != b'\x7fELF':
+        raise ValueError(elf + ' is not an ELF file')
+    machine = int.from_bytes(header[18:20], 'little' if header[5] == 1 else 'big')
+    for tool in ADDR2LINE.get(machine, ('addr2line',)):
+        if shutil.which(tool):
+            return tool
+    raise ValueError('no addr2line found for machine type %d, use --addr2line' % machine)
+
+
+def symbolise(profile, elf, addr2line):
+    """Map the sampled addresses to function names, leaving out those outside the ELF."""
+    # Return addresses point after the call, which may be the next line or function
+    lookups = set()
+    for _, _, pcs in profile.samples:
+        lookups.update(lookup_address(profile, pc, i) for i, pc in enumerate(pcs))
+    lookups = sorted(a for a in lookups if a >= 0)
+    result = subprocess.run([addr2line, '-e', elf, '-f', '-C', '-a'], input='\n'.join('%x' % a for a in lookups),
+                            capture_output=True, text=True, check=True)
+    out = result.stdout.splitlines()
+    names = {}
+    for i, address in enumerate(lookups):
+        name = out[3 * i + 1] if 3 * i + 1 < len(out) else '??'
+        if name != '??':
+            names[address] = name
+    return names
+
+
+def lookup_address(profile, pc, index):
+    return pc - profile.base - (1 if index > 0 else 0)
+
+
+def module_name(profile, pc):
+    """Name of the module holding an address the ELF does not cover, as one pseudo function per module."""
+    i = bisect.bisect_right(profile.modules, (pc, float('inf'), '')) - 1
+    if i >= 0 and pc < profile.modules[i][1]:
+        return '[%s]' % os.path.basename(profile.modules[i][2])
+    return '[unknown]'
+
+
+def stacks(profile, names, with_task):
+    """Yield (task name, [outermost function, ..., sampled function]) per sample."""
+    for _, task, pcs in profile.samples:
+        frames = []
+        for i, pc in enumerate(pcs):
+            address = lookup_address(profile, pc, i)
+            name = names.get(address)
+            frames.append(name if name is not None else module_name(profile, pc))
+        frames.reverse()
+        task_name = profile.names.get(task, 'task-%x' % task)
+        yield task_name, frames if not with_task else [task_name] + frames
+
+
+def write_flat(profile, names, out):
+    self_counts = collections.Counter()
+    total_counts = collections.Counter()
+    for _, frames in stacks(profile, names, False):
+        self_counts[frames[-1]] += 1
+        for function in set(frames):
+            total_counts[function] += 1
+    sample_num = len(profile.samples)
+    out.write('%d samples at %d Hz' % (sample_num, profile.hz))
+    for core, dropped in sorted(profile.dropped.items()):
+        out.write(', %d dropped on core %d' % (dropped, core))
+    out.write('\n%7s %7s %7s %7s  %s\n' % ('self%', 'self', 'total%', 'total', 'function'))
+    for function, total in sorted(total_counts.items(), key=lambda item: (-self_counts[item[0]], -item[1])):
+        count = self_counts[function]
+        out.write('%6.1f%% %7d %6.1f%% %7d  %s\n' % (100 * count / sample_num, count, 100 * total / sample_num,
+                                                   total, function))
+
+
+def write_folded(profile, names, out, with_task):
+    counts = collections.Counter(';'.join(frames) for _, frames in stacks(profile, names, with_task))
+    for stack, count in sorted(counts.items()):
+        out.write('%s %d\n' % (stack, count))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('log', nargs='?', type=argparse.FileType('r'), default=sys.stdin)
+    parser.add_argument('--elf', required=True, help='image the samples were taken from')
+    parser.add_argument('--addr2line', help='addr2line of the toolchain that built the ELF')
+    parser.add_argument('--folded', action='store_true', help='write folded stacks instead of the flat profile')
+    parser.add_argument('--no-task', action='store_true', help='leave the task out of folded stacks')
+    parser.add_argument('-o', '--output', type=argparse.FileType('w'), default=sys.stdout)
+    args = parser.parse_args()
+    try:
+        profile = parse(args.log)
+        if not profile.samples:
+            raise ValueError('no samples found')
+        names = symbolise(profile, args.elf, args.addr2line or find_addr2line(args.elf))
+    except (OSError, ValueError, subprocess.CalledProcessError) as error:
+        print('error: %s' % error, file=sys.stderr)
+        return 1
+    if args.folded:
+        write_folded(profile, names, args.output, not args.no_task)
+    else:
+        write_flat(profile, names, args.output)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
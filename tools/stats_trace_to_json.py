@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+"""Convert stats_trace_dump() output into Chrome trace event JSON.
+
+Usage: stats_trace_to_json.py [console.log] > trace.json
+
+Lines that do not start with "stats_trace," are ignored, so a raw console log
+can be fed in directly. Every core becomes a process and every task a thread;
+begin/end pairs become complete ("X") events. Events whose partner was
+overwritten in the ring are dropped.
+"""
+
+import argparse
+import json
+import sys
+
+PREFIX = 'stats_trace,'
+FORMAT_VERSION = 1
+FIELD_NUM = {'T': 2, 'E': 5}   # fields before the name, the kind included
+
+
+def parse(lines):
+    names = {}
+    events = []
+    dropped = {}
+    for line in lines:
+        line = line.rstrip('\r\n')
+        start = line.find(PREFIX)
+        if start < 0:
+            continue
+        record = line[start + len(PREFIX):]
+        kind = record.split(',', 1)[0]
+        # Names come last and may contain commas, so split only up to them
+        fields = record.split(',', FIELD_NUM.get(kind, 2))
+        if kind == 'V':
+            if int(fields[1]) != FORMAT_VERSION:
+                raise ValueError('unsupported trace format version ' + fields[1])
+        elif kind == 'T':
+            names[int(fields[1], 16)] = fields[2]
+        elif kind == 'D':
+            dropped[int(fields[1])] = int(fields[2])
+        elif kind == 'E':
+            core, task, phase, ts, zone = fields[1:6]
+            events.append((int(ts), int(core), int(task, 16), phase, zone))
+    events.sort(key=lambda e: e[0])
+    return names, events, dropped
+
+
+def to_chrome(names, events, dropped):
+    out = []
+    open_zones = {}     # (task, zone) -> (begin time, core)
+    cores = set()
+    tasks = set()
+    for ts, core, task, phase, zone in events:
+        key = (task, zone)
+        if phase == 'B':
+            open_zones[key] = (ts, core)
+        elif key in open_zones:
+            begin, begin_core = open_zones.pop(key)
+            cores.add(begin_core)
+            tasks.add((begin_core, task))
+            out.append({
+                'name': zone,
+                'ph': 'X',
+                'ts': begin,
+                'dur': ts - begin,
+                'pid': begin_core,
+                'tid': task,
+                'args': {'end_core': core} if core != begin_core else {},
+            })
+    for core in sorted(cores):
+        args = {'name': 'core %d' % core}
+        if dropped.get(core):
+            args['name'] += ' (%d events dropped)' % dropped[core]
+        out.append({'name': 'process_name', 'ph': 'M', 'pid': core, 'args': args})
+    for core, task in sorted(tasks):
+        out.append({'name': 'thread_name', 'ph': 'M', 'pid': core, 'tid': task,
+                    'args': {'name': names.get(task, 'task-%x' % task)}})
+    return {'traceEvents': out, 'displayTimeUnit': 'ms'}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('log', nargs='?', type=argparse.FileType('r'), default=sys.stdin)
+    parser.add_argument('-o', '--output', type=argparse.FileType('w'), default=sys.stdout)
+    args = parser.parse_args()
+    json.dump(to_chrome(*parse(args.log)), args.output)
+    args.output.write('\n')
+
+
+if __name__ == '__main__':
+    main()